@@ -0,0 +1,77 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_GRADIENT_H_9B27F0C4
+#define KEYLEDSD_GRADIENT_H_9B27F0C4
+
+#include <cstdint>
+#include <vector>
+#include "keyledsd/RenderTarget.h"
+#include "keyledsd/colors.h"
+#include "keyledsd_config.h"
+
+namespace keyleds {
+
+/****************************************************************************/
+
+/** Phase-driven color gradient
+ *
+ * Renders effects where every key cycles through a shared color table, each
+ * with its own phase offset. Phases and key masks are stored as flat arrays,
+ * indexed like render targets, so rendering a frame is a single gather pass
+ * over the color table.
+ *
+ * Keys are disabled until they are given a phase. Disabled keys are rendered
+ * as transparent black.
+ */
+class KEYLEDSD_EXPORT Gradient final
+{
+public:
+    using size_type = RenderTarget::size_type;
+    using phase_type = std::uint32_t;
+    using color_table = std::vector<RGBAColor>;
+
+    static constexpr phase_type resolution = 1024;  ///< Number of entries in color tables
+public:
+    explicit        Gradient(size_type size);
+                    ~Gradient();
+
+    /// Sets color table, which must have resolution entries
+    void            setTable(color_table);
+    /// Enables key at given render target index, with given phase shift
+    void            setPhase(size_type idx, phase_type phase);
+    void            disable(size_type idx);
+
+    /// Renders into target, with time t expressed in table entries
+    void            render(phase_type t, RenderTarget & target) const;
+
+    /// Builds a color table looping through given colors, with linear interpolation
+    static color_table interpolate(const std::vector<RGBAColor> & colors);
+    /// Builds a table of given size going once through given colors, first to last,
+    /// with linear interpolation. Suits value-to-color mappings rather than cycles.
+    static color_table ramp(const std::vector<RGBAColor> & colors, color_table::size_type size);
+
+private:
+    color_table                 m_table;    ///< Color samples, resolution entries
+    std::vector<phase_type>     m_phases;   ///< Phase shift of each key, in table entries
+    std::vector<std::uint32_t>  m_keep;     ///< All ones for enabled keys, zero otherwise
+};
+
+/****************************************************************************/
+
+} // namespace keyleds
+
+#endif
@@ -17,9 +17,12 @@
 #ifndef KEYLEDSD_KEYDATABASE_H_E8A1B5AF
 #define KEYLEDSD_KEYDATABASE_H_E8A1B5AF
 
+#include <cstddef>
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
+#include "keyledsd/KeyMask.h"
 #include "keyledsd/RenderTarget.h"
 #include "keyledsd_config.h"
 
@@ -55,14 +58,31 @@ public:
 
     class KeyGroup;
 
+    struct Point final { position_type x, y; };
+
+    /// Key adjacency graph, in compressed sparse row form: neighbours of key
+    /// with index i are indices[offsets[i]] up to indices[offsets[i + 1]].
+    struct Adjacency final
+    {
+        std::vector<unsigned>   offsets;    ///< One entry per key, plus one
+        std::vector<unsigned>   indices;    ///< Neighbour key indices, grouped by key
+    };
+
 private:
-    struct Relation final
+    /// Uniform grid over key centers, used to answer spatial queries
+    struct Grid final
     {
-        position_type   distance;
+        Point           origin;         ///< Position of top-left cell
+        position_type   cellSize;       ///< Width and height of a cell
+        unsigned        columns;
+        unsigned        rows;
+        std::vector<unsigned> cellStart;///< Offset of each cell's first key in cellKeys
+        std::vector<unsigned> cellKeys; ///< Key indices, grouped by cell
     };
 
     using key_list = std::vector<Key>;
-    using relation_list = std::vector<Relation>;
+    using point_list = std::vector<Point>;
+    using index_table = std::vector<unsigned>;
 public:
     using value_type = key_list::value_type;
     using reference = key_list::const_reference;
@@ -70,6 +90,7 @@ public:
     using const_iterator = key_list::const_iterator;
     using difference_type = key_list::difference_type;
     using size_type = key_list::size_type;
+    using index_list = std::vector<size_type>;
 public:
                     KeyDatabase(key_list keys);
     explicit        KeyDatabase(const KeyDatabase &) = default;
@@ -77,7 +98,9 @@ public:
                     ~KeyDatabase();
 
     const_iterator  findKeyCode(int keyCode) const;
-    const_iterator  findName(const std::string & name) const;
+    const_iterator  findName(const char * name, std::size_t size) const;
+    const_iterator  findName(const std::string & name) const
+                        { return findName(name.data(), name.size()); }
 
     const_iterator  begin() const { return m_keys.cbegin(); }
     const_iterator  end() const { return m_keys.cend(); }
@@ -85,22 +108,49 @@ public:
     size_type       size() const noexcept { return m_keys.size(); }
 
     Key::Rect       bounds() const { return m_bounds; }
+    Point           center(const Key & key) const { return m_centers[key.index]; }
     position_type   distance(const Key &, const Key &) const;
     double          angle(const Key &, const Key &) const;
 
+    /// Spatial queries. They match keys by their center, ignoring keys with
+    /// no known position. Matching key indices are stored into the given list,
+    /// which is cleared first, so callers can reuse it to avoid allocations.
+    void            findInRect(const Key::Rect &, index_list &) const;
+    void            findInRadius(Point center, position_type radius, index_list &) const;
+    /// Finds keys within width/2 of segment [from, to], ordered from start to end
+    void            findAlongLine(Point from, Point to, position_type width, index_list &) const;
+    const_iterator  findNearest(Point) const;
+
+    /// Keys whose rectangles touch or nearly touch, computed once at creation
+    const Adjacency & adjacency() const noexcept { return m_adjacency; }
+
     /// Builds a KeyGroup with given name; first and last define a sequence of
     /// string defining key names for the group. Invalid names are ignored.
     template<typename It> KeyGroup makeGroup(std::string name, It first, It last) const;
+    /// Builds a KeyGroup with given name holding keys set in mask, in index order.
+    KeyGroup        makeGroup(std::string name, const KeyMask & mask) const;
 
 private:
     /// Computes m_bounds, invoked once at initialization
     static Key::Rect computeBounds(const key_list &);
-    static relation_list computeRelations(const key_list &);
+    /// Invokes visitor with the index of each positioned key centered in rect
+    template <typename Visitor> void visitRect(const Key::Rect &, Visitor &&) const;
+
+    static point_list computeCenters(const key_list &);
+    static Grid computeGrid(const key_list &, const point_list &);
+    Adjacency computeAdjacency() const;
+    /// Build open-addressing hash tables mapping key codes / names to indices
+    static index_table computeCodeIndex(const key_list &);
+    static index_table computeNameIndex(const key_list &);
 
 private:
     const key_list      m_keys;         ///< Vector of all keys known for a device
     const Key::Rect     m_bounds;       ///< Bounds of m_keys' positions
-    const relation_list m_relations;    ///< Pre-computed relation array
+    const point_list    m_centers;      ///< Center of each key, by index
+    const Grid          m_grid;         ///< Spatial index over m_centers
+    const Adjacency     m_adjacency;    ///< Neighbour graph, built from m_grid
+    const index_table   m_codeIndex;    ///< Hash table of m_keys indices by keyCode
+    const index_table   m_nameIndex;    ///< Hash table of m_keys indices by name
 };
 
 /****************************************************************************/
@@ -113,6 +163,9 @@ private:
  *
  * Moving or destroying the KeyDatabase the KeyGroup's keys live in invalidates
  * the KeyGroup.
+ *
+ * Alongside the key sequence, a KeyMask of member key indices is maintained,
+ * for constant-time membership tests and set operations.
  */
 class KeyDatabase::KeyGroup final
 {
@@ -165,19 +218,22 @@ public:
     size_type       size() const noexcept { return m_keys.size(); }
     size_type       max_size() const { return m_keys.max_size(); }
 
-    void            clear() { m_keys.clear(); }
-    const_iterator  erase(const_iterator it)
-                        { return const_iterator(m_keys.erase(it.get())); }
+    bool            contains(const Key & key) const noexcept { return m_mask.test(key.index); }
+    const KeyMask & mask() const noexcept { return m_mask; }
+
+    void            clear() { m_keys.clear(); m_mask.clear(); }
+    const_iterator  erase(const_iterator it);
     const_iterator  insert(const_iterator pos, KeyDatabase::iterator it)
-                        { return const_iterator(m_keys.insert(pos.get(), it)); }
-    void            push_back(KeyDatabase::iterator it) { m_keys.push_back(it); }
-    void            pop_back() { m_keys.pop_back(); }
+                        { m_mask.set(it->index); return const_iterator(m_keys.insert(pos.get(), it)); }
+    void            push_back(KeyDatabase::iterator it) { m_mask.set(it->index); m_keys.push_back(it); }
+    void            pop_back() { erase(std::prev(end())); }
 
     void            shrink_to_fit() { m_keys.shrink_to_fit(); }
     void            swap(KeyGroup &) noexcept;
 private:
     std::string     m_name;
     key_list        m_keys;
+    KeyMask         m_mask;     ///< Indices of keys in m_keys
 };
 
 /****************************************************************************/
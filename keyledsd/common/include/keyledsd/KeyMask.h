@@ -0,0 +1,154 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_KEYMASK_H_4C0E93D1
+#define KEYLEDSD_KEYMASK_H_4C0E93D1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace keyleds {
+
+/****************************************************************************/
+
+/** Set of key indices
+ *
+ * Compact bitmap over key indices, as used in render targets and key
+ * databases. Bit N is set if key with index N belongs to the set. Words
+ * are exposed so rendering code can process masks a word at a time.
+ * Masks grow as needed; missing words are treated as zeroes.
+ */
+class KeyMask final
+{
+public:
+    using word_type = std::uint64_t;
+    using size_type = std::size_t;
+    static constexpr size_type word_bits = 8 * sizeof(word_type);
+private:
+    using word_list = std::vector<word_type>;
+public:
+                    KeyMask() = default;
+    explicit        KeyMask(size_type bits) : m_words((bits + word_bits - 1) / word_bits, 0) {}
+
+    bool            test(size_type idx) const noexcept
+                        { return idx / word_bits < m_words.size() &&
+                                 (m_words[idx / word_bits] >> (idx % word_bits)) & 1; }
+    void            set(size_type idx)
+                        { reserveBit(idx); m_words[idx / word_bits] |= word_type(1) << (idx % word_bits); }
+    void            reset(size_type idx) noexcept
+                        { if (idx / word_bits < m_words.size()) {
+                              m_words[idx / word_bits] &= ~(word_type(1) << (idx % word_bits)); } }
+    void            clear() noexcept { std::fill(m_words.begin(), m_words.end(), 0); }
+
+    bool            any() const noexcept;
+    bool            none() const noexcept { return !any(); }
+    size_type       count() const noexcept;
+
+    const word_type * words() const noexcept { return m_words.data(); }
+    size_type       nbWords() const noexcept { return m_words.size(); }
+
+    /// Invokes func with the index of each set bit, in increasing order
+    template <typename Func> void forEach(Func && func) const;
+
+    KeyMask &       operator|=(const KeyMask &);
+    KeyMask &       operator&=(const KeyMask &) noexcept;
+    KeyMask &       operator^=(const KeyMask &);
+    KeyMask &       operator-=(const KeyMask &) noexcept;   ///< set difference
+
+    friend bool     operator==(const KeyMask &, const KeyMask &) noexcept;
+
+private:
+    void            reserveBit(size_type idx)
+                        { if (idx / word_bits >= m_words.size()) { m_words.resize(idx / word_bits + 1, 0); } }
+
+private:
+    word_list       m_words;
+};
+
+/****************************************************************************/
+
+inline bool KeyMask::any() const noexcept
+{
+    return std::any_of(m_words.begin(), m_words.end(), [](auto word) { return word != 0; });
+}
+
+inline KeyMask::size_type KeyMask::count() const noexcept
+{
+    size_type result = 0;
+    for (auto word : m_words) { result += size_type(__builtin_popcountll(word)); }
+    return result;
+}
+
+template <typename Func> void KeyMask::forEach(Func && func) const
+{
+    for (size_type widx = 0; widx < m_words.size(); ++widx) {
+        for (auto word = m_words[widx]; word != 0; word &= word - 1) {
+            func(widx * word_bits + size_type(__builtin_ctzll(word)));
+        }
+    }
+}
+
+inline KeyMask & KeyMask::operator|=(const KeyMask & other)
+{
+    if (other.m_words.size() > m_words.size()) { m_words.resize(other.m_words.size(), 0); }
+    for (size_type idx = 0; idx < other.m_words.size(); ++idx) { m_words[idx] |= other.m_words[idx]; }
+    return *this;
+}
+
+inline KeyMask & KeyMask::operator&=(const KeyMask & other) noexcept
+{
+    const auto common = std::min(m_words.size(), other.m_words.size());
+    for (size_type idx = 0; idx < common; ++idx) { m_words[idx] &= other.m_words[idx]; }
+    std::fill(m_words.begin() + common, m_words.end(), 0);
+    return *this;
+}
+
+inline KeyMask & KeyMask::operator^=(const KeyMask & other)
+{
+    if (other.m_words.size() > m_words.size()) { m_words.resize(other.m_words.size(), 0); }
+    for (size_type idx = 0; idx < other.m_words.size(); ++idx) { m_words[idx] ^= other.m_words[idx]; }
+    return *this;
+}
+
+inline KeyMask & KeyMask::operator-=(const KeyMask & other) noexcept
+{
+    const auto common = std::min(m_words.size(), other.m_words.size());
+    for (size_type idx = 0; idx < common; ++idx) { m_words[idx] &= ~other.m_words[idx]; }
+    return *this;
+}
+
+inline bool operator==(const KeyMask & a, const KeyMask & b) noexcept
+{
+    const auto & shorter = a.m_words.size() < b.m_words.size() ? a.m_words : b.m_words;
+    const auto & longer = a.m_words.size() < b.m_words.size() ? b.m_words : a.m_words;
+    return std::equal(shorter.begin(), shorter.end(), longer.begin()) &&
+           std::all_of(longer.begin() + shorter.size(), longer.end(),
+                       [](auto word) { return word == 0; });
+}
+inline bool operator!=(const KeyMask & a, const KeyMask & b) noexcept { return !(a == b); }
+
+inline KeyMask operator|(KeyMask a, const KeyMask & b) { return a |= b; }
+inline KeyMask operator&(KeyMask a, const KeyMask & b) { return a &= b; }
+inline KeyMask operator^(KeyMask a, const KeyMask & b) { return a ^= b; }
+inline KeyMask operator-(KeyMask a, const KeyMask & b) { return a -= b; }
+
+/****************************************************************************/
+
+} // namespace keyleds
+
+#endif
@@ -0,0 +1,115 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_ONDEMANDTHREAD_H_3F81C6B2
+#define KEYLEDSD_ONDEMANDTHREAD_H_3F81C6B2
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace keyleds {
+
+/****************************************************************************/
+
+/** Helper thread that only runs while its effect is rendered
+ *
+ * Effects call touch() from render(). The first call starts the thread,
+ * which runs the body given at construction. The body loops while running()
+ * returns true. That stops being the case once stop() is called, or
+ * when touch() has not been called for the idle delay, as happens for
+ * effect groups that are loaded but not displayed. A later touch() then
+ * starts the body again. If the body returns on its own while still wanted,
+ * for instance because its source failed, it is not restarted.
+ *
+ * Bodies wait through sleepUntil(), which returns early when stopping.
+ */
+class OnDemandThread final
+{
+public:
+    using clock = std::chrono::steady_clock;
+public:
+    explicit        OnDemandThread(std::function<void()> body,
+                                   clock::duration idleDelay = std::chrono::seconds(1))
+                     : m_body(std::move(body)), m_idleDelay(idleDelay) {}
+                    OnDemandThread(const OnDemandThread &) = delete;
+                    ~OnDemandThread() { stop(); }
+
+    /// Stops the thread for good, for owners that must release resources it uses
+    void            stop()
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock(m_mutex);
+                            m_stopping = true;
+                        }
+                        m_condition.notify_all();
+                        if (m_thread.joinable()) { m_thread.join(); }
+                        m_state = State::Finished;
+                    }
+
+    /// Render side: marks the thread as wanted, starting it if it is not running
+    void            touch()
+                    {
+                        m_lastTouch = clock::now().time_since_epoch().count();
+                        if (m_state.load() != State::Idle) { return; }
+                        if (m_thread.joinable()) { m_thread.join(); }
+                        m_state = State::Running;
+                        m_thread = std::thread([this] {
+                            m_idled = false;
+                            m_body();
+                            m_state = m_idled ? State::Idle : State::Finished;
+                        });
+                    }
+
+    /// Thread side: whether the body should keep looping
+    bool            running()
+                    {
+                        if (m_stopping) { return false; }
+                        const auto idleFor = clock::now() - clock::time_point(
+                            clock::duration(m_lastTouch.load()));
+                        m_idled = idleFor > m_idleDelay;
+                        return !m_idled;
+                    }
+
+    /// Thread side: waits until given time, or until the thread is stopped
+    void            sleepUntil(clock::time_point time)
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_condition.wait_until(lock, time, [this] { return m_stopping.load(); });
+                    }
+
+private:
+    enum class State { Idle, Running, Finished };
+
+    const std::function<void()> m_body;         ///< thread main loop
+    const clock::duration       m_idleDelay;    ///< time without touch() before thread pauses
+    std::atomic<clock::rep>     m_lastTouch{0}; ///< time of last touch(), since clock epoch
+    std::atomic<State>          m_state{State::Idle};
+    bool                        m_idled = false;    ///< thread side: body stopped for idling
+    std::atomic<bool>           m_stopping{false};  ///< set by stop(), under m_mutex
+    std::mutex                  m_mutex;
+    std::condition_variable     m_condition;        ///< wakes sleepUntil() on stop()
+    std::thread                 m_thread;
+};
+
+/****************************************************************************/
+
+} // namespace keyleds
+
+#endif
@@ -63,6 +63,9 @@ public:
     reference                   operator[](size_type idx) { return m_colors[idx]; }
     const_reference             operator[](size_type idx) const { return m_colors[idx]; }
 
+    /// Returns the capacity a render target of given size allocates
+    static size_type            capacityFor(size_type size);
+
 private:
     RGBAColor *                 m_colors;       ///< Color buffer. RGBAColor is a POD type
     size_type                   m_size;         ///< Number of color entries
@@ -0,0 +1,71 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_TRIPLEBUFFER_H_9A5D27E4
+#define KEYLEDSD_TRIPLEBUFFER_H_9A5D27E4
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace keyleds {
+
+/****************************************************************************/
+
+/** Single-producer, single-consumer latest-value hand-off
+ *
+ * Lets a helper thread pass fixed-size arrays to the render thread. The
+ * producer fills the back buffer and swaps it with the middle one, the
+ * consumer swaps the middle one with its front buffer when it holds fresh
+ * data. Neither side ever waits for the other; intermediate values the
+ * consumer did not pick up in time are dropped.
+ */
+template <typename T>
+class TripleBuffer final
+{
+    static constexpr unsigned fresh = 4;    ///< flag set in m_middle when it was published
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+public:
+    explicit        TripleBuffer(size_type size, const T & value = T())
+                        { for (auto & buffer : m_buffers) { buffer.assign(size, value); } }
+                    TripleBuffer(const TripleBuffer &) = delete;
+
+    size_type       size() const noexcept { return m_buffers[0].size(); }
+
+    /// Producer side: buffer to fill, then publish
+    T *             back() noexcept { return m_buffers[m_back].data(); }
+    void            publish() noexcept { m_back = m_middle.exchange(m_back | fresh) & ~fresh; }
+
+    /// Consumer side: latest published buffer, valid until next call
+    const T *       front() noexcept
+                        { if (m_middle.load() & fresh) { m_front = m_middle.exchange(m_front) & ~fresh; }
+                          return m_buffers[m_front].data(); }
+
+private:
+    std::array<std::vector<T>, 3> m_buffers;
+    unsigned                m_front = 0;        ///< only touched by consumer
+    unsigned                m_back = 1;         ///< only touched by producer
+    std::atomic<unsigned>   m_middle{2};        ///< buffer index, plus fresh flag
+};
+
+/****************************************************************************/
+
+} // namespace keyleds
+
+#endif
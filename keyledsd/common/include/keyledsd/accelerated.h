@@ -41,6 +41,26 @@ extern "C" {
  */
 void blend(uint8_t * a, const uint8_t * b, unsigned length);
 
+/** Sample a color table at per-entry phases
+ *
+ * For each entry, look up the table at the entry's phase, offset by a
+ * common time value, and mask the result, that is, compute:
+ * \f$dst_n=table[(t - phase_n) \land mask] \land keep_n\f$
+ *
+ * The sampling uses AVX2 gathers or SSE2 if available.
+ *
+ * @param[out] dst An array of R8G8B8A8 colors receiving the result. Must be 32-byte aligned.
+ * @param table An array of R8G8B8A8 colors with mask + 1 entries.
+ * @param mask Index mask, applied to phases. Table size minus one, must be a power of two minus one.
+ * @param phases Per-entry phase, in table entries.
+ * @param keep Per-entry mask applied to sampled color, typically either all bits or none.
+ * @param t Time value, in table entries.
+ * @param length The number of entries in dst, phases and keep. Must be a multiple of 8.
+ * @note Arrays must not overlap.
+ */
+void gradient(uint32_t * dst, const uint32_t * table, unsigned mask,
+              const uint32_t * phases, const uint32_t * keep, unsigned t, unsigned length);
+
 #ifdef __cplusplus
 }
 } // namespace keyleds
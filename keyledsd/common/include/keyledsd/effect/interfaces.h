@@ -17,6 +17,7 @@
 #ifndef KEYLEDSD_EFFECT_INTERFACES_H_07881F1A
 #define KEYLEDSD_EFFECT_INTERFACES_H_07881F1A
 
+#include <cstddef>
 #include <string>
 #include <vector>
 #include "keyledsd/KeyDatabase.h"
@@ -53,6 +54,10 @@ public:
 
     /// Return a Renderer interface that can draw the effect into a RenderTarget
     virtual Renderer * renderer() = 0;
+
+    /// Return an estimate of memory held by the effect, in bytes. Render targets
+    /// obtained from EffectService need not be included. Used for cache accounting.
+    virtual std::size_t memoryUsage() const = 0;
 };
 
 /// Manages communication with engine
@@ -94,6 +99,12 @@ public:
     virtual const std::string & getFile(const std::string &) = 0;
 
     virtual void                log(unsigned, const char *) = 0;
+
+    // Newer entry points go below, to keep existing vtable slots in place
+
+    /// Locates a data file the way getFile does, returning its actual path
+    /// or an empty string. Lets plugins map large files instead of reading them.
+    virtual std::string         findFile(const std::string &) const = 0;
 };
 
 /****************************************************************************/
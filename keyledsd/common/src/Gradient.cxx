@@ -0,0 +1,116 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/Gradient.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include "keyledsd/accelerated.h"
+
+using keyleds::Gradient;
+
+static_assert(sizeof(keyleds::RGBAColor) == sizeof(std::uint32_t),
+              "RGBAColor must be packed for gradient kernel");
+static_assert(Gradient::resolution && (Gradient::resolution & (Gradient::resolution - 1)) == 0,
+              "resolution must be a power of two");
+
+/****************************************************************************/
+
+// Arrays are sized to render target capacity, so kernels run on full vectors
+Gradient::Gradient(size_type size)
+ : m_table(resolution, RGBAColor{0, 0, 0, 0}),
+   m_phases(RenderTarget::capacityFor(size), 0),
+   m_keep(m_phases.size(), 0)
+{}
+
+Gradient::~Gradient() {}
+
+void Gradient::setTable(color_table table)
+{
+    if (table.size() != resolution) {
+        throw std::invalid_argument("gradient color table has wrong size");
+    }
+    m_table = std::move(table);
+}
+
+void Gradient::setPhase(size_type idx, phase_type phase)
+{
+    m_phases[idx] = phase;
+    m_keep[idx] = ~std::uint32_t(0);
+}
+
+void Gradient::disable(size_type idx)
+{
+    m_phases[idx] = 0;
+    m_keep[idx] = 0;
+}
+
+void Gradient::render(phase_type t, RenderTarget & target) const
+{
+    assert(target.capacity() == m_phases.size());
+    if (m_phases.empty()) { return; }
+
+    gradient(reinterpret_cast<std::uint32_t *>(target.data()),
+             reinterpret_cast<const std::uint32_t *>(m_table.data()), resolution - 1,
+             m_phases.data(), m_keep.data(), t, unsigned(m_phases.size()));
+}
+
+Gradient::color_table Gradient::interpolate(const std::vector<RGBAColor> & colors)
+{
+    color_table table(resolution, RGBAColor{0, 0, 0, 0});
+
+    for (color_table::size_type range = 0; range < colors.size(); ++range) {
+        auto first = range * table.size() / colors.size();
+        auto last = (range + 1) * table.size() / colors.size();
+        auto colorA = colors[range];
+        auto colorB = colors[range + 1 >= colors.size() ? 0 : range + 1];
+
+        for (color_table::size_type idx = first; idx < last; ++idx) {
+            float ratio = float(idx - first) / float(last - first);
+
+            table[idx] = RGBAColor{
+                RGBAColor::channel_type(colorA.red * (1.0f - ratio) + colorB.red * ratio),
+                RGBAColor::channel_type(colorA.green * (1.0f - ratio) + colorB.green * ratio),
+                RGBAColor::channel_type(colorA.blue * (1.0f - ratio) + colorB.blue * ratio),
+                RGBAColor::channel_type(colorA.alpha * (1.0f - ratio) + colorB.alpha * ratio),
+            };
+        }
+    }
+    return table;
+}
+
+Gradient::color_table Gradient::ramp(const std::vector<RGBAColor> & colors, color_table::size_type size)
+{
+    color_table table(size, colors.empty() ? RGBAColor{0, 0, 0, 0} : colors.front());
+    if (colors.size() < 2 || size < 2) { return table; }
+
+    for (color_table::size_type idx = 0; idx < size; ++idx) {
+        const float position = float(idx) * float(colors.size() - 1) / float(size - 1);
+        const auto range = std::min(color_table::size_type(position), colors.size() - 2);
+        const float ratio = position - float(range);
+        const auto & colorA = colors[range];
+        const auto & colorB = colors[range + 1];
+
+        table[idx] = RGBAColor{
+            RGBAColor::channel_type(colorA.red * (1.0f - ratio) + colorB.red * ratio),
+            RGBAColor::channel_type(colorA.green * (1.0f - ratio) + colorB.green * ratio),
+            RGBAColor::channel_type(colorA.blue * (1.0f - ratio) + colorB.blue * ratio),
+            RGBAColor::channel_type(colorA.alpha * (1.0f - ratio) + colorB.alpha * ratio),
+        };
+    }
+    return table;
+}
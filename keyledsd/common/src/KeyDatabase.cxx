@@ -18,16 +18,80 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
 
 using keyleds::KeyDatabase;
 
 /****************************************************************************/
 
-// Return index in relation table for key pair, given a.index < b.index
-static unsigned relationIndex(const KeyDatabase::Key & a, const KeyDatabase::Key & b, unsigned N)
+// Keys with no layout information have an empty rectangle at origin
+static bool hasPosition(const KeyDatabase::Key & key)
 {
-    // Relations are stored in pyramidal array
-    return a.index * (2 * N - 1 - a.index) / 2 + b.index - a.index - 1;
+    return key.position.x0 != key.position.x1 || key.position.y0 != key.position.y1;
+}
+
+/****************************************************************************/
+// Hash indexes
+//
+// Both indexes are open-addressing tables with linear probing, sized to a
+// power of two at least twice the number of keys so probe sequences stay
+// short. Slots hold an index into the key list, or emptySlot.
+
+static constexpr unsigned emptySlot = std::numeric_limits<unsigned>::max();
+
+static std::size_t indexTableSize(std::size_t nbKeys)
+{
+    std::size_t size = 8;
+    while (size < 2 * nbKeys) { size <<= 1; }
+    return size;
+}
+
+static std::uint32_t hashKeyCode(int keyCode)
+{
+    auto value = static_cast<std::uint32_t>(keyCode) * UINT32_C(2654435761);
+    return value ^ (value >> 16);
+}
+
+static std::uint32_t hashName(const char * name, std::size_t size)
+{
+    std::uint32_t value = UINT32_C(2166136261);             // FNV-1a
+    for (std::size_t idx = 0; idx < size; ++idx) {
+        value = (value ^ static_cast<unsigned char>(name[idx])) * UINT32_C(16777619);
+    }
+    return value;
+}
+
+/// Inserts every key into a new table, keeping the first key on duplicates
+/// so lookups match what a linear scan would return.
+template <typename Hash, typename Equal>
+static std::vector<unsigned> buildIndex(const std::vector<KeyDatabase::Key> & keys,
+                                        Hash && hash, Equal && equal)
+{
+    auto table = std::vector<unsigned>(indexTableSize(keys.size()), emptySlot);
+    const auto mask = table.size() - 1;
+
+    for (unsigned idx = 0; idx < keys.size(); ++idx) {
+        auto slot = hash(keys[idx]) & mask;
+        for (; table[slot] != emptySlot; slot = (slot + 1) & mask) {
+            if (equal(keys[table[slot]], keys[idx])) { break; }
+        }
+        if (table[slot] == emptySlot) { table[slot] = idx; }
+    }
+    return table;
+}
+
+template <typename Match>
+static unsigned lookupIndex(const std::vector<unsigned> & table, std::uint32_t hash,
+                            Match && match)
+{
+    const auto mask = table.size() - 1;
+    for (auto slot = hash & mask; table[slot] != emptySlot; slot = (slot + 1) & mask) {
+        if (match(table[slot])) { return table[slot]; }
+    }
+    return emptySlot;
 }
 
 /****************************************************************************/
@@ -36,38 +100,171 @@ static unsigned relationIndex(const KeyDatabase::Key & a, const KeyDatabase::Key
 KeyDatabase::KeyDatabase(key_list keys)
  : m_keys(std::move(keys)),
    m_bounds(computeBounds(m_keys)),
-   m_relations(computeRelations(m_keys))
+   m_centers(computeCenters(m_keys)),
+   m_grid(computeGrid(m_keys, m_centers)),
+   m_adjacency(computeAdjacency()),
+   m_codeIndex(computeCodeIndex(m_keys)),
+   m_nameIndex(computeNameIndex(m_keys))
 {}
 
 KeyDatabase::~KeyDatabase() {}
 
 KeyDatabase::const_iterator KeyDatabase::findKeyCode(int keyCode) const
 {
-    return std::find_if(m_keys.cbegin(), m_keys.cend(),
-                        [keyCode](const auto & key) { return key.keyCode == keyCode; });
+    auto idx = lookupIndex(m_codeIndex, hashKeyCode(keyCode),
+                           [this, keyCode](unsigned idx) { return m_keys[idx].keyCode == keyCode; });
+    return idx == emptySlot ? m_keys.cend() : m_keys.cbegin() + idx;
 }
 
-KeyDatabase::const_iterator KeyDatabase::findName(const std::string & name) const
+KeyDatabase::const_iterator KeyDatabase::findName(const char * name, std::size_t size) const
 {
-    return std::find_if(m_keys.cbegin(), m_keys.cend(),
-                        [name](const auto & key) { return key.name == name; });
+    auto idx = lookupIndex(m_nameIndex, hashName(name, size),
+                           [this, name, size](unsigned idx) {
+                               const auto & keyName = m_keys[idx].name;
+                               return keyName.size() == size &&
+                                      std::memcmp(keyName.data(), name, size) == 0;
+                           });
+    return idx == emptySlot ? m_keys.cend() : m_keys.cbegin() + idx;
 }
 
 KeyDatabase::position_type KeyDatabase::distance(const Key & a, const Key & b) const
 {
     if (a.index == b.index) { return 0; }
-    return m_relations[a.index < b.index ? relationIndex(a, b, m_keys.size())
-                                         : relationIndex(b, a, m_keys.size())].distance;
+    auto dx = m_centers[b.index].x - m_centers[a.index].x;
+    auto dy = m_centers[b.index].y - m_centers[a.index].y;
+    return position_type(std::sqrt(dx * dx + dy * dy));
 }
 
 double KeyDatabase::angle(const Key & a, const Key & b) const
 {
     if (a.index == b.index) { return 0.0; }
-    auto xa = (a.position.x1 + a.position.x0) / 2;
-    auto ya = (a.position.y1 + a.position.y0) / 2;
-    auto xb = (b.position.x1 + b.position.x0) / 2;
-    auto yb = (b.position.y1 + b.position.y0) / 2;
-    return std::atan2(ya - yb, xb - xa);    // note: y axis is inverted
+    const auto & ca = m_centers[a.index];
+    const auto & cb = m_centers[b.index];
+    return std::atan2(ca.y - cb.y, cb.x - ca.x);    // note: y axis is inverted
+}
+
+template <typename Visitor>
+void KeyDatabase::visitRect(const Key::Rect & rect, Visitor && visitor) const
+{
+    if (m_grid.columns == 0 || rect.x1 < rect.x0 || rect.y1 < rect.y0) { return; }
+
+    auto cell = [this](position_type value, position_type origin, unsigned count) {
+        if (value < origin) { return 0u; }
+        return std::min(unsigned((value - origin) / m_grid.cellSize), count - 1);
+    };
+    const auto col0 = cell(rect.x0, m_grid.origin.x, m_grid.columns);
+    const auto col1 = cell(rect.x1, m_grid.origin.x, m_grid.columns);
+    const auto row0 = cell(rect.y0, m_grid.origin.y, m_grid.rows);
+    const auto row1 = cell(rect.y1, m_grid.origin.y, m_grid.rows);
+
+    for (auto row = row0; row <= row1; ++row) {
+        const auto first = m_grid.cellStart[row * m_grid.columns + col0];
+        const auto last = m_grid.cellStart[row * m_grid.columns + col1 + 1];
+        for (auto idx = first; idx < last; ++idx) {
+            const auto key = m_grid.cellKeys[idx];
+            const auto & center = m_centers[key];
+            if (rect.x0 <= center.x && center.x <= rect.x1 &&
+                rect.y0 <= center.y && center.y <= rect.y1) {
+                visitor(key);
+            }
+        }
+    }
+}
+
+void KeyDatabase::findInRect(const Key::Rect & rect, index_list & result) const
+{
+    result.clear();
+    visitRect(rect, [&result](unsigned key) { result.push_back(key); });
+    std::sort(result.begin(), result.end());
+}
+
+void KeyDatabase::findInRadius(Point center, position_type radius, index_list & result) const
+{
+    result.clear();
+    const auto limit = (long long)radius * radius;
+    visitRect(Key::Rect{center.x - radius, center.y - radius, center.x + radius, center.y + radius},
+              [this, center, limit, &result](unsigned key) {
+                  const long long dx = m_centers[key].x - center.x;
+                  const long long dy = m_centers[key].y - center.y;
+                  if (dx * dx + dy * dy <= limit) { result.push_back(key); }
+              });
+    std::sort(result.begin(), result.end());
+}
+
+void KeyDatabase::findAlongLine(Point from, Point to, position_type width, index_list & result) const
+{
+    const long long dx = to.x - from.x;
+    const long long dy = to.y - from.y;
+    const long long length2 = dx * dx + dy * dy;
+    if (length2 == 0) { return findInRadius(from, width / 2, result); }
+
+    // Projection of a key's center onto the line, scaled by length2
+    auto projection = [this, from, dx, dy](unsigned key) {
+        return (m_centers[key].x - from.x) * dx + (m_centers[key].y - from.y) * dy;
+    };
+
+    result.clear();
+    const auto halfWidth = double(width) / 2.0;
+    const auto margin = position_type(std::ceil(halfWidth));
+    visitRect(Key::Rect{std::min(from.x, to.x) - margin, std::min(from.y, to.y) - margin,
+                        std::max(from.x, to.x) + margin, std::max(from.y, to.y) + margin},
+              [&](unsigned key) {
+                  auto t = std::max(0.0, std::min(1.0, double(projection(key)) / double(length2)));
+                  auto ex = m_centers[key].x - (from.x + t * double(dx));
+                  auto ey = m_centers[key].y - (from.y + t * double(dy));
+                  if (ex * ex + ey * ey <= halfWidth * halfWidth) { result.push_back(key); }
+              });
+    std::sort(result.begin(), result.end(), [&projection](unsigned a, unsigned b) {
+        auto pa = projection(a), pb = projection(b);
+        return pa < pb || (pa == pb && a < b);
+    });
+}
+
+KeyDatabase::const_iterator KeyDatabase::findNearest(Point point) const
+{
+    if (m_grid.columns == 0) { return m_keys.cend(); }
+
+    // Search rings of cells of increasing radius around the point's cell.
+    // Once a ring is done, keys in further rings are at least ring * cellSize away.
+    auto best = emptySlot;
+    auto bestDistance = std::numeric_limits<long long>::max();
+    auto consider = [&](unsigned key) {
+        const long long dx = m_centers[key].x - point.x;
+        const long long dy = m_centers[key].y - point.y;
+        const auto distance = dx * dx + dy * dy;
+        if (distance < bestDistance || (distance == bestDistance && key < best)) {
+            best = key;
+            bestDistance = distance;
+        }
+    };
+
+    auto cell = [this](position_type value, position_type origin, unsigned count) {
+        if (value < origin) { return 0; }
+        return int(std::min(unsigned((value - origin) / m_grid.cellSize), count - 1));
+    };
+    const auto col = cell(point.x, m_grid.origin.x, m_grid.columns);
+    const auto row = cell(point.y, m_grid.origin.y, m_grid.rows);
+    const auto maxRing = int(std::max(m_grid.columns, m_grid.rows));
+
+    for (int ring = 0; ring < maxRing; ++ring) {
+        for (int r = row - ring; r <= row + ring; ++r) {
+            if (r < 0 || r >= int(m_grid.rows)) { continue; }
+            const bool edge = r == row - ring || r == row + ring;
+            for (int c = col - ring; c <= col + ring; c += edge ? 1 : 2 * ring) {
+                if (c >= 0 && c < int(m_grid.columns)) {
+                    const auto cellIdx = r * m_grid.columns + c;
+                    for (auto idx = m_grid.cellStart[cellIdx];
+                         idx < m_grid.cellStart[cellIdx + 1]; ++idx) {
+                        consider(m_grid.cellKeys[idx]);
+                    }
+                }
+                if (ring == 0) { break; }
+            }
+        }
+        const long long reach = (long long)ring * m_grid.cellSize;
+        if (best != emptySlot && bestDistance <= reach * reach) { break; }
+    }
+    return m_keys.cbegin() + best;
 }
 
 KeyDatabase::Key::Rect KeyDatabase::computeBounds(const key_list & keys)
@@ -87,28 +284,119 @@ KeyDatabase::Key::Rect KeyDatabase::computeBounds(const key_list & keys)
     return result;
 }
 
-KeyDatabase::relation_list KeyDatabase::computeRelations(const key_list & keys)
+KeyDatabase::point_list KeyDatabase::computeCenters(const key_list & keys)
+{
+    point_list result;
+    result.reserve(keys.size());
+    for (const auto & key : keys) {
+        result.push_back(Point{
+            (key.position.x1 + key.position.x0) / 2,
+            (key.position.y1 + key.position.y0) / 2
+        });
+    }
+    return result;
+}
+
+KeyDatabase::Grid KeyDatabase::computeGrid(const key_list & keys, const point_list & centers)
 {
-    KeyDatabase::relation_list result;
-    result.reserve(keys.size() * (keys.size() - 1) / 2);
+    auto grid = Grid{ Point{0, 0}, 1, 0, 0, { 0 }, {} };
+
+    unsigned nbKeys = 0;
+    auto max = Point{0, 0};
+    for (const auto & key : keys) {
+        if (!hasPosition(key)) { continue; }
+        const auto & center = centers[key.index];
+        if (nbKeys == 0) { grid.origin = max = center; }
+        grid.origin.x = std::min(grid.origin.x, center.x);
+        grid.origin.y = std::min(grid.origin.y, center.y);
+        max.x = std::max(max.x, center.x);
+        max.y = std::max(max.y, center.y);
+        ++nbKeys;
+    }
+    if (nbKeys == 0) { return grid; }
+
+    // Square cells, sized so there is about one key per cell
+    const auto width = max.x - grid.origin.x + 1;
+    const auto height = max.y - grid.origin.y + 1;
+    grid.cellSize = std::max(1, position_type(std::sqrt(double(width) * height / nbKeys)));
+    grid.columns = unsigned(width / grid.cellSize) + 1;
+    grid.rows = unsigned(height / grid.cellSize) + 1;
+
+    // Counting sort of keys into cells
+    auto cellOf = [&grid, &centers](const Key & key) {
+        const auto & center = centers[key.index];
+        return unsigned((center.y - grid.origin.y) / grid.cellSize) * grid.columns
+             + unsigned((center.x - grid.origin.x) / grid.cellSize);
+    };
+    grid.cellStart.assign(grid.columns * grid.rows + 1, 0);
+    for (const auto & key : keys) {
+        if (hasPosition(key)) { ++grid.cellStart[cellOf(key) + 1]; }
+    }
+    std::partial_sum(grid.cellStart.begin(), grid.cellStart.end(), grid.cellStart.begin());
 
-    for (auto it = keys.begin(); it != keys.end(); ++it) {
-        for (auto other = std::next(it); other != keys.end(); ++other) {
-            auto xa = (it->position.x1 + it->position.x0) / 2;
-            auto ya = (it->position.y1 + it->position.y0) / 2;
-            auto xb = (other->position.x1 + other->position.x0) / 2;
-            auto yb = (other->position.y1 + other->position.y0) / 2;
-            auto dx = xb - xa;
-            auto dy = yb - ya;
+    grid.cellKeys.resize(nbKeys);
+    auto fill = std::vector<unsigned>(grid.cellStart.begin(), grid.cellStart.end() - 1);
+    for (const auto & key : keys) {
+        if (hasPosition(key)) { grid.cellKeys[fill[cellOf(key)]++] = unsigned(key.index); }
+    }
+    return grid;
+}
 
-            result.push_back(Relation{
-                position_type(std::sqrt(dx * dx + dy * dy))
-            });
+KeyDatabase::Adjacency KeyDatabase::computeAdjacency() const
+{
+    Adjacency result;
+    result.offsets.reserve(m_keys.size() + 1);
+    result.offsets.push_back(0);
+
+    // Keys are adjacent if the gap between their rectangles is within a quarter
+    // of a typical key height. Search spans the largest key so all centers are found.
+    std::vector<position_type> heights;
+    position_type maxHalfSize = 0;
+    for (const auto & key : m_keys) {
+        if (!hasPosition(key)) { continue; }
+        heights.push_back(key.position.y1 - key.position.y0);
+        maxHalfSize = std::max({ maxHalfSize, (key.position.x1 - key.position.x0 + 1) / 2,
+                                 (key.position.y1 - key.position.y0 + 1) / 2 });
+    }
+    position_type margin = 1;
+    if (!heights.empty()) {
+        std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+        margin = std::max(margin, heights[heights.size() / 2] / 4);
+    }
+
+    for (const auto & key : m_keys) {
+        if (hasPosition(key)) {
+            const auto & pos = key.position;
+            const auto reach = margin + maxHalfSize;
+            visitRect(Key::Rect{ pos.x0 - reach, pos.y0 - reach, pos.x1 + reach, pos.y1 + reach },
+                      [&](unsigned other) {
+                          if (other == key.index) { return; }
+                          const auto & opos = m_keys[other].position;
+                          auto gapX = std::max(opos.x0, pos.x0) - std::min(opos.x1, pos.x1);
+                          auto gapY = std::max(opos.y0, pos.y0) - std::min(opos.y1, pos.y1);
+                          if (gapX <= margin && gapY <= margin) { result.indices.push_back(other); }
+                      });
+            std::sort(result.indices.begin() + result.offsets.back(), result.indices.end());
         }
+        result.offsets.push_back(unsigned(result.indices.size()));
     }
     return result;
 }
 
+KeyDatabase::index_table KeyDatabase::computeCodeIndex(const key_list & keys)
+{
+    return buildIndex(keys,
+                      [](const Key & key) { return hashKeyCode(key.keyCode); },
+                      [](const Key & a, const Key & b) { return a.keyCode == b.keyCode; });
+}
+
+KeyDatabase::index_table KeyDatabase::computeNameIndex(const key_list & keys)
+{
+    return buildIndex(keys,
+                      [](const Key & key) { return hashName(key.name.data(), key.name.size()); },
+                      [](const Key & a, const Key & b) { return a.name == b.name; });
+}
+
 /****************************************************************************/
 
 KeyDatabase::Key::Key(index_type index, int keyCode, std::string name, Rect position)
@@ -122,17 +410,44 @@ KeyDatabase::Key::~Key() {}
 
 /****************************************************************************/
 
+KeyDatabase::KeyGroup KeyDatabase::makeGroup(std::string name, const KeyMask & mask) const
+{
+    std::vector<iterator> result;
+    result.reserve(mask.count());
+    mask.forEach([this, &result](KeyMask::size_type idx) {
+        if (idx < m_keys.size()) { result.push_back(m_keys.cbegin() + idx); }
+    });
+    return KeyGroup(std::move(name), std::move(result));
+}
+
+/****************************************************************************/
+
 KeyDatabase::KeyGroup::KeyGroup(std::string name, key_list keys)
  : m_name(std::move(name)), m_keys(std::move(keys))
-{}
+{
+    for (const auto & it : m_keys) { m_mask.set(it->index); }
+}
 
 KeyDatabase::KeyGroup::~KeyGroup() {}
 
+KeyDatabase::KeyGroup::const_iterator KeyDatabase::KeyGroup::erase(const_iterator it)
+{
+    const auto index = (*it).index;
+    auto result = m_keys.erase(it.get());
+    // A key may appear several times in a group, only drop it from mask on last one
+    if (std::none_of(m_keys.cbegin(), m_keys.cend(),
+                     [index](const auto & kit) { return kit->index == index; })) {
+        m_mask.reset(index);
+    }
+    return const_iterator(result);
+}
+
 void KeyDatabase::KeyGroup::swap(KeyGroup & other) noexcept
 {
     using std::swap;
     swap(m_name, other.m_name);
     swap(m_keys, other.m_keys);
+    swap(m_mask, other.m_mask);
 }
 
 bool operator==(const KeyDatabase::KeyGroup & a, const KeyDatabase::KeyGroup & b)
@@ -41,7 +41,7 @@ static std::size_t align(std::size_t value, std::size_t alignment)
 RenderTarget::RenderTarget(size_type size)
  : m_colors(nullptr),
    m_size(size),                            // m_size tracks actual number of keys
-   m_capacity(align(size, alignColors))    // m_capacity tracks actual buffer size
+   m_capacity(capacityFor(size))            // m_capacity tracks actual buffer size
 {
     if (::posix_memalign(reinterpret_cast<void**>(&m_colors), alignBytes,
                          m_capacity * sizeof(m_colors[0])) != 0) {
@@ -75,6 +75,11 @@ RenderTarget::~RenderTarget()
     free(m_colors);
 }
 
+RenderTarget::size_type RenderTarget::capacityFor(size_type size)
+{
+    return size_type(align(size, alignColors));
+}
+
 void keyleds::swap(RenderTarget & lhs, RenderTarget & rhs) noexcept
 {
     using std::swap;
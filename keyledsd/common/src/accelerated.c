@@ -59,3 +59,44 @@ void blend(uint8_t * restrict dst, const uint8_t * restrict src, unsigned length
 void blend(uint8_t * restrict dst, const uint8_t * restrict src, unsigned length)
     { blend_plain(dst, src, length); }
 #endif
+
+/****************************************************************************/
+/* gradient */
+
+#define GRADIENT_ARGS uint32_t * restrict dst, const uint32_t * restrict table, unsigned mask, \
+                      const uint32_t * restrict phases, const uint32_t * restrict keep, \
+                      unsigned t, unsigned length
+
+void gradient_avx2(GRADIENT_ARGS);
+void gradient_sse2(GRADIENT_ARGS);
+void gradient_plain(GRADIENT_ARGS);
+
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+static void (*resolve_gradient(void))(GRADIENT_ARGS)
+{
+#  if defined __GNUC__ && !defined __clang__
+    __builtin_cpu_init();
+#  endif
+#  ifdef KEYLEDSD_USE_AVX2
+    if (__builtin_cpu_supports("avx2")) { return gradient_avx2; }
+#  endif
+#  ifdef KEYLEDSD_USE_SSE2
+    if (__builtin_cpu_supports("sse2")) { return gradient_sse2; }
+#  endif
+    return gradient_plain;
+}
+
+#  ifdef HAVE_IFUNC_ATTRIBUTE
+void gradient(GRADIENT_ARGS) __attribute__((ifunc("resolve_gradient")));
+#  else
+static void (*resolved_gradient)(GRADIENT_ARGS);
+void gradient(GRADIENT_ARGS)
+{
+    if (resolved_gradient == 0) { resolved_gradient = resolve_gradient(); }
+    (*resolved_gradient)(dst, table, mask, phases, keep, t, length);
+}
+#  endif
+#else
+void gradient(GRADIENT_ARGS)
+    { gradient_plain(dst, table, mask, phases, keep, t, length); }
+#endif
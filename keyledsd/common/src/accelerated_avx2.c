@@ -65,3 +65,30 @@ void blend_avx2(uint8_t * restrict dst, const uint8_t * restrict src, unsigned l
         dstv += 1;
     } while (--length > 0);
 }
+
+void gradient_avx2(uint32_t * restrict dst, const uint32_t * restrict table, unsigned mask,
+                   const uint32_t * restrict phases, const uint32_t * restrict keep,
+                   unsigned t, unsigned length)
+{
+    assert((uintptr_t)dst % 32 == 0);   // AVX2 requires 32-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition
+    assert(length % 8 == 0);            // we'll process entries 8 by 8
+
+    __m256i * restrict dstv = (__m256i *)__builtin_assume_aligned(dst, 32);
+    const __m256i * restrict phasev = (const __m256i *)phases;
+    const __m256i * restrict keepv = (const __m256i *)keep;
+
+    const __m256i timev = _mm256_set1_epi32((int)t);
+    const __m256i maskv = _mm256_set1_epi32((int)mask);
+
+    length /= 8;
+
+    do {
+        __m256i index = _mm256_and_si256(_mm256_sub_epi32(timev, _mm256_loadu_si256(phasev)), maskv);
+        __m256i colors = _mm256_i32gather_epi32((const int *)table, index, 4);
+        _mm256_store_si256(dstv, _mm256_and_si256(colors, _mm256_loadu_si256(keepv)));
+        phasev += 1;
+        keepv += 1;
+        dstv += 1;
+    } while (--length > 0);
+}
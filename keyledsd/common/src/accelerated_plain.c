@@ -36,3 +36,16 @@ void blend_plain(uint8_t * restrict a, const uint8_t * restrict b, unsigned leng
         b += 4;
     }
 }
+
+void gradient_plain(uint32_t * restrict dst, const uint32_t * restrict table, unsigned mask,
+                    const uint32_t * restrict phases, const uint32_t * restrict keep,
+                    unsigned t, unsigned length)
+{
+    assert((uintptr_t)dst % 8 == 0);  // Not a requirement, but lets compiler optimize stuff
+
+    dst = (uint32_t*)__builtin_assume_aligned(dst, 8);
+
+    for (unsigned idx = 0; idx < length; ++idx) {
+        dst[idx] = table[(t - phases[idx]) & mask] & keep[idx];
+    }
+}
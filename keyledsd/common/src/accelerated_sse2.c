@@ -65,3 +65,35 @@ void blend_sse2(uint8_t * restrict dst, const uint8_t * restrict src, unsigned l
         dstv += 1;
     } while (--length > 0);
 }
+
+void gradient_sse2(uint32_t * restrict dst, const uint32_t * restrict table, unsigned mask,
+                   const uint32_t * restrict phases, const uint32_t * restrict keep,
+                   unsigned t, unsigned length)
+{
+    assert((uintptr_t)dst % 16 == 0);   // SSE2 requires 16-bytes aligned data
+    assert(length != 0);                // allows inverting loop condition
+    assert(length % 4 == 0);            // we'll process entries 4 by 4
+
+    __m128i * restrict dstv = (__m128i *)__builtin_assume_aligned(dst, 16);
+    const __m128i * restrict phasev = (const __m128i *)phases;
+    const __m128i * restrict keepv = (const __m128i *)keep;
+
+    const __m128i timev = _mm_set1_epi32((int)t);
+    const __m128i maskv = _mm_set1_epi32((int)mask);
+    uint32_t indices[4] __attribute__((aligned(16)));
+
+    length /= 4;
+
+    do {
+        /* SSE2 has no gather: compute indices in vector form, then load scalars */
+        __m128i index = _mm_and_si128(_mm_sub_epi32(timev, _mm_loadu_si128(phasev)), maskv);
+        _mm_store_si128((__m128i *)indices, index);
+
+        __m128i colors = _mm_set_epi32((int)table[indices[3]], (int)table[indices[2]],
+                                       (int)table[indices[1]], (int)table[indices[0]]);
+        _mm_store_si128(dstv, _mm_and_si128(colors, _mm_loadu_si128(keepv)));
+        phasev += 1;
+        keepv += 1;
+        dstv += 1;
+    } while (--length > 0);
+}
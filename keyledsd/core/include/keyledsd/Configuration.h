@@ -54,7 +54,10 @@ private:
                                           device_map devices,
                                           key_group_list groups,
                                           effect_group_list effectGroups,
-                                          profile_list profiles);
+                                          profile_list profiles,
+                                          unsigned contextDelay,
+                                          unsigned prewarm,
+                                          unsigned memoryBudget);
 public:
                             Configuration() = default;
                             ~Configuration();
@@ -66,6 +69,9 @@ public:
     const key_group_list &  keyGroups() const { return m_keyGroups; }
     const effect_group_list & effectGroups() const { return m_effectGroups; }
     const profile_list&     profiles() const { return m_profiles; }
+    unsigned                contextDelay() const { return m_contextDelay; }
+    unsigned                prewarm() const { return m_prewarm; }
+    unsigned                memoryBudget() const { return m_memoryBudget; }
 
 public:
     static std::unique_ptr<Configuration>   loadFile(const std::string & path);
@@ -78,6 +84,9 @@ private:
     key_group_list          m_keyGroups;    ///< Map of key group names to lists of key names
     effect_group_list       m_effectGroups; ///< Map of effect group names to configurations
     profile_list            m_profiles;     ///< List of profile configurations
+    unsigned                m_contextDelay = 0; ///< Time to let context settle before applying it, in ms
+    unsigned                m_prewarm = 0;  ///< Number of profiles to load effects of ahead of use
+    unsigned                m_memoryBudget = 0; ///< Memory loaded effects may use per device, in KiB
 };
 
 /****************************************************************************/
@@ -142,6 +151,7 @@ public:
     {
         struct Entry;
         using entry_list = std::vector<Entry>;
+    public:
         using string_map = std::vector<std::pair<std::string, std::string>>;
     public:
                             Lookup() = default;
@@ -149,6 +159,7 @@ public:
                             ~Lookup();
 
         bool                match(const string_map &) const;
+        string_map          filters() const;    ///< Returns (context key, regex) pairs
     private:
         static entry_list   buildRegexps(string_map);
     private:
@@ -198,6 +209,21 @@ private:
 
 /****************************************************************************/
 
+// Structural comparison, used to find out what changed when reloading configuration
+
+bool operator==(const Configuration::EffectGroup &, const Configuration::EffectGroup &);
+bool operator==(const Configuration::KeyGroup &, const Configuration::KeyGroup &);
+bool operator==(const Configuration::Effect &, const Configuration::Effect &);
+
+inline bool operator!=(const Configuration::EffectGroup & a, const Configuration::EffectGroup & b)
+    { return !(a == b); }
+inline bool operator!=(const Configuration::KeyGroup & a, const Configuration::KeyGroup & b)
+    { return !(a == b); }
+inline bool operator!=(const Configuration::Effect & a, const Configuration::Effect & b)
+    { return !(a == b); }
+
+/****************************************************************************/
+
 } // namespace keyleds
 
 #endif
@@ -18,6 +18,7 @@
 #define KEYLEDSD_KEYBOARD_H_F6DA7CD5
 
 #include <cstdint>
+#include <functional>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -41,6 +42,11 @@ public:
     struct ColorDirective {
         uint8_t id, red, green, blue;
     };
+    struct Event {                          ///< Report the device sent on its own
+        uint16_t    feature;                ///< Feature that sent it, 0 if unknown
+        uint8_t     function;               ///< Event identifier within feature
+    };
+    using event_handler = std::function<void(const Event &)>;
 
     // Data
     class KeyBlock;
@@ -81,6 +87,12 @@ public:
     virtual std::string resolveKey(key_block_id_type, key_id_type) const = 0;
     virtual int         decodeKeyId(key_block_id_type, key_id_type) const = 0;
 
+    // Events
+    /// Returns a descriptor that becomes readable when flush() has events to deliver, or -1
+    virtual int         eventFd() = 0;
+    /// Sets the handler flush() delivers events to
+    void                setEventHandler(event_handler handler) { m_eventHandler = std::move(handler); }
+
     // Manipulate
     virtual void        setTimeout(unsigned us) = 0;
     virtual void        flush() = 0;
@@ -93,6 +105,10 @@ public:
     // Quirks
     void                patchMissingKeys(const KeyBlock &, const key_list &);
 
+protected:
+    void                notifyEvent(const Event & event) const
+                        { if (m_eventHandler) { m_eventHandler(event); } }
+
 private:
     const std::string   m_path;             ///< Device node path
     Type                m_type;             ///< The kind of libkeyleds device
@@ -102,6 +118,7 @@ private:
     std::string         m_firmware;         ///< Detected firmware version
     int                 m_layout;           ///< Device-declared layout number - used to locate a layout file
     block_list          m_blocks;           ///< List of key blocks detected on device
+    event_handler       m_eventHandler;     ///< Invoked by flush() for each device event
 };
 
 /****************************************************************************/
@@ -0,0 +1,69 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_LAYOUTDATABASE_H_6A1D04C9
+#define KEYLEDSD_LAYOUTDATABASE_H_6A1D04C9
+
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace keyleds {
+
+class LayoutDescription;
+
+/****************************************************************************/
+
+/** Compiled layout database
+ *
+ * Read-only collection of layout descriptions, compiled from the layout XML
+ * files by keyledsd-layoutc and memory-mapped at runtime. Each layout is stored
+ * as a key table sorted by block and code, with precomputed key rectangles and
+ * interned key names, so loading one requires neither XML parsing nor
+ * rebuilding key geometry. Layout descriptions found in the database reference
+ * its key names in place and keep the mapping alive.
+ *
+ * Layouts are identified by the base name of their source file, for
+ * instance "c33100000000_0002".
+ */
+class LayoutDatabase final
+{
+public:
+    using entry_list = std::vector<std::pair<std::string, const LayoutDescription *>>;
+public:
+    explicit            LayoutDatabase(const std::string & path);
+                        LayoutDatabase(LayoutDatabase &&) noexcept;
+                        LayoutDatabase(const LayoutDatabase &) = delete;
+                        ~LayoutDatabase();
+
+    std::size_t         size() const;
+    bool                find(const std::string & name, LayoutDescription * layout) const;
+
+    static void         write(std::ostream &, entry_list);
+
+private:
+    std::shared_ptr<const char> m_data; ///< Mapped file contents
+    std::size_t         m_size;     ///< Size of mapped file, in bytes
+};
+
+/****************************************************************************/
+
+} // namespace keyleds
+
+#endif
@@ -17,8 +17,7 @@
 #ifndef KEYLEDSD_LAYOUTDESCRIPTION_H_FF3532D2
 #define KEYLEDSD_LAYOUTDESCRIPTION_H_FF3532D2
 
-#include <iosfwd>
-#include <stdexcept>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -30,28 +29,32 @@ namespace keyleds {
  *
  * Describes the physical layout of a keyboard: which keys are available, where
  * exactly they are on the keyboard, and what size the whole keyboard is.
+ * Keys are kept sorted by block and code, so they can be looked up directly.
+ * Key names are not copied: they point into a storage block that the
+ * description shares ownership of, typically the mapped layout database.
  */
 class LayoutDescription final
 {
 public:
     struct Rect { unsigned x0, y0, x1, y1; };
     class Key;
-    class ParseError;
     using key_list = std::vector<Key>;
+    using storage_ptr = std::shared_ptr<const void>;
 public:
                         LayoutDescription() = default;
-                        LayoutDescription(std::string name, key_list keys);
+                        LayoutDescription(const char * name, key_list keys, storage_ptr storage);
                         ~LayoutDescription();
 
-    const std::string & name() const { return m_name; }
+    const char *        name() const { return m_name; }
     const key_list &    keys() const { return m_keys; }
+    const Key *         find(unsigned block, unsigned code) const;
 
-    static LayoutDescription parse(std::istream &);
-    static LayoutDescription loadFile(const std::string & path);
+    static LayoutDescription loadFile(const std::string & name);
 
 private:
-    std::string         m_name;     ///< Layout name, indicating its country code
-    key_list            m_keys;     ///< All keys from all blocks
+    const char *        m_name = "";    ///< Layout name, indicating its country code
+    key_list            m_keys;     ///< All keys from all blocks, sorted by (block, code)
+    storage_ptr         m_storage;  ///< Keeps the memory m_name and key names point into alive
 };
 
 /****************************************************************************/
@@ -65,26 +68,12 @@ class LayoutDescription::Key final
     using block_type = unsigned int;
     using code_type = unsigned int;
 public:
-                Key(block_type block, code_type code, Rect position, std::string name);
-                ~Key();
+                Key(block_type block, code_type code, Rect position, const char * name);
 public:
     block_type  block;          ///< Block identifier, eg: 0 for normal keys, 64 for game/light keys, ...
     code_type   code;           ///< Key identifier within block
     Rect        position;       ///< Physical key bounds. [0, 0] is upper left corner.
-    std::string name;           ///< User-readable key name
-};
-
-/****************************************************************************/
-
-class LayoutDescription::ParseError : public std::runtime_error
-{
-public:
-                ParseError(const std::string & what, int line);
-                ~ParseError();
-
-    int         line() const noexcept { return m_line; }
-private:
-    int         m_line; ///< Line of the parsing error, as reported by xml lib
+    const char * name;          ///< User-readable key name, owned by layout storage
 };
 
 /****************************************************************************/
@@ -0,0 +1,95 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_PROFILEMATCHER_H_3E9B58A1
+#define KEYLEDSD_PROFILEMATCHER_H_3E9B58A1
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "keyledsd/Configuration.h"
+
+namespace keyleds {
+
+/****************************************************************************/
+
+/** Compiled profile selector
+ *
+ * Selects the profile that applies to a context, along with the effect groups
+ * it enables, for a single device. All profile lookups are compiled together:
+ * identical filters are evaluated once, and literal prefixes or literal
+ * patterns are checked before, or instead of, running the regex.
+ *
+ * As contexts change a lot more often than the profile they select - think
+ * window title updates - recent selections are cached by the values of the
+ * context keys that lookups actually use.
+ *
+ * It references the configuration it was built from, and must be rebuilt
+ * whenever it changes.
+ */
+class ProfileMatcher final
+{
+    using string_map = std::vector<std::pair<std::string, std::string>>;
+public:
+    using effect_group_list = std::vector<const Configuration::EffectGroup *>;
+
+    /// Outcome of profile selection
+    struct Selection
+    {
+        const Configuration::Profile *  profile;        ///< Selected profile
+        effect_group_list               effectGroups;   ///< Effect groups it enables, including overlay's
+    };
+
+    static constexpr std::size_t cacheSize = 16;    ///< Number of recent selections to remember
+private:
+    class Condition;
+    using condition_list = std::vector<std::unique_ptr<Condition>>;
+    using index_list = std::vector<std::size_t>;
+    using cache_entry = std::pair<std::vector<std::string>, const Selection *>;
+public:
+                        ProfileMatcher();
+                        ProfileMatcher(const Configuration &, const std::string & deviceName);
+                        ProfileMatcher(ProfileMatcher &&) noexcept;
+                        ~ProfileMatcher();
+    ProfileMatcher &    operator=(ProfileMatcher &&) noexcept;
+
+    /// Returns selection for given context, or nullptr if no profile applies
+    const Selection *   match(const string_map & context);
+
+    /// Returns all possible selections, in configuration order, default last
+    const std::vector<Selection> & selections() const { return m_selections; }
+
+private:
+    const Selection *   select(const std::vector<const std::string *> & values) const;
+
+private:
+    std::vector<std::string>    m_keys;         ///< Context keys used by lookups, in use order
+    condition_list              m_conditions;   ///< Distinct (key, regex) filters
+    std::vector<index_list>     m_profiles;     ///< Condition indices of each regular profile
+    std::vector<Selection>      m_selections;   ///< Selection for each regular profile, then default
+    bool                        m_hasDefault;   ///< Whether last entry of m_selections is default
+
+    std::vector<cache_entry>    m_cache;        ///< Recent selections, most recent first
+    std::vector<const std::string *> m_values;  ///< Buffer for values of m_keys, avoids reallocation
+};
+
+/****************************************************************************/
+
+} // namespace keyleds
+
+#endif
@@ -17,6 +17,7 @@
 #ifndef KEYLEDS_RENDER_LOOP_H_D7E4709F
 #define KEYLEDS_RENDER_LOOP_H_D7E4709F
 
+#include <atomic>
 #include <mutex>
 #include <vector>
 #include "keyledsd/Device.h"
@@ -32,7 +33,8 @@ namespace keyleds {
  * An AnimationLoop that runs a set of Renderers and sends the resulting
  * RenderTarget state to a Device. It assumes entire control of the device.
  * That is, no other thread is allowed to call Device's manipulation methods
- * while a RenderLoop for it exists.
+ * while a RenderLoop for it exists, save for flush(), which only delivers
+ * device events.
  */
 class RenderLoop final : public tools::AnimationLoop
 {
@@ -51,6 +53,9 @@ public:
     /// calling their render method.
     renderer_list &     renderers() { return m_renderers; }
 
+    /// Makes next frame send all colors, for when the device may have changed them
+    void                refresh();
+
     /// Creates a new render target matching the layout of given device
     static RenderTarget renderTargetFor(const Device &);
 
@@ -63,6 +68,7 @@ private:
 
 private:
     Device &            m_device;               ///< The device to render to
+    std::atomic<bool>   m_refresh;              ///< Whether next frame must send all colors
     renderer_list       m_renderers;            ///< Current list of renderers (unowned)
     std::mutex          m_mRenderers;           ///< Controls access to m_renderers
 
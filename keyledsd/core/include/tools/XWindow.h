@@ -223,6 +223,12 @@ private:
 
 /****************************************************************************/
 
+/// Enables Xlib locking, so plugins can use their own connections from helper
+/// threads. Must be called before any other Xlib function.
+void initThreads();
+
+/****************************************************************************/
+
 } // namespace xlib
 
 #endif
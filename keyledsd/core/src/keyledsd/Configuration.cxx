@@ -20,6 +20,7 @@
 #include <array>
 #include <cassert>
 #include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -88,6 +89,9 @@ public:
     Configuration::key_group_list       m_keyGroups;
     Configuration::effect_group_list    m_effectGroups;
     Configuration::profile_list         m_profiles;
+    unsigned                            m_contextDelay;
+    unsigned                            m_prewarm;
+    unsigned                            m_memoryBudget;
 
 private:
     std::stack<state_ptr, std::vector<state_ptr>>                m_state;
@@ -547,6 +551,9 @@ public:
                      const std::string & value, const std::string & anchor) override
     {
         if (key == "plugin-path")  { builder.m_pluginPaths = { value }; }
+        else if (key == "context-delay") { builder.m_contextDelay = parseUInt(builder, key, value); }
+        else if (key == "prewarm") { builder.m_prewarm = parseUInt(builder, key, value); }
+        else if (key == "memory-budget") { builder.m_memoryBudget = parseUInt(builder, key, value); }
         else MappingBuildState::scalarEntry(builder, key, value, anchor);
     }
 
@@ -574,6 +581,19 @@ public:
         }
         MappingBuildState::subStateEnd(builder, state);
     }
+
+private:
+    static unsigned parseUInt(ConfigurationBuilder & builder, const std::string & key,
+                              const std::string & value)
+    {
+        char * end;
+        errno = 0;
+        auto result = std::strtoul(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || errno != 0 || result > UINT_MAX) {
+            throw builder.makeError("invalid value for " + key + ": " + value);
+        }
+        return unsigned(result);
+    }
 };
 
 
@@ -592,6 +612,9 @@ public:
 /****************************************************************************/
 
 ConfigurationBuilder::ConfigurationBuilder()
+ : m_contextDelay(KEYLEDSD_CONTEXT_DELAY),
+   m_prewarm(0),
+   m_memoryBudget(0)
 {
     m_state.push(std::make_unique<InitialState>());
 }
@@ -673,14 +696,20 @@ Configuration::Configuration(std::string path,
                              device_map devices,
                              key_group_list keyGroups,
                              effect_group_list effectGroups,
-                             profile_list profiles)
+                             profile_list profiles,
+                             unsigned contextDelay,
+                             unsigned prewarm,
+                             unsigned memoryBudget)
  : m_path(std::move(path)),
    m_plugins(std::move(plugins)),
    m_pluginPaths(std::move(pluginPaths)),
    m_devices(std::move(devices)),
    m_keyGroups(std::move(keyGroups)),
    m_effectGroups(std::move(effectGroups)),
-   m_profiles(std::move(profiles))
+   m_profiles(std::move(profiles)),
+   m_contextDelay(contextDelay),
+   m_prewarm(prewarm),
+   m_memoryBudget(memoryBudget)
 {}
 
 Configuration::~Configuration() {}
@@ -709,7 +738,10 @@ std::unique_ptr<Configuration> Configuration::loadFile(const std::string & path)
         std::move(builder.m_devices),
         std::move(builder.m_keyGroups),
         std::move(builder.m_effectGroups),
-        std::move(builder.m_profiles)
+        std::move(builder.m_profiles),
+        builder.m_contextDelay,
+        builder.m_prewarm,
+        builder.m_memoryBudget
     ));
 }
 
@@ -771,6 +803,15 @@ bool Configuration::Profile::Lookup::match(const string_map & context) const
     });
 }
 
+Configuration::Profile::Lookup::string_map Configuration::Profile::Lookup::filters() const
+{
+    string_map result;
+    result.reserve(m_entries.size());
+    std::transform(m_entries.begin(), m_entries.end(), std::back_inserter(result),
+                   [](const auto & entry) { return std::make_pair(entry.key, entry.value); });
+    return result;
+}
+
 Configuration::Profile::Lookup::entry_list
 Configuration::Profile::Lookup::buildRegexps(string_map filters)
 {
@@ -796,3 +837,20 @@ Configuration::Effect::Effect(std::string name, string_map items)
 {}
 
 Configuration::Effect::~Effect() {}
+
+/****************************************************************************/
+
+bool keyleds::operator==(const Configuration::EffectGroup & a, const Configuration::EffectGroup & b)
+{
+    return a.name() == b.name() && a.keyGroups() == b.keyGroups() && a.effects() == b.effects();
+}
+
+bool keyleds::operator==(const Configuration::KeyGroup & a, const Configuration::KeyGroup & b)
+{
+    return a.name() == b.name() && a.keys() == b.keys();
+}
+
+bool keyleds::operator==(const Configuration::Effect & a, const Configuration::Effect & b)
+{
+    return a.name() == b.name() && a.items() == b.items();
+}
@@ -156,10 +156,13 @@ bool EffectManager::load(const std::string & name, std::string * error)
         return false;
     }
 
-    if (definition->major != KEYLEDSD_VERSION_MAJOR) {
+    // Plugin interfaces may change between minor versions until 1.0
+    if (definition->major != KEYLEDSD_VERSION_MAJOR ||
+        (KEYLEDSD_VERSION_MAJOR == 0 && definition->minor != KEYLEDSD_VERSION_MINOR)) {
         if (error) {
             *error = "plugin version " + std::to_string(definition->major)
-                   + " does not matchkeyleds version";
+                   + "." + std::to_string(definition->minor)
+                   + " does not match keyleds version";
         }
         return false;
     }
@@ -0,0 +1,300 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/LayoutDatabase.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+#include "keyledsd/LayoutDescription.h"
+
+using keyleds::LayoutDatabase;
+using keyleds::LayoutDescription;
+
+/****************************************************************************/
+// File format
+//
+// All integers are stored in little-endian byte order, so a database compiled
+// on the build machine can be used on any target when cross-compiling. It
+// consists of a header, followed by the layout index, the key tables of all
+// layouts and a block of NUL-terminated strings, every one of which is stored
+// only once.
+
+static constexpr char       fileMagic[4] = { 'K', 'L', 'D', 'B' };
+static constexpr uint16_t   fileVersion = 2;
+static constexpr uint16_t   fileByteOrder = 0x0102;
+
+struct FileHeader {
+    char        magic[4];       ///< Always fileMagic
+    uint16_t    version;        ///< Format version, bumped on any incompatible change
+    uint16_t    byteOrder;      ///< Always fileByteOrder, catches writers that ignore endianness
+    uint32_t    nbLayouts;      ///< Number of FileLayout entries following the header
+    uint32_t    nbKeys;         ///< Total number of FileKey entries following the layouts
+    uint32_t    stringsSize;    ///< Size of string block following the keys, in bytes
+};
+
+struct FileLayout {
+    uint32_t    id;             ///< String offset of layout identifier, entries are sorted on it
+    uint32_t    name;           ///< String offset of layout name
+    uint32_t    firstKey;       ///< Index of first key of the layout
+    uint32_t    nbKeys;         ///< Number of keys in the layout
+};
+
+struct FileKey {
+    uint16_t    block;          ///< Block identifier
+    uint16_t    code;           ///< Key identifier within block, keys are sorted on (block, code)
+    uint32_t    name;           ///< String offset of key name
+    uint16_t    x0, y0, x1, y1; ///< Precomputed key rectangle
+};
+
+static_assert(sizeof(FileHeader) % alignof(FileLayout) == 0, "layout index must be aligned");
+static_assert(sizeof(FileLayout) % alignof(FileKey) == 0, "key table must be aligned");
+static_assert(sizeof(FileKey) == 16, "key entries must not be padded");
+
+/****************************************************************************/
+
+namespace {
+
+/// Conversion of integers from and to file byte order
+inline uint16_t fromFile(uint16_t value) { return le16toh(value); }
+inline uint32_t fromFile(uint32_t value) { return le32toh(value); }
+inline uint16_t toFile(uint16_t value) { return htole16(value); }
+inline uint32_t toFile(uint32_t value) { return htole32(value); }
+
+/// Typed view on mapped database contents, with bound checking
+class FileView final
+{
+public:
+    FileView(const char * data, std::size_t size)
+    {
+        if (size < sizeof(FileHeader)) { throw std::runtime_error("not a layout database"); }
+        const auto * header = reinterpret_cast<const FileHeader *>(data);
+        if (std::memcmp(header->magic, fileMagic, sizeof(fileMagic)) != 0) {
+            throw std::runtime_error("not a layout database");
+        }
+        if (fromFile(header->byteOrder) != fileByteOrder) {
+            throw std::runtime_error("layout database has wrong byte order");
+        }
+        if (fromFile(header->version) != fileVersion) {
+            throw std::runtime_error("unsupported layout database version " +
+                                     std::to_string(fromFile(header->version)));
+        }
+        m_nbLayouts = fromFile(header->nbLayouts);
+        m_nbKeys = fromFile(header->nbKeys);
+        m_stringsSize = fromFile(header->stringsSize);
+
+        auto expected = sizeof(FileHeader)
+                      + std::size_t(m_nbLayouts) * sizeof(FileLayout)
+                      + std::size_t(m_nbKeys) * sizeof(FileKey)
+                      + m_stringsSize;
+        if (size != expected || m_stringsSize == 0 || data[size - 1] != '\0') {
+            throw std::runtime_error("layout database is truncated or corrupted");
+        }
+        m_layouts = reinterpret_cast<const FileLayout *>(header + 1);
+        m_keys = reinterpret_cast<const FileKey *>(m_layouts + m_nbLayouts);
+        m_strings = reinterpret_cast<const char *>(m_keys + m_nbKeys);
+    }
+
+    const FileLayout *  layoutsBegin() const { return m_layouts; }
+    const FileLayout *  layoutsEnd() const { return m_layouts + m_nbLayouts; }
+
+    const FileKey *     keysBegin(const FileLayout & layout) const
+    {
+        auto firstKey = fromFile(layout.firstKey);
+        if (firstKey > m_nbKeys || fromFile(layout.nbKeys) > m_nbKeys - firstKey) {
+            throw std::runtime_error("layout database has invalid key range");
+        }
+        return m_keys + firstKey;
+    }
+
+    const char *        string(uint32_t offset) const
+    {
+        offset = fromFile(offset);
+        if (offset >= m_stringsSize) {
+            throw std::runtime_error("layout database has invalid string offset");
+        }
+        return m_strings + offset;      // string block is NUL-terminated, checked above
+    }
+
+private:
+    uint32_t            m_nbLayouts;
+    uint32_t            m_nbKeys;
+    uint32_t            m_stringsSize;
+    const FileLayout *  m_layouts;
+    const FileKey *     m_keys;
+    const char *        m_strings;
+};
+
+/// Builds the string block while writing a database, storing each string once
+class StringTable final
+{
+public:
+    StringTable() { intern(std::string()); }
+
+    uint32_t intern(const std::string & value)
+    {
+        auto it = m_offsets.find(value);
+        if (it != m_offsets.end()) { return it->second; }
+        auto offset = uint32_t(m_data.size());
+        m_data.insert(m_data.end(), value.c_str(), value.c_str() + value.size() + 1);
+        m_offsets.emplace(value, offset);
+        return offset;
+    }
+
+    const std::vector<char> & data() const { return m_data; }
+
+private:
+    std::map<std::string, uint32_t> m_offsets;
+    std::vector<char>               m_data;
+};
+
+template <typename T, typename U> T checkedCast(U value, const char * what)
+{
+    if (value > std::numeric_limits<T>::max()) {
+        throw std::out_of_range(std::string(what) + " " + std::to_string(value) + " out of range");
+    }
+    return T(value);
+}
+
+} // namespace
+
+/****************************************************************************/
+
+LayoutDatabase::LayoutDatabase(const std::string & path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { throw std::system_error(errno, std::generic_category()); }
+
+    struct stat info;
+    if (::fstat(fd, &info) < 0) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category());
+    }
+    m_size = std::size_t(info.st_size);
+
+    void * data = m_size > 0 ? ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    auto error = m_size > 0 ? errno : EINVAL;
+    ::close(fd);
+    if (data == MAP_FAILED) { throw std::system_error(error, std::generic_category()); }
+
+    auto size = m_size;
+    m_data = std::shared_ptr<const char>(static_cast<const char *>(data),
+                                         [size](const char * ptr) {
+                                             ::munmap(const_cast<char *>(ptr), size);
+                                         });
+    FileView(m_data.get(), m_size);
+}
+
+LayoutDatabase::LayoutDatabase(LayoutDatabase && other) noexcept
+ : m_data(std::move(other.m_data)), m_size(other.m_size)
+{
+    other.m_size = 0;
+}
+
+LayoutDatabase::~LayoutDatabase() {}
+
+std::size_t LayoutDatabase::size() const
+{
+    auto view = FileView(m_data.get(), m_size);
+    return std::size_t(view.layoutsEnd() - view.layoutsBegin());
+}
+
+bool LayoutDatabase::find(const std::string & name, LayoutDescription * layout) const
+{
+    auto view = FileView(m_data.get(), m_size);
+    auto it = std::lower_bound(
+        view.layoutsBegin(), view.layoutsEnd(), name,
+        [&view](const FileLayout & entry, const std::string & value) {
+            return std::strcmp(view.string(entry.id), value.c_str()) < 0;
+        });
+    if (it == view.layoutsEnd() || name != view.string(it->id)) { return false; }
+
+    // Key names are referenced in place, the layout shares ownership of the mapping
+    const auto nbKeys = fromFile(it->nbKeys);
+    const auto * keysBegin = view.keysBegin(*it);
+    LayoutDescription::key_list keys;
+    keys.reserve(nbKeys);
+    std::for_each(keysBegin, keysBegin + nbKeys, [&view, &keys](const FileKey & key) {
+        keys.emplace_back(fromFile(key.block), fromFile(key.code),
+                          LayoutDescription::Rect{ fromFile(key.x0), fromFile(key.y0),
+                                                   fromFile(key.x1), fromFile(key.y1) },
+                          view.string(key.name));
+    });
+    *layout = LayoutDescription(view.string(it->name), std::move(keys), m_data);
+    return true;
+}
+
+void LayoutDatabase::write(std::ostream & out, entry_list entries)
+{
+    std::sort(entries.begin(), entries.end(),
+              [](const auto & a, const auto & b) { return a.first < b.first; });
+    auto dup = std::adjacent_find(entries.begin(), entries.end(),
+                                  [](const auto & a, const auto & b) { return a.first == b.first; });
+    if (dup != entries.end()) {
+        throw std::invalid_argument("duplicate layout " + dup->first);
+    }
+
+    StringTable strings;
+    std::vector<FileLayout> layouts;
+    std::vector<FileKey> keys;
+    layouts.reserve(entries.size());
+
+    for (const auto & entry : entries) {
+        const auto & layoutKeys = entry.second->keys();  // sorted by (block, code)
+        layouts.push_back({
+            toFile(strings.intern(entry.first)),
+            toFile(strings.intern(entry.second->name())),
+            toFile(checkedCast<uint32_t>(keys.size(), "key index")),
+            toFile(checkedCast<uint32_t>(layoutKeys.size(), "key count"))
+        });
+        for (const auto & key : layoutKeys) {
+            keys.push_back({
+                toFile(checkedCast<uint16_t>(key.block, "block")),
+                toFile(checkedCast<uint16_t>(key.code, "key code")),
+                toFile(strings.intern(key.name)),
+                toFile(checkedCast<uint16_t>(key.position.x0, "coordinate")),
+                toFile(checkedCast<uint16_t>(key.position.y0, "coordinate")),
+                toFile(checkedCast<uint16_t>(key.position.x1, "coordinate")),
+                toFile(checkedCast<uint16_t>(key.position.y1, "coordinate"))
+            });
+        }
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, fileMagic, sizeof(header.magic));
+    header.version = toFile(fileVersion);
+    header.byteOrder = toFile(fileByteOrder);
+    header.nbLayouts = toFile(checkedCast<uint32_t>(layouts.size(), "layout count"));
+    header.nbKeys = toFile(checkedCast<uint32_t>(keys.size(), "key count"));
+    header.stringsSize = toFile(checkedCast<uint32_t>(strings.data().size(), "string block size"));
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(layouts.data()), layouts.size() * sizeof(FileLayout));
+    out.write(reinterpret_cast<const char *>(keys.data()), keys.size() * sizeof(FileKey));
+    out.write(strings.data().data(), strings.data().size());
+}
@@ -0,0 +1,224 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyledsd/ProfileMatcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <regex>
+#include "logging.h"
+
+LOGGING("profile-matcher");
+
+using keyleds::ProfileMatcher;
+using Profile = keyleds::Configuration::Profile;
+
+static constexpr char defaultProfileName[] = "__default__";
+static constexpr char overlayProfileName[] = "__overlay__";
+
+/****************************************************************************/
+
+/// Computes the literal prefix any string matching the pattern must start with.
+/// Sets literal if the pattern is made of that prefix only.
+static std::string literalPrefix(const std::string & pattern, bool * literal)
+{
+    static constexpr char specials[] = "\\^$.|?*+()[]{}";
+
+    *literal = false;
+    if (pattern.find('|') != std::string::npos) { return {}; }     // alternation
+    auto end = pattern.find_first_of(specials);
+    if (end == std::string::npos) {
+        *literal = true;
+        return pattern;
+    }
+    // Last literal character is optional if followed by those quantifiers
+    if (end > 0 && std::strchr("?*{", pattern[end]) != nullptr) { --end; }
+    return pattern.substr(0, end);
+}
+
+static ProfileMatcher::effect_group_list resolveGroups(const keyleds::Configuration & config,
+                                                       const Profile & profile)
+{
+    ProfileMatcher::effect_group_list result;
+    for (const auto & name : profile.effectGroups()) {
+        auto eit = std::find_if(config.effectGroups().begin(), config.effectGroups().end(),
+                                [&name](auto & group) { return group.name() == name; });
+        if (eit == config.effectGroups().end()) {
+            ERROR("profile <", profile.name(), "> references unknown effect group <", name, ">");
+            continue;
+        }
+        result.push_back(&*eit);
+    }
+    return result;
+}
+
+/****************************************************************************/
+
+/// A single lookup filter, shared by all profiles that use it
+class ProfileMatcher::Condition final
+{
+public:
+    Condition(std::size_t key, std::string pattern)
+     : m_key(key),
+       m_pattern(std::move(pattern)),
+       m_prefix(literalPrefix(m_pattern, &m_literal))
+    {
+        if (!m_literal) {
+            m_regex = std::regex(m_pattern, std::regex::nosubs | std::regex::optimize);
+        }
+    }
+
+    std::size_t         key() const { return m_key; }
+    const std::string & pattern() const { return m_pattern; }
+
+    bool                match(const std::string & value) const
+    {
+        if (m_literal) { return value == m_prefix; }
+        if (value.compare(0, m_prefix.size(), m_prefix) != 0) { return false; }
+        return std::regex_match(value, m_regex);
+    }
+
+private:
+    std::size_t m_key;          ///< Index of context key in matcher's key list
+    std::string m_pattern;      ///< Regex source
+    bool        m_literal;      ///< Set if pattern has no special characters
+    std::string m_prefix;       ///< Literal prefix of pattern, whole pattern if m_literal
+    std::regex  m_regex;        ///< Compiled pattern, unused if m_literal
+};
+
+/****************************************************************************/
+
+ProfileMatcher::ProfileMatcher()
+ : m_hasDefault(false)
+{}
+
+ProfileMatcher::ProfileMatcher(const Configuration & config, const std::string & deviceName)
+ : m_hasDefault(false)
+{
+    const Profile * defaultProfile = nullptr;
+    const Profile * overlayProfile = nullptr;
+    std::vector<const Profile *> profiles;
+
+    for (const auto & profile : config.profiles()) {
+        const auto & devices = profile.devices();
+        if (!devices.empty() &&
+            std::find(devices.begin(), devices.end(), deviceName) == devices.end()) {
+            continue;
+        }
+        if (profile.name() == defaultProfileName) {
+            defaultProfile = &profile;
+        } else if (profile.name() == overlayProfileName) {
+            overlayProfile = &profile;
+        } else {
+            profiles.push_back(&profile);
+        }
+    }
+
+    auto overlayGroups = overlayProfile != nullptr ? resolveGroups(config, *overlayProfile)
+                                                   : effect_group_list();
+    auto makeSelection = [&](const Profile & profile) {
+        auto groups = resolveGroups(config, profile);
+        groups.insert(groups.end(), overlayGroups.begin(), overlayGroups.end());
+        return Selection{ &profile, std::move(groups) };
+    };
+
+    // Compile lookups of regular profiles, sharing identical conditions
+    for (const auto * profile : profiles) {
+        index_list indices;
+        for (auto & filter : profile->lookup().filters()) {
+            auto kit = std::find(m_keys.begin(), m_keys.end(), filter.first);
+            auto keyIdx = std::size_t(kit - m_keys.begin());
+            if (kit == m_keys.end()) { m_keys.push_back(std::move(filter.first)); }
+
+            auto cit = std::find_if(m_conditions.begin(), m_conditions.end(),
+                                    [&](const auto & condition) {
+                                        return condition->key() == keyIdx &&
+                                               condition->pattern() == filter.second;
+                                    });
+            indices.push_back(std::size_t(cit - m_conditions.begin()));
+            if (cit == m_conditions.end()) {
+                m_conditions.push_back(std::make_unique<Condition>(keyIdx, std::move(filter.second)));
+            }
+        }
+        m_profiles.push_back(std::move(indices));
+        m_selections.push_back(makeSelection(*profile));
+    }
+    if (defaultProfile != nullptr) {
+        m_selections.push_back(makeSelection(*defaultProfile));
+        m_hasDefault = true;
+    }
+
+    m_cache.reserve(cacheSize);
+    m_values.reserve(m_keys.size());
+}
+
+ProfileMatcher::ProfileMatcher(ProfileMatcher &&) noexcept = default;
+ProfileMatcher::~ProfileMatcher() {}
+ProfileMatcher & ProfileMatcher::operator=(ProfileMatcher &&) noexcept = default;
+
+const ProfileMatcher::Selection * ProfileMatcher::match(const string_map & context)
+{
+    static const std::string empty;
+
+    m_values.clear();
+    for (const auto & key : m_keys) {
+        auto it = std::find_if(context.begin(), context.end(),
+                               [&key](const auto & entry) { return entry.first == key; });
+        m_values.push_back(it != context.end() ? &it->second : &empty);
+    }
+
+    auto cit = std::find_if(m_cache.begin(), m_cache.end(), [this](const auto & entry) {
+        return std::equal(entry.first.begin(), entry.first.end(), m_values.begin(),
+                          [](const auto & cached, const auto * value) { return cached == *value; });
+    });
+    if (cit != m_cache.end()) {
+        std::rotate(m_cache.begin(), cit, cit + 1);
+        return m_cache.front().second;
+    }
+
+    const auto * selection = select(m_values);
+    if (m_cache.size() == cacheSize) { m_cache.pop_back(); }
+    std::vector<std::string> values;
+    values.reserve(m_values.size());
+    std::transform(m_values.begin(), m_values.end(), std::back_inserter(values),
+                   [](const auto * value) { return *value; });
+    m_cache.emplace(m_cache.begin(), std::move(values), selection);
+    return selection;
+}
+
+const ProfileMatcher::Selection *
+ProfileMatcher::select(const std::vector<const std::string *> & values) const
+{
+    // Each condition is evaluated at most once: -1 unknown, 0 no match, 1 match
+    std::vector<signed char> results(m_conditions.size(), -1);
+
+    // When several profiles match, the last one wins
+    for (auto idx = m_profiles.size(); idx-- > 0; ) {
+        const auto & indices = m_profiles[idx];
+        bool matched = std::all_of(indices.begin(), indices.end(), [&](auto cidx) {
+            if (results[cidx] < 0) {
+                const auto & condition = *m_conditions[cidx];
+                results[cidx] = condition.match(*values[condition.key()]) ? 1 : 0;
+            }
+            return results[cidx] != 0;
+        });
+        if (matched) {
+            DEBUG("profile matches: ", m_selections[idx].profile->name());
+            return &m_selections[idx];
+        }
+    }
+    return m_hasDefault ? &m_selections.back() : nullptr;
+}
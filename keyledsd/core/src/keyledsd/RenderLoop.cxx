@@ -21,6 +21,7 @@
 #include <cerrno>
 #include <chrono>
 #include <exception>
+#include <numeric>
 #include <thread>
 #include "keyledsd/Device.h"
 #include "logging.h"
@@ -35,6 +36,7 @@ using keyleds::RenderLoop;
 RenderLoop::RenderLoop(Device & device, unsigned fps)
     : AnimationLoop(fps),
       m_device(device),
+      m_refresh(false),
       m_state(renderTargetFor(device)),
       m_buffer(renderTargetFor(device))
 {
@@ -54,6 +56,11 @@ std::unique_lock<std::mutex> RenderLoop::lock()
     return std::unique_lock<std::mutex>(m_mRenderers);
 }
 
+void RenderLoop::refresh()
+{
+    m_refresh = true;
+}
+
 keyleds::RenderTarget RenderLoop::renderTargetFor(const Device & device)
 {
     return RenderTarget(std::accumulate(
@@ -75,10 +82,8 @@ bool RenderLoop::render(unsigned long nanosec)
     }
 
     if (hasRenderers) {
-        m_device.flush();   // Ensure another program using the device did not fill
-                            // The inbound report queue.
-
-        // Compute diff
+        // Compute diff, or send everything if device state is unknown
+        const bool refresh = m_refresh.exchange(false);
         bool hasChanges = false;
         auto oldKeyIt = m_state.cbegin();
         auto newKeyIt = m_buffer.cbegin();
@@ -88,7 +93,7 @@ bool RenderLoop::render(unsigned long nanosec)
             m_directives.clear();
 
             for (size_t kIdx = 0; kIdx < numBlockKeys; ++kIdx) {
-                if (*oldKeyIt != *newKeyIt) {
+                if (refresh || *oldKeyIt != *newKeyIt) {
                     m_directives.push_back({
                         block.keys()[kIdx], newKeyIt->red, newKeyIt->green, newKeyIt->blue
                     });
@@ -0,0 +1,298 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** Layout compiler
+ *
+ * Tool that parses layout XML files and writes them all into a single layout
+ * database, which keyledsd then maps at runtime. It runs at build time to
+ * produce the system database, and is installed as keyledsd-layoutc so users
+ * can compile their own layouts into an overriding database. This is the only
+ * place where layout XML is parsed, keyledsd itself does not need libxml2.
+ *
+ * Usage: keyledsd-layoutc <output> <layout.xml>...
+ */
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "keyledsd/LayoutDatabase.h"
+#include "keyledsd/LayoutDescription.h"
+
+using keyleds::LayoutDatabase;
+using keyleds::LayoutDescription;
+
+/****************************************************************************/
+
+namespace {
+
+class ParseError : public std::runtime_error
+{
+public:
+                ParseError(const std::string & what, int line)
+                 : std::runtime_error(what), m_line(line) {}
+
+    int         line() const noexcept { return m_line; }
+private:
+    int         m_line; ///< Line of the parsing error, as reported by xml lib
+};
+
+} // namespace
+
+/****************************************************************************/
+
+using xmlString = std::unique_ptr<xmlChar, void(*)(void *)>;
+
+static constexpr xmlChar KEYBOARD_TAG[] = "keyboard";
+static constexpr xmlChar ROW_TAG[] = "row";
+static constexpr xmlChar KEY_TAG[] = "key";
+
+static constexpr xmlChar ROOT_ATTR_NAME[] = "layout";
+static constexpr xmlChar KEYBOARD_ATTR_X[] = "x";
+static constexpr xmlChar KEYBOARD_ATTR_Y[] = "y";
+static constexpr xmlChar KEYBOARD_ATTR_WIDTH[] = "width";
+static constexpr xmlChar KEYBOARD_ATTR_HEIGHT[] = "height";
+static constexpr xmlChar KEYBOARD_ATTR_ZONE[] = "zone";
+static constexpr xmlChar KEY_ATTR_CODE[] = "code";
+static constexpr xmlChar KEY_ATTR_GLYPH[] = "glyph";
+static constexpr xmlChar KEY_ATTR_WIDTH[] = "width";
+
+/****************************************************************************/
+
+static void hideErrorFunc(void *, xmlErrorPtr) {}
+
+static unsigned parseUInt(const xmlNode * node, const xmlChar * name, int base)
+{
+    xmlString valueStr(xmlGetProp(const_cast<xmlNode *>(node), name), xmlFree);
+    if (valueStr == nullptr) {
+        std::ostringstream errMsg;
+        errMsg <<"Element '" <<node->name <<"' misses a '" <<name <<"' attribute";
+        throw ParseError(errMsg.str(), xmlGetLineNo(const_cast<xmlNode *>(node)));
+    }
+    char * strEnd;
+    unsigned valueUInt = std::strtoul((char*)valueStr.get(), &strEnd, base);
+    if (*strEnd != '\0') {
+        std::ostringstream errMsg;
+        errMsg <<"Value '" <<valueStr.get() <<"' in attribute '" <<name <<"' of '"
+               <<node->name <<"' element cannot be parsed as an integer";
+        throw ParseError(errMsg.str(), xmlGetLineNo(const_cast<xmlNode *>(node)));
+    }
+    return valueUInt;
+}
+
+/****************************************************************************/
+
+static void parseKeyboard(const xmlNode * keyboard, LayoutDescription::key_list & keys,
+                          std::deque<std::string> & names)
+{
+    char * strEnd;
+    unsigned kbX = parseUInt(keyboard, KEYBOARD_ATTR_X, 10);
+    unsigned kbY = parseUInt(keyboard, KEYBOARD_ATTR_Y, 10);
+    unsigned kbWidth = parseUInt(keyboard, KEYBOARD_ATTR_WIDTH, 10);
+    unsigned kbHeight = parseUInt(keyboard, KEYBOARD_ATTR_HEIGHT, 10);
+    unsigned kbZone = parseUInt(keyboard, KEYBOARD_ATTR_ZONE, 0);
+
+    unsigned nbRows = 0;
+    for (const xmlNode * row = keyboard->children; row != nullptr; row = row->next) {
+        if (row->type == XML_ELEMENT_NODE || xmlStrcmp(row->name, ROW_TAG) == 0) { nbRows += 1; }
+    }
+
+    unsigned rowIdx = 0;
+    for (const xmlNode * row = keyboard->children; row != nullptr; row = row->next) {
+        if (row->type != XML_ELEMENT_NODE || xmlStrcmp(row->name, ROW_TAG) != 0) { continue; }
+
+        unsigned totalWidth = 0;
+        for (const xmlNode * key = row->children; key != nullptr; key = key->next) {
+            if (key->type != XML_ELEMENT_NODE || xmlStrcmp(key->name, KEY_TAG) != 0) { continue; }
+            xmlString keyWidthStr(xmlGetProp(const_cast<xmlNode *>(key), KEY_ATTR_WIDTH), xmlFree);
+            if (keyWidthStr != nullptr) {
+                auto keyWidthFloat = ::strtof((char*)keyWidthStr.get(), &strEnd);
+                if (*strEnd != '\0') {
+                    std::ostringstream errMsg;
+                    errMsg <<"Value '" <<keyWidthStr.get() <<"' in attribute '"
+                           <<KEY_ATTR_WIDTH <<"' of '" <<KEY_TAG
+                           <<"' element cannot be parsed as a float";
+                    throw ParseError(errMsg.str(), xmlGetLineNo(const_cast<xmlNode *>(key)));
+                }
+                totalWidth += (unsigned int)(keyWidthFloat * 1000);
+            } else {
+                totalWidth += 1000;
+            }
+        }
+
+        unsigned xOffset = 0;
+        for (const xmlNode * key = row->children; key != nullptr; key = key->next) {
+            if (key->type != XML_ELEMENT_NODE || xmlStrcmp(key->name, KEY_TAG) != 0) { continue; }
+            xmlString code(xmlGetProp(const_cast<xmlNode *>(key), KEY_ATTR_CODE), xmlFree);
+            xmlString glyph(xmlGetProp(const_cast<xmlNode *>(key), KEY_ATTR_GLYPH), xmlFree);
+            xmlString keyWidthStr(xmlGetProp(const_cast<xmlNode *>(key), KEY_ATTR_WIDTH), xmlFree);
+
+            unsigned keyWidth;
+            if (keyWidthStr != nullptr) {
+                keyWidth = kbWidth
+                         * (unsigned int)(::strtof((char*)keyWidthStr.get(), &strEnd) * 1000)
+                         / totalWidth;
+            } else {
+                keyWidth = kbWidth * 1000 / totalWidth;
+            }
+
+            if (code != nullptr) {
+                unsigned codeVal = parseUInt(key, KEY_ATTR_CODE, 0);
+                auto codeNameStr = glyph != nullptr ? std::string(reinterpret_cast<char *>(glyph.get()))
+                                                    : std::string();
+                std::transform(codeNameStr.begin(), codeNameStr.end(), codeNameStr.begin(), ::toupper);
+                names.push_back(std::move(codeNameStr));
+
+                keys.emplace_back(
+                    kbZone,
+                    codeVal,
+                    LayoutDescription::Rect {
+                        kbX + xOffset,
+                        kbY + rowIdx * (kbHeight / nbRows),
+                        kbX + xOffset + keyWidth - 1,
+                        kbY + (rowIdx + 1) * (kbHeight / nbRows) - 1
+                    },
+                    names.back().c_str()
+                );
+            }
+            xOffset += keyWidth;
+        }
+        rowIdx += 1;
+    }
+}
+
+/****************************************************************************/
+
+static LayoutDescription parseLayout(std::istream & stream)
+{
+    // Parser context
+    std::unique_ptr<xmlParserCtxt, void(*)(xmlParserCtxtPtr)> context(
+        xmlNewParserCtxt(), xmlFreeParserCtxt
+    );
+    if (context == nullptr) {
+        throw std::runtime_error("Failed to initialize libxml");
+    }
+    xmlSetStructuredErrorFunc(context.get(), hideErrorFunc);
+
+    // Document
+    std::ostringstream bufferStream;
+    bufferStream << stream.rdbuf();
+    std::string buffer = bufferStream.str();
+    std::unique_ptr<xmlDoc, void(*)(xmlDocPtr)> document(
+        xmlCtxtReadMemory(context.get(), buffer.data(), buffer.size(),
+                          nullptr, nullptr, XML_PARSE_NOWARNING | XML_PARSE_NONET),
+        xmlFreeDoc
+    );
+    if (document == nullptr) {
+        auto error = xmlCtxtGetLastError(context.get());
+        if (error == nullptr) { throw ParseError("empty file", 1); }
+        std::string errMsg(error->message);
+        errMsg.erase(errMsg.find_last_not_of(" \r\n") + 1);
+        throw ParseError(errMsg, error->line);
+    }
+
+    // Search for keyboard nodes
+    const xmlNode * const root = xmlDocGetRootElement(document.get());
+    if (root == nullptr) { throw ParseError("document has no root element", 1); }
+    auto name = xmlString(xmlGetProp(const_cast<xmlNode *>(root), ROOT_ATTR_NAME), xmlFree);
+
+    // Strings live in a deque, which never moves its elements once added
+    auto names = std::make_shared<std::deque<std::string>>();
+    names->push_back(name != nullptr ? reinterpret_cast<const char *>(name.get()) : "");
+
+    LayoutDescription::key_list keys;
+    for (const xmlNode * node = root->children; node != nullptr; node = node->next) {
+        if (node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, KEYBOARD_TAG) == 0) {
+            parseKeyboard(node, keys, *names);
+        }
+    }
+
+    // Finalize
+    const char * layoutName = names->front().c_str();
+    return LayoutDescription(layoutName, std::move(keys), std::move(names));
+}
+
+/****************************************************************************/
+
+static std::string layoutId(const std::string & path)
+{
+    auto start = path.find_last_of('/');
+    auto base = path.substr(start == std::string::npos ? 0 : start + 1);
+    auto dot = base.find_last_of('.');
+    return dot == std::string::npos ? base : base.substr(0, dot);
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2) {
+        std::cerr <<"Usage: " <<argv[0] <<" <output> <layout.xml>..." <<std::endl;
+        return 1;
+    }
+    const std::string output = argv[1];
+
+    std::vector<LayoutDescription> layouts;
+    layouts.reserve(argc - 2);
+    LayoutDatabase::entry_list entries;
+    for (int idx = 2; idx < argc; ++idx) {
+        std::ifstream file(argv[idx]);
+        if (!file) {
+            std::cerr <<argv[idx] <<": cannot open file" <<std::endl;
+            return 1;
+        }
+        try {
+            layouts.push_back(parseLayout(file));
+        } catch (ParseError & error) {
+            std::cerr <<argv[idx] <<':' <<error.line() <<": " <<error.what() <<std::endl;
+            return 1;
+        } catch (std::exception & error) {
+            std::cerr <<argv[idx] <<": " <<error.what() <<std::endl;
+            return 1;
+        }
+        entries.emplace_back(layoutId(argv[idx]), &layouts.back());
+    }
+
+    // Write to a temporary file and rename it over output, so a running
+    // keyledsd that has the database mapped never sees a partial file
+    const std::string tmpOutput = output + ".tmp";
+    try {
+        std::ofstream file(tmpOutput, std::ios::binary | std::ios::trunc);
+        if (!file) { throw std::runtime_error("cannot create file"); }
+        LayoutDatabase::write(file, std::move(entries));
+        file.close();
+        if (!file) { throw std::runtime_error("write failed"); }
+    } catch (std::exception & error) {
+        std::cerr <<tmpOutput <<": " <<error.what() <<std::endl;
+        std::remove(tmpOutput.c_str());
+        return 1;
+    }
+    if (std::rename(tmpOutput.c_str(), output.c_str()) != 0) {
+        std::cerr <<output <<": " <<std::strerror(errno) <<std::endl;
+        std::remove(tmpOutput.c_str());
+        return 1;
+    }
+    return 0;
+}
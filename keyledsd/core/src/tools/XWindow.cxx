@@ -366,3 +366,10 @@ int ErrorCatcher::errorHandler(X11Display *, XErrorEvent * error)
 }
 
 ErrorCatcher * ErrorCatcher::s_current = nullptr;
+
+/****************************************************************************/
+
+void xlib::initThreads()
+{
+    XInitThreads();
+}
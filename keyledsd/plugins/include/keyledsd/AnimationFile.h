@@ -0,0 +1,68 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYLEDSD_EFFECT_ANIMATION_FILE_H_5E0C7A31
+#define KEYLEDSD_EFFECT_ANIMATION_FILE_H_5E0C7A31
+
+#include <cstdint>
+
+namespace plugin { namespace animation {
+
+/****************************************************************************/
+// File format
+//
+// Animation files hold a sequence of frames for a set of named keys, using
+// native byte order. They are produced by keyledsd-animc from a text
+// description. They start with a header, followed by:
+//  - nbKeys key name offsets (uint32), into the string table.
+//  - nbFrames frame offsets (uint32), from start of file. Frame 0 is a key
+//    frame: nbKeys colors (R8G8B8A8), one per key. Other frames are deltas
+//    against the previous frame: a count (uint32) followed by that many
+//    FileDelta entries.
+//  - the string table: NUL-terminated key names.
+// The last frame is followed by the first one again, so animations loop.
+// All offsets are multiples of 4.
+
+constexpr char fileMagic[4] = { 'K', 'L', 'A', 'N' };
+constexpr std::uint16_t fileVersion = 1;
+constexpr std::uint16_t fileByteOrder = 0x0102;
+
+struct FileHeader
+{
+    char            magic[4];
+    std::uint16_t   version;
+    std::uint16_t   byteOrder;
+    std::uint32_t   nbKeys;
+    std::uint32_t   nbFrames;
+    std::uint32_t   frameDuration;  ///< in milliseconds
+    std::uint32_t   stringsOffset;  ///< from start of file
+    std::uint32_t   stringsSize;
+};
+
+struct FileDelta
+{
+    std::uint32_t   key;            ///< index in file's key list
+    std::uint8_t    color[4];       ///< R8G8B8A8
+};
+
+static_assert(sizeof(FileHeader) == 28, "unexpected padding in FileHeader");
+static_assert(sizeof(FileDelta) == 8, "unexpected padding in FileDelta");
+
+/****************************************************************************/
+
+} } // namespace plugin::animation
+
+#endif
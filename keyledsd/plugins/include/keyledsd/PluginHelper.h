@@ -36,6 +36,7 @@ public:
     void    handleKeyEvent(const KeyDatabase::Key &, bool) override {}
 
     keyleds::Renderer * renderer() override { return this; }
+    std::size_t memoryUsage() const override { return 0; }
 };
 
 template <typename T>
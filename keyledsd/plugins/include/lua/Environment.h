@@ -47,6 +47,7 @@ public:
     public:
         virtual void            print(const std::string &) const = 0;
         virtual bool            parseColor(const std::string &, RGBAColor *) const = 0;
+        virtual const KeyDatabase & keyDB() const = 0;
 
         virtual RenderTarget *  createRenderTarget() = 0;
         virtual void            destroyRenderTarget(RenderTarget *) = 0;
@@ -62,6 +63,7 @@ public:
 
     void            openKeyleds(Controller *);
     Controller *    controller() const;
+    const KeyDatabase * keyDB() const;
 
     void            stepInterpolators(unsigned ms) { Interpolator::stepAll(m_lua, ms); }
 
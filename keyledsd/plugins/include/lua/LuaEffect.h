@@ -50,10 +50,12 @@ public: // Effect interface for keyleds & lua init hook
     void            handleContextChange(const string_map &) override;
     void            handleGenericEvent(const string_map &) override;
     void            handleKeyEvent(const KeyDatabase::Key &, bool) override;
+    std::size_t     memoryUsage() const override;
 
 public: // Environment::Controller interface for lua
     void            print(const std::string &) const override;
     bool            parseColor(const std::string &, RGBAColor *) const override;
+    const KeyDatabase & keyDB() const override;
     RenderTarget *  createRenderTarget() override;
     void            destroyRenderTarget(RenderTarget *) override;
     int             createThread(lua_State * lua, int nargs) override;
@@ -28,6 +28,13 @@ template <> struct metatable<const KeyDatabase::KeyGroup *>
     { static const char * name; static constexpr struct luaL_Reg * methods = nullptr;
       static const struct luaL_Reg meta_methods[]; struct weak_table : std::true_type{}; };
 
+/// Groups built by scripts, owned by lua
+template <> struct metatable<KeyDatabase::KeyGroup>
+    { static const char * name; static constexpr struct luaL_Reg * methods = nullptr;
+      static const struct luaL_Reg meta_methods[]; struct weak_table : std::false_type{}; };
+
+const KeyDatabase::KeyGroup * lua_checkkeygroup(lua_State * lua, int index);
+
 /****************************************************************************/
 
 } } // namespace keyleds::lua
@@ -0,0 +1,387 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <X11/Xlib.h>
+#include <X11/Xlibint.h>                    // for XESetError
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#undef min                                  // defined by Xlibint.h, clash with std::min
+#undef max
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "keyledsd/OnDemandThread.h"
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/TripleBuffer.h"
+#include "keyledsd/utils.h"
+
+/****************************************************************************/
+
+/** Screen grabber using the MIT-SHM extension
+ *
+ * Owns its own display connection, so it can be used from a helper thread.
+ * The server writes root window contents directly into a shared memory
+ * segment, avoiding the copy through the X socket XGetImage would incur.
+ * The segment is recreated if the root window changes size.
+ *
+ * X errors on that connection are caught by a hook registered on the
+ * connection itself, rather than by the process-wide error handler, which
+ * other code swaps at will and which the capture thread must not rely on.
+ * Xlib only runs such hooks for errors it reads while waiting for a reply,
+ * so every request is followed by a round trip. The hook records errors in
+ * a thread-local flag: only the thread using the connection receives them.
+ */
+class ScreenCapture final
+{
+public:
+    explicit ScreenCapture(const std::string & displayName)
+     : m_display(XOpenDisplay(displayName.empty() ? nullptr : displayName.c_str()))
+    {
+        if (m_display == nullptr) {
+            throw std::runtime_error(std::string("cannot open display ") + XDisplayName(displayName.c_str()));
+        }
+        if (!XShmQueryExtension(m_display)) {
+            XCloseDisplay(m_display);
+            throw std::runtime_error("display does not support MIT-SHM");
+        }
+        m_root = DefaultRootWindow(m_display);
+
+        // Private extension slot, only used to hook errors of this connection
+        auto * codes = XAddExtension(m_display);
+        if (codes == nullptr) {
+            XCloseDisplay(m_display);
+            throw std::runtime_error("cannot register X error hook");
+        }
+        XESetError(m_display, codes->extension, errorHook);
+
+        // Attaching fails on remote displays, catch that early
+        try {
+            resize();
+        } catch (...) {
+            destroyImage();
+            XCloseDisplay(m_display);
+            throw;
+        }
+    }
+
+    ~ScreenCapture()
+    {
+        destroyImage();
+        XCloseDisplay(m_display);
+    }
+
+    /// Grabs the whole root window, image is valid until next call
+    const XImage & capture()
+    {
+        resize();
+        t_failed = false;
+        if (!XShmGetImage(m_display, m_root, m_image, 0, 0, AllPlanes) || t_failed) {
+            throw std::runtime_error("screen capture failed");
+        }
+        return *m_image;
+    }
+
+private:
+    void resize()
+    {
+        ::Window root;
+        int x, y;
+        unsigned width, height, border, depth;
+        t_failed = false;
+        if (!XGetGeometry(m_display, m_root, &root, &x, &y, &width, &height, &border, &depth)
+            || t_failed) {
+            throw std::runtime_error("cannot query screen size");
+        }
+        if (m_image != nullptr && unsigned(m_image->width) == width
+                               && unsigned(m_image->height) == height) { return; }
+        destroyImage();
+
+        const int screen = DefaultScreen(m_display);
+        m_image = XShmCreateImage(m_display, DefaultVisual(m_display, screen),
+                                  unsigned(DefaultDepth(m_display, screen)), ZPixmap,
+                                  nullptr, &m_shm, width, height);
+        if (m_image == nullptr) { throw std::runtime_error("cannot create shared image"); }
+        if (m_image->bits_per_pixel != 32 || m_image->red_mask != 0xff0000
+            || m_image->green_mask != 0xff00 || m_image->blue_mask != 0xff) {
+            throw std::runtime_error("unsupported screen pixel format");
+        }
+
+        m_shm.shmid = shmget(IPC_PRIVATE, std::size_t(m_image->bytes_per_line) * height,
+                             IPC_CREAT | 0600);
+        if (m_shm.shmid < 0) { throw std::runtime_error("cannot allocate shared memory"); }
+        m_shm.shmaddr = m_image->data = static_cast<char *>(shmat(m_shm.shmid, nullptr, 0));
+        m_shm.readOnly = False;
+        if (m_shm.shmaddr == reinterpret_cast<char *>(-1)) {
+            m_shm.shmaddr = m_image->data = nullptr;
+            throw std::runtime_error("cannot attach shared memory");
+        }
+        t_failed = false;
+        XShmAttach(m_display, &m_shm);
+        XSync(m_display, False);
+        shmctl(m_shm.shmid, IPC_RMID, nullptr);     // freed once both sides detach
+        if (t_failed) { throw std::runtime_error("cannot share memory with X server"); }
+        m_attached = true;
+    }
+
+    void destroyImage()
+    {
+        if (m_image == nullptr) { return; }
+        if (m_attached) {
+            XShmDetach(m_display, &m_shm);
+            XSync(m_display, False);
+            m_attached = false;
+        }
+        if (m_shm.shmaddr != nullptr) {
+            shmdt(m_shm.shmaddr);
+            m_shm.shmaddr = m_image->data = nullptr;
+        }
+        XDestroyImage(m_image);
+        m_image = nullptr;
+    }
+
+    /// Called by Xlib for every error on our connection, marks it handled
+    static int errorHook(::Display *, xError *, XExtCodes *, int * result)
+    {
+        t_failed = true;
+        *result = 0;
+        return 1;
+    }
+
+private:
+    ::Display *         m_display;          ///< private connection to X server
+    ::Window            m_root;             ///< window being captured
+    XImage *            m_image = nullptr;  ///< current image, sized to root window
+    XShmSegmentInfo     m_shm = {};         ///< shared segment backing m_image
+    bool                m_attached = false; ///< whether server attached the segment
+    static thread_local bool t_failed;      ///< set by error hook, cleared before checked requests
+};
+
+thread_local bool ScreenCapture::t_failed = false;
+
+/****************************************************************************/
+
+/** Downsample a 32-bit BGRX image into a grid of average colors
+ *
+ * Each grid cell is the box-filtered average of the pixels it covers. Sums
+ * are accumulated per row span with 16-bit lanes, widened to 32 bits often
+ * enough that they never overflow.
+ */
+static void downsample(const XImage & image, unsigned columns, unsigned rows,
+                       std::vector<std::uint32_t> & sums, keyleds::RGBAColor * out)
+{
+    const auto width = unsigned(image.width), height = unsigned(image.height);
+    sums.assign(std::size_t(columns) * rows * 4, 0);
+
+    for (unsigned y = 0, row = 0; y < height; ++y) {
+        while ((row + 1) * height / rows <= y) { ++row; }
+        const auto * line = reinterpret_cast<const std::uint8_t *>(image.data)
+                          + std::size_t(y) * unsigned(image.bytes_per_line);
+        auto * rowSums = &sums[std::size_t(row) * columns * 4];
+
+        for (unsigned column = 0; column < columns; ++column) {
+            const unsigned begin = column * width / columns, end = (column + 1) * width / columns;
+            const auto * pixels = line + 4 * begin;
+            auto * cell = rowSums + 4 * column;
+            unsigned idx = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            __m128i total = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cell));
+            while (idx + 4 <= end - begin) {
+                // Each step adds at most 2 * 255 per 16-bit lane, flush after 128 steps
+                const unsigned blockEnd = std::min(end - begin, idx + 4 * 128) & ~3u;
+                __m128i partial = zero;
+                for (; idx < blockEnd; idx += 4) {
+                    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 4 * idx));
+                    partial = _mm_add_epi16(partial, _mm_add_epi16(_mm_unpacklo_epi8(px, zero),
+                                                                   _mm_unpackhi_epi8(px, zero)));
+                }
+                total = _mm_add_epi32(total, _mm_unpacklo_epi16(partial, zero));
+                total = _mm_add_epi32(total, _mm_unpackhi_epi16(partial, zero));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(cell), total);
+#endif
+            for (; idx < end - begin; ++idx) {
+                for (unsigned channel = 0; channel < 4; ++channel) { cell[channel] += pixels[4 * idx + channel]; }
+            }
+        }
+    }
+
+    for (unsigned row = 0; row < rows; ++row) {
+        const auto rowHeight = (row + 1) * height / rows - row * height / rows;
+        for (unsigned column = 0; column < columns; ++column) {
+            const auto count = std::max(1u, rowHeight * ((column + 1) * width / columns - column * width / columns));
+            const auto * cell = &sums[(std::size_t(row) * columns + column) * 4];
+            out[row * columns + column] = keyleds::RGBAColor(
+                keyleds::RGBAColor::channel_type(cell[2] / count),
+                keyleds::RGBAColor::channel_type(cell[1] / count),
+                keyleds::RGBAColor::channel_type(cell[0] / count),
+                255);
+        }
+    }
+}
+
+/****************************************************************************/
+
+/** Ambient screen color effect
+ *
+ * A helper thread captures the screen at a fixed rate, averages it down to
+ * a small grid and publishes the grid through a triple buffer. Each key
+ * takes the color of the grid cell matching its position on the keyboard.
+ * The thread opens its display connection when the effect starts being
+ * rendered, and closes it when rendering stops, so loaded but inactive
+ * effect groups do not capture.
+ */
+class AmbientEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+public:
+    AmbientEffect(EffectService & service)
+     : m_service(service),
+       m_buffer(service.createRenderTarget()),
+       m_display(service.getConfig("display")),
+       m_columns(16),
+       m_rows(6),
+       m_rate(10),
+       m_alpha(255),
+       m_failed(false),
+       m_thread([this] { run(); })
+    {
+        keyleds::parseNumber(service.getConfig("columns"), &m_columns);
+        keyleds::parseNumber(service.getConfig("rows"), &m_rows);
+        keyleds::parseNumber(service.getConfig("rate"), &m_rate);
+        keyleds::parseNumber(service.getConfig("alpha"), &m_alpha);
+        m_columns = std::max(m_columns, 1u);
+        m_rows = std::max(m_rows, 1u);
+        m_rate = std::max(m_rate, 1u);
+        m_alpha = std::min(m_alpha, 255u);
+
+        loadKeys(service);
+        m_grid.reset(new keyleds::TripleBuffer<RGBAColor>(m_columns * m_rows, RGBAColor(0, 0, 0, 0)));
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+    }
+
+    void render(unsigned long, RenderTarget & target) override
+    {
+        m_thread.touch();
+        if (m_failed.exchange(false)) { m_service.log(2, m_error.c_str()); }
+
+        const auto * grid = m_grid->front();
+        for (const auto & key : m_keys) {
+            const auto & color = grid[key.cell];
+            (*m_buffer)[key.index] = RGBAColor(color.red, color.green, color.blue,
+                                               RGBAColor::channel_type(color.alpha * m_alpha / 255));
+        }
+        blend(target, *m_buffer);
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return m_keys.size() * sizeof(KeyInfo) + 3 * m_grid->size() * sizeof(RGBAColor);
+    }
+
+private:
+    struct KeyInfo
+    {
+        RenderTarget::size_type index;
+        unsigned                cell;       ///< index of grid cell under key
+    };
+
+    void loadKeys(EffectService & service)
+    {
+        const KeyGroup * keys = nullptr;
+        const auto & groupStr = service.getConfig("group");
+        if (!groupStr.empty()) {
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git != service.keyGroups().end()) { keys = &*git; }
+        }
+
+        const auto & keyDB = service.keyDB();
+        const auto bounds = keyDB.bounds();
+        const auto width = float(std::max(1, bounds.x1 - bounds.x0));
+        const auto height = float(std::max(1, bounds.y1 - bounds.y0));
+        for (const auto & key : keyDB) {
+            if (key.position.x0 == key.position.x1 && key.position.y0 == key.position.y1) { continue; }
+            if (keys && !keys->contains(key)) { continue; }
+            const auto center = keyDB.center(key);
+            const auto column = std::min(unsigned(float(center.x - bounds.x0) / width * float(m_columns)),
+                                         m_columns - 1);
+            const auto row = std::min(unsigned(float(center.y - bounds.y0) / height * float(m_rows)),
+                                      m_rows - 1);
+            m_keys.push_back({ key.index, row * m_columns + column });
+        }
+    }
+
+    /// Capture thread: grabs, downsamples and publishes at configured rate
+    void run()
+    {
+        std::unique_ptr<ScreenCapture> capture;
+        try {
+            capture.reset(new ScreenCapture(m_display));
+        } catch (std::exception & error) {
+            m_error = error.what();             // reported by render thread
+            m_failed = true;
+            return;
+        }
+
+        std::vector<std::uint32_t> sums;
+        const auto period = std::chrono::microseconds(1000000 / m_rate);
+        auto next = std::chrono::steady_clock::now();
+
+        while (m_thread.running()) {
+            try {
+                downsample(capture->capture(), m_columns, m_rows, sums, m_grid->back());
+            } catch (std::exception &) {
+                break;                          // screen went away, keep last colors
+            }
+            m_grid->publish();
+
+            next += period;
+            const auto now = std::chrono::steady_clock::now();
+            if (next < now) { next = now; }     // do not try to catch up after stalls
+            m_thread.sleepUntil(next);
+        }
+    }
+
+private:
+    EffectService &         m_service;
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    const std::string       m_display;      ///< X display name, empty for default
+    unsigned                m_columns;      ///< width of sampling grid
+    unsigned                m_rows;         ///< height of sampling grid
+    unsigned                m_rate;         ///< captures per second
+    unsigned                m_alpha;        ///< opacity of rendered colors, 0 to 255
+
+    std::vector<KeyInfo>    m_keys;         ///< keys that display a grid cell
+    std::unique_ptr<keyleds::TripleBuffer<RGBAColor>> m_grid; ///< latest grid from capture thread
+
+    std::string             m_error;        ///< why capture thread could not start
+    std::atomic<bool>       m_failed;       ///< m_error is set and not yet logged
+    keyleds::OnDemandThread m_thread;       ///< capture thread, runs while rendered
+};
+
+KEYLEDSD_SIMPLE_EFFECT("ambient", AmbientEffect);
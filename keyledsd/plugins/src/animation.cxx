@@ -0,0 +1,213 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "keyledsd/AnimationFile.h"
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/utils.h"
+
+using namespace plugin::animation;
+
+/****************************************************************************/
+
+/** Read-only memory mapping of a whole file */
+class MappedFile final
+{
+public:
+    explicit MappedFile(const std::string & path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno)); }
+
+        struct stat info;
+        if (::fstat(fd, &info) < 0 || info.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot map empty or unreadable file " + path);
+        }
+        m_size = std::size_t(info.st_size);
+        m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m_data == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+        }
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    ~MappedFile() { ::munmap(m_data, m_size); }
+
+    const char *    data() const { return static_cast<const char *>(m_data); }
+    std::size_t     size() const { return m_size; }
+
+private:
+    void *          m_data;
+    std::size_t     m_size;
+};
+
+/****************************************************************************/
+
+/** Animation playback effect
+ *
+ * Plays a pre-rendered animation, mapped from disk. The whole file is
+ * validated once when loading. After that, playing a frame only applies its
+ * deltas, sparse writes straight into the render buffer.
+ */
+class AnimationEffect final : public plugin::Effect
+{
+    static constexpr std::uint32_t noKey = ~std::uint32_t(0);
+public:
+    AnimationEffect(EffectService & service)
+     : m_buffer(service.createRenderTarget()),
+       m_frame(0),
+       m_time(0)
+    {
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+
+        const auto & name = service.getConfig("file");
+        auto path = service.findFile("animations/" + name);
+        if (name.empty() || path.empty()) {
+            service.log(2, ("animation file not found: " + name).c_str());
+            return;
+        }
+        try {
+            m_file.reset(new MappedFile(path));
+            load(service.keyDB());
+        } catch (std::exception & err) {
+            service.log(2, err.what());
+            m_file.reset();
+            return;
+        }
+        applyKeyFrame();
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        if (m_file) {
+            // Apply every frame we went through, deltas are relative to previous frame
+            m_time += ms;
+            auto frames = m_time / m_header->frameDuration;
+            m_time %= m_header->frameDuration;
+            frames %= m_header->nbFrames;   // whole loops leave display unchanged
+            for (; frames > 0; --frames) {
+                m_frame = (m_frame + 1) % m_header->nbFrames;
+                if (m_frame == 0) { applyKeyFrame(); } else { applyDelta(m_frame); }
+            }
+        }
+        blend(target, *m_buffer);
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return m_keyMap.size() * sizeof(m_keyMap[0]) + m_frames.size() * sizeof(m_frames[0]);
+    }
+
+private:
+    /// Validates file structure and maps file keys onto device keys
+    void load(const KeyDatabase & keyDB)
+    {
+        auto fail = [](const char * what) { throw std::runtime_error(std::string("animation: ") + what); };
+        const auto size = m_file->size();
+        const auto * data = m_file->data();
+
+        if (size < sizeof(FileHeader)) { fail("file too small"); }
+        m_header = reinterpret_cast<const FileHeader *>(data);
+        if (std::memcmp(m_header->magic, fileMagic, sizeof(fileMagic)) != 0) { fail("bad magic"); }
+        if (m_header->version != fileVersion) { fail("unsupported version"); }
+        if (m_header->byteOrder != fileByteOrder) { fail("wrong byte order"); }
+        if (m_header->nbFrames == 0 || m_header->frameDuration == 0) { fail("empty animation"); }
+
+        const std::uint64_t tablesEnd = sizeof(FileHeader)
+                                      + 4 * (std::uint64_t(m_header->nbKeys) + m_header->nbFrames);
+        if (tablesEnd > size ||
+            std::uint64_t(m_header->stringsOffset) + m_header->stringsSize > size ||
+            m_header->stringsSize == 0 || data[m_header->stringsOffset + m_header->stringsSize - 1] != '\0') {
+            fail("truncated file");
+        }
+        const auto * nameOffsets = reinterpret_cast<const std::uint32_t *>(data + sizeof(FileHeader));
+        const auto * frameOffsets = nameOffsets + m_header->nbKeys;
+
+        // Key names
+        m_keyMap.resize(m_header->nbKeys);
+        const char * strings = data + m_header->stringsOffset;
+        for (std::uint32_t idx = 0; idx < m_header->nbKeys; ++idx) {
+            if (nameOffsets[idx] >= m_header->stringsSize) { fail("bad key name"); }
+            auto it = keyDB.findName(strings + nameOffsets[idx],
+                                     std::strlen(strings + nameOffsets[idx]));
+            m_keyMap[idx] = it == keyDB.end() ? noKey : std::uint32_t(it->index);
+        }
+
+        // Frames
+        m_frames.resize(m_header->nbFrames);
+        for (std::uint32_t idx = 0; idx < m_header->nbFrames; ++idx) {
+            const auto offset = frameOffsets[idx];
+            if (offset % 4 != 0 || offset > size) { fail("bad frame offset"); }
+            m_frames[idx] = data + offset;
+            if (idx == 0) {
+                if (4 * std::uint64_t(m_header->nbKeys) > size - offset) { fail("truncated frame"); }
+                continue;
+            }
+
+            if (size - offset < 4) { fail("truncated frame"); }
+            const auto count = *reinterpret_cast<const std::uint32_t *>(data + offset);
+            if (sizeof(FileDelta) * std::uint64_t(count) > size - offset - 4) { fail("truncated frame"); }
+            const auto * entries = reinterpret_cast<const FileDelta *>(data + offset + 4);
+            if (std::any_of(entries, entries + count,
+                            [this](const auto & entry) { return entry.key >= m_header->nbKeys; })) {
+                fail("bad key in delta frame");
+            }
+        }
+    }
+
+    void applyKeyFrame()
+    {
+        const auto * colors = reinterpret_cast<const RGBAColor *>(m_frames[0]);
+        for (std::size_t idx = 0; idx < m_keyMap.size(); ++idx) {
+            if (m_keyMap[idx] != noKey) { (*m_buffer)[m_keyMap[idx]] = colors[idx]; }
+        }
+    }
+
+    void applyDelta(std::uint32_t frame)
+    {
+        const auto count = *reinterpret_cast<const std::uint32_t *>(m_frames[frame]);
+        const auto * entries = reinterpret_cast<const FileDelta *>(m_frames[frame] + 4);
+        for (std::uint32_t idx = 0; idx < count; ++idx) {
+            const auto key = m_keyMap[entries[idx].key];
+            if (key != noKey) { std::memcpy(&(*m_buffer)[key], entries[idx].color, 4); }
+        }
+    }
+
+private:
+    RenderTarget *              m_buffer;       ///< this plugin's rendered state
+    std::unique_ptr<MappedFile> m_file;         ///< animation data, null if loading failed
+    const FileHeader *          m_header = nullptr;
+    std::vector<std::uint32_t>  m_keyMap;       ///< render target index for each file key, or noKey
+    std::vector<const char *>   m_frames;       ///< start of each frame's data in m_file
+
+    std::uint32_t               m_frame;        ///< index of frame currently displayed
+    unsigned long               m_time;         ///< time spent on current frame, in milliseconds
+};
+
+KEYLEDSD_SIMPLE_EFFECT("animation", AnimationEffect);
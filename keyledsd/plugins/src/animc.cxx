@@ -0,0 +1,223 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** Animation compiler
+ *
+ * Turns a text description of an animation into a file the animation effect
+ * can map and play directly, see keyledsd/AnimationFile.h for that format.
+ * Input is line-based, everything following a '#' is a comment:
+ *
+ *     duration 50              # milliseconds per frame, once before any frame
+ *     keys ESC F1 F2 F3        # key names, can be repeated to append keys
+ *     frame red black black -  # one color per key, in keys order
+ *     frame - red black -
+ *
+ * Colors are anything the configuration accepts, names or hexadecimal
+ * rrggbb / rrggbbaa values. A '-' keeps the key's color from the previous
+ * frame; in the first frame, it leaves the key transparent. Only changes
+ * are stored for frames after the first one. The animation loops.
+ *
+ * Usage: keyledsd-animc <output.kla> <input>
+ */
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "keyledsd/AnimationFile.h"
+#include "keyledsd/colors.h"
+#include "keyledsd/utils.h"
+
+using keyleds::RGBAColor;
+using namespace plugin::animation;
+
+/****************************************************************************/
+
+namespace {
+
+class ParseError : public std::runtime_error
+{
+public:
+                ParseError(const std::string & what, int line)
+                 : std::runtime_error(what), m_line(line) {}
+
+    int         line() const noexcept { return m_line; }
+private:
+    int         m_line; ///< Line of the parsing error in input
+};
+
+struct Animation
+{
+    unsigned                            duration = 0;   ///< milliseconds per frame
+    std::vector<std::string>            keys;           ///< key names, in file order
+    std::vector<std::vector<RGBAColor>> frames;         ///< full colors of each frame
+};
+
+} // namespace
+
+/****************************************************************************/
+
+static Animation parseAnimation(std::istream & input)
+{
+    Animation result;
+    std::string line;
+    for (int lineNo = 1; std::getline(input, line); ++lineNo) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string command;
+        if (!(words >> command)) { continue; }
+
+        if (command == "duration") {
+            std::string value;
+            if (!(words >> value) || !keyleds::parseNumber(value, &result.duration)
+                || result.duration == 0) {
+                throw ParseError("invalid frame duration", lineNo);
+            }
+        } else if (command == "keys") {
+            if (!result.frames.empty()) { throw ParseError("keys must come before frames", lineNo); }
+            std::string name;
+            while (words >> name) {
+                std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+                result.keys.push_back(name);
+            }
+        } else if (command == "frame") {
+            std::vector<RGBAColor> colors = result.frames.empty()
+                ? std::vector<RGBAColor>(result.keys.size(), RGBAColor(0, 0, 0, 0))
+                : result.frames.back();
+            std::size_t idx = 0;
+            std::string value;
+            for (; words >> value; ++idx) {
+                if (idx >= colors.size()) { throw ParseError("more colors than keys", lineNo); }
+                if (value != "-" && !RGBAColor::parse(value, &colors[idx])) {
+                    throw ParseError("invalid color '" + value + "'", lineNo);
+                }
+            }
+            if (idx < colors.size()) { throw ParseError("fewer colors than keys", lineNo); }
+            result.frames.push_back(std::move(colors));
+        } else {
+            throw ParseError("unknown command '" + command + "'", lineNo);
+        }
+    }
+
+    if (result.duration == 0) { throw ParseError("no frame duration given", 1); }
+    if (result.frames.empty()) { throw ParseError("no frames given", 1); }
+    return result;
+}
+
+/****************************************************************************/
+
+template <typename T> static void append(std::vector<char> & out, const T & value)
+{
+    const auto * bytes = reinterpret_cast<const char *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+static void writeAnimation(std::ostream & out, const Animation & animation)
+{
+    const auto nbKeys = std::uint32_t(animation.keys.size());
+    const auto nbFrames = std::uint32_t(animation.frames.size());
+
+    // Frames, key frame first then deltas against previous frame
+    std::vector<char> frames;
+    std::vector<std::uint32_t> frameOffsets;
+    const auto framesStart = sizeof(FileHeader) + 4 * (std::size_t(nbKeys) + nbFrames);
+    for (std::uint32_t frame = 0; frame < nbFrames; ++frame) {
+        frameOffsets.push_back(std::uint32_t(framesStart + frames.size()));
+        const auto & colors = animation.frames[frame];
+        if (frame == 0) {
+            for (const auto & color : colors) { append(frames, color); }
+            continue;
+        }
+        std::vector<FileDelta> deltas;
+        for (std::uint32_t key = 0; key < nbKeys; ++key) {
+            if (colors[key] == animation.frames[frame - 1][key]) { continue; }
+            deltas.push_back({ key, { colors[key].red, colors[key].green,
+                                      colors[key].blue, colors[key].alpha } });
+        }
+        append(frames, std::uint32_t(deltas.size()));
+        for (const auto & delta : deltas) { append(frames, delta); }
+    }
+
+    // String table, the empty string first so stringsSize is never zero
+    std::vector<char> strings(1, '\0');
+    std::vector<std::uint32_t> nameOffsets;
+    for (const auto & name : animation.keys) {
+        nameOffsets.push_back(std::uint32_t(strings.size()));
+        strings.insert(strings.end(), name.c_str(), name.c_str() + name.size() + 1);
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, fileMagic, sizeof(header.magic));
+    header.version = fileVersion;
+    header.byteOrder = fileByteOrder;
+    header.nbKeys = nbKeys;
+    header.nbFrames = nbFrames;
+    header.frameDuration = animation.duration;
+    header.stringsOffset = std::uint32_t(framesStart + frames.size());
+    header.stringsSize = std::uint32_t(strings.size());
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(nameOffsets.data()), nameOffsets.size() * 4);
+    out.write(reinterpret_cast<const char *>(frameOffsets.data()), frameOffsets.size() * 4);
+    out.write(frames.data(), frames.size());
+    out.write(strings.data(), strings.size());
+}
+
+/****************************************************************************/
+
+int main(int argc, char * argv[])
+{
+    if (argc != 3) {
+        std::cerr <<"Usage: " <<argv[0] <<" <output.kla> <input>\n"
+                    "Input lines, '#' starts a comment:\n"
+                    "    duration <ms>              frame duration, required\n"
+                    "    keys <name>...             keys the animation drives, in order\n"
+                    "    frame <color|->...         one color per key, - keeps previous color\n";
+        return 1;
+    }
+    const std::string output = argv[1];
+
+    Animation animation;
+    std::ifstream input(argv[2]);
+    if (!input) {
+        std::cerr <<argv[2] <<": cannot open file" <<std::endl;
+        return 1;
+    }
+    try {
+        animation = parseAnimation(input);
+    } catch (ParseError & error) {
+        std::cerr <<argv[2] <<':' <<error.line() <<": " <<error.what() <<std::endl;
+        return 1;
+    }
+
+    try {
+        std::ofstream file(output, std::ios::binary | std::ios::trunc);
+        writeAnimation(file, animation);
+        file.close();
+        if (!file) { throw std::runtime_error("write failed"); }
+    } catch (std::exception & error) {
+        std::cerr <<output <<": " <<error.what() <<std::endl;
+        std::remove(output.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+#include "keyledsd/Gradient.h"
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/utils.h"
+
+using keyleds::Gradient;
+
+static constexpr unsigned maxStepsPerFrame = 4;     ///< when lagging, skip steps beyond this
+static constexpr unsigned rampSize = 256;           ///< number of entries in color ramp
+
+/****************************************************************************/
+
+/** Cellular automaton effect
+ *
+ * Runs a simulation over the key adjacency graph of the device, at a fixed
+ * step rate. State is one float per key, double-buffered: each step reads
+ * the current state and writes the next one, then they are swapped.
+ *
+ * Supported modes:
+ *  - heat: key presses inject heat, which diffuses to neighbouring keys and
+ *    slowly cools down.
+ *  - life: Conway's game of life, with neighbours as defined by the graph.
+ *    Key presses bring cells to life, and the board is reseeded when life
+ *    dies out. Dead cells fade out over a few steps.
+ */
+class AutomatonEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+    enum class Mode { Heat, Life };
+public:
+    AutomatonEffect(EffectService & service)
+     : m_adjacency(service.keyDB().adjacency()),
+       m_buffer(service.createRenderTarget()),
+       m_mode(service.getConfig("mode") == "life" ? Mode::Life : Mode::Heat),
+       m_step(50),
+       m_time(0),
+       m_diffusion(50),
+       m_cooling(5),
+       m_density(30)
+    {
+        keyleds::parseNumber(service.getConfig("step"), &m_step);
+        keyleds::parseNumber(service.getConfig("diffusion"), &m_diffusion);
+        keyleds::parseNumber(service.getConfig("cooling"), &m_cooling);
+        keyleds::parseNumber(service.getConfig("density"), &m_density);
+        if (m_step == 0) { m_step = 1; }
+        m_diffusion = std::min(m_diffusion, 100u);
+        m_cooling = std::min(m_cooling, 100u);
+
+        std::vector<RGBAColor> colors;
+        for (const auto & item : service.configuration()) {
+            RGBAColor color;
+            if (item.first.rfind("color", 0) == 0 && RGBAColor::parse(item.second, &color)) {
+                colors.push_back(color);
+            }
+        }
+        if (colors.empty()) {
+            colors = { RGBAColor(255, 0, 0, 0), RGBAColor(255, 160, 0, 255),
+                       RGBAColor(255, 255, 224, 255) };
+        }
+        m_ramp = Gradient::ramp(colors, rampSize);
+
+        const KeyGroup * keys = nullptr;
+        const auto & groupStr = service.getConfig("group");
+        if (!groupStr.empty()) {
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git != service.keyGroups().end()) { keys = &*git; }
+        }
+
+        const auto nbKeys = m_adjacency.offsets.size() - 1;
+        m_enabled.assign(nbKeys, false);
+        for (const auto & key : service.keyDB()) {
+            m_enabled[key.index] = !keys || keys->contains(key);
+        }
+        m_state.assign(nbKeys, 0.0f);
+        m_next.assign(nbKeys, 0.0f);
+        if (m_mode == Mode::Life) {
+            m_alive.assign(nbKeys, 0);
+            m_nextAlive.assign(nbKeys, 0);
+            seed();
+        }
+
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        m_time += ms;
+        unsigned steps = 0;
+        while (m_time >= m_step) {
+            m_time -= m_step;
+            if (steps < maxStepsPerFrame) {
+                if (m_mode == Mode::Heat) { stepHeat(); } else { stepLife(); }
+                ++steps;
+            }
+        }
+
+        for (std::size_t idx = 0; idx < m_state.size(); ++idx) {
+            if (!m_enabled[idx]) { continue; }
+            const auto value = std::min(1.0f, std::max(0.0f, m_state[idx]));
+            (*m_buffer)[idx] = m_ramp[unsigned(value * float(rampSize - 1) + 0.5f)];
+        }
+        blend(target, *m_buffer);
+    }
+
+    void handleKeyEvent(const KeyDatabase::Key & key, bool press) override
+    {
+        if (!press || !m_enabled[key.index]) { return; }
+        m_state[key.index] = 1.0f;
+        if (m_mode == Mode::Life) { m_alive[key.index] = 1; }
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return (m_state.size() + m_next.size()) * sizeof(float)
+             + m_alive.size() + m_nextAlive.size() + m_ramp.size() * sizeof(RGBAColor);
+    }
+
+private:
+    void stepHeat()
+    {
+        const auto diffusion = float(m_diffusion) / 100.0f;
+        const auto retention = 1.0f - float(m_cooling) / 100.0f;
+        const auto * offsets = m_adjacency.offsets.data();
+        const auto * indices = m_adjacency.indices.data();
+
+        for (std::size_t idx = 0; idx < m_state.size(); ++idx) {
+            const auto first = offsets[idx], last = offsets[idx + 1];
+            float sum = 0.0f;
+            for (auto edge = first; edge < last; ++edge) { sum += m_state[indices[edge]]; }
+            const auto mean = first == last ? m_state[idx] : sum / float(last - first);
+            m_next[idx] = retention * (m_state[idx] + diffusion * (mean - m_state[idx]));
+        }
+        std::swap(m_state, m_next);
+    }
+
+    void stepLife()
+    {
+        const auto * offsets = m_adjacency.offsets.data();
+        const auto * indices = m_adjacency.indices.data();
+        unsigned population = 0;
+
+        for (std::size_t idx = 0; idx < m_state.size(); ++idx) {
+            unsigned count = 0;
+            for (auto edge = offsets[idx]; edge < offsets[idx + 1]; ++edge) {
+                count += m_alive[indices[edge]];
+            }
+            const bool alive = m_enabled[idx] && (count == 3 || (m_alive[idx] && count == 2));
+            m_nextAlive[idx] = alive ? 1 : 0;
+            m_next[idx] = alive ? 1.0f : m_state[idx] * 0.5f;
+            population += m_nextAlive[idx];
+        }
+        std::swap(m_alive, m_nextAlive);
+        std::swap(m_state, m_next);
+        if (population == 0) { seed(); }
+    }
+
+    void seed()
+    {
+        auto dist = std::uniform_int_distribution<unsigned>(0, 99);
+        for (std::size_t idx = 0; idx < m_alive.size(); ++idx) {
+            m_alive[idx] = m_enabled[idx] && dist(m_random) < m_density ? 1 : 0;
+            if (m_alive[idx]) { m_state[idx] = 1.0f; }
+        }
+    }
+
+private:
+    const KeyDatabase::Adjacency & m_adjacency; ///< neighbour graph from key database
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    const Mode              m_mode;         ///< what simulation to run
+    std::minstd_rand        m_random;       ///< seeds life mode
+
+    unsigned                m_step;         ///< simulation step duration, in milliseconds
+    unsigned                m_time;         ///< time since last step, in milliseconds
+    unsigned                m_diffusion;    ///< heat mode: share of heat exchanged per step, in percent
+    unsigned                m_cooling;      ///< heat mode: heat lost per step, in percent
+    unsigned                m_density;      ///< life mode: share of cells alive on seeding, in percent
+
+    std::vector<RGBAColor>  m_ramp;         ///< maps state from 0 to 1 onto colors
+    std::vector<bool>       m_enabled;      ///< whether each key takes part in the simulation
+    std::vector<float>      m_state;        ///< current per-key state, from 0 to 1
+    std::vector<float>      m_next;         ///< next per-key state, being computed
+    std::vector<unsigned char> m_alive;     ///< life mode: current cell liveness
+    std::vector<unsigned char> m_nextAlive; ///< life mode: next cell liveness
+};
+
+KEYLEDSD_SIMPLE_EFFECT("automaton", AutomatonEffect);
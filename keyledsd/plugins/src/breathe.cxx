@@ -16,9 +16,12 @@
  */
 #include <algorithm>
 #include <cmath>
+#include "keyledsd/Gradient.h"
 #include "keyledsd/PluginHelper.h"
 #include "keyledsd/utils.h"
 
+using keyleds::Gradient;
+
 static constexpr float pi = 3.14159265358979f;
 
 /****************************************************************************/
@@ -29,25 +32,30 @@ class BreateEffect final : public plugin::Effect
 public:
     BreateEffect(EffectService & service)
      : m_buffer(service.createRenderTarget()),
-       m_keys(nullptr),
+       m_gradient(m_buffer->size()),
        m_time(0), m_period(10000)
     {
         auto color = RGBAColor(255, 255, 255, 255);
         RGBAColor::parse(service.getConfig("color"), &color);
-        m_alpha = color.alpha;
-        color.alpha = 0;
+        m_gradient.setTable(generateColorTable(color));
 
+        const KeyGroup * keys = nullptr;
         const auto & groupStr = service.getConfig("group");
         if (!groupStr.empty()) {
             auto git = std::find_if(
                 service.keyGroups().begin(), service.keyGroups().end(),
                 [groupStr](const auto & group) { return group.name() == groupStr; });
-            if (git != service.keyGroups().end()) { m_keys = &*git; }
+            if (git != service.keyGroups().end()) { keys = &*git; }
         }
 
-        keyleds::parseNumber(service.getConfig("period"), &m_period);
+        // All keys breathe in sync, so they all have the same phase
+        if (keys) {
+            for (const auto & key : *keys) { m_gradient.setPhase(key.index, 0); }
+        } else {
+            for (const auto & key : service.keyDB()) { m_gradient.setPhase(key.index, 0); }
+        }
 
-        std::fill(m_buffer->begin(), m_buffer->end(), color);
+        keyleds::parseNumber(service.getConfig("period"), &m_period);
     }
 
     void render(unsigned long ms, RenderTarget & target) override
@@ -55,22 +63,27 @@ public:
         m_time += ms;
         if (m_time >= m_period) { m_time -= m_period; }
 
-        float t = float(m_time) / float(m_period);
-        float alphaf = -std::cos(2.0f * pi * t);
-        uint8_t alpha = m_alpha * (unsigned(128.0f * alphaf) + 128) / 256;
+        m_gradient.render(Gradient::phase_type(Gradient::resolution * m_time / m_period), *m_buffer);
+        blend(target, *m_buffer);
+    }
 
-        if (m_keys) {
-            for (const auto & key : *m_keys) { (*m_buffer)[key.index].alpha = alpha; }
-        } else {
-            for (auto & key : *m_buffer) { key.alpha = alpha; }
+private:
+    /// Samples a full breathing cycle, alpha following a cosine up to color's alpha
+    static Gradient::color_table generateColorTable(RGBAColor color)
+    {
+        Gradient::color_table table(Gradient::resolution);
+        for (Gradient::phase_type idx = 0; idx < Gradient::resolution; ++idx) {
+            float t = float(idx) / float(Gradient::resolution);
+            float alphaf = -std::cos(2.0f * pi * t);
+            table[idx] = RGBAColor(color.red, color.green, color.blue,
+                                   color.alpha * unsigned(int(128.0f * alphaf) + 128) / 256);
         }
-        blend(target, *m_buffer);
+        return table;
     }
 
 private:
     RenderTarget *  m_buffer;       ///< this plugin's rendered state
-    const KeyGroup* m_keys;         ///< what keys the effect applies to. Empty for whole keyboard.
-    uint8_t         m_alpha;        ///< peak alpha value through the breathing cycle
+    Gradient        m_gradient;     ///< breathing cycle samples, keys outside group disabled
 
     unsigned        m_time;         ///< time in milliseconds since beginning of current cycle
     unsigned        m_period;       ///< total duration of a cycle in milliseconds
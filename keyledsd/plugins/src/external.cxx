@@ -0,0 +1,318 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/utils.h"
+
+static constexpr int pollTimeout = 100;     ///< ms, bounds how long stopping takes
+
+/****************************************************************************/
+// Shared memory format
+//
+// The effect creates a sealed memfd and hands it to any process connecting
+// to its unix socket, as SCM_RIGHTS ancillary data along with the mapping
+// size (uint64). The mapping holds, in native byte order:
+//  - a SharedHeader.
+//  - nbKeys NUL-terminated key names at namesOffset, in frame order.
+//  - nbFrames frames at framesOffset, frameStride bytes apart, each holding
+//    one R8G8B8A8 color per key, blended over whatever effects come before.
+//
+// Producers write frame number n into slot n % nbFrames, following this
+// sequence: store 2n - 1 into sequences[slot] then issue a release fence,
+// write colors, store 2n into sequences[slot], then store n into latest,
+// the last two stores having release semantics. Frame numbers start at 1 and
+// wrap around. The effect never writes to the mapping after creating it.
+// Every client can write the whole mapping, so the effect only reads latest
+// and sequences back from the header, using its own copy of the layout.
+//
+// Each render, the effect copies the latest frame out of the mapping, then
+// reads its sequence again. If the sequence was odd or changed in between,
+// the producer lapped the ring while the copy was made: the copy is torn and
+// is dropped, the previous complete frame being blended again instead. The
+// effect never waits for the producer.
+
+static constexpr char sharedMagic[4] = { 'K', 'L', 'F', 'B' };
+static constexpr std::uint16_t sharedVersion = 1;
+static constexpr std::uint16_t sharedByteOrder = 0x0102;
+static constexpr unsigned ringSize = 4;           ///< frames in shared ring
+static constexpr std::size_t frameAlign = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory requires lock-free atomics");
+
+struct SharedHeader
+{
+    char                        magic[4];
+    std::uint16_t               version;
+    std::uint16_t               byteOrder;
+    std::uint32_t               nbKeys;
+    std::uint32_t               nbFrames;
+    std::uint32_t               frameStride;    ///< bytes between frames
+    std::uint32_t               framesOffset;   ///< from start of mapping
+    std::uint32_t               namesOffset;    ///< from start of mapping
+    std::uint32_t               namesSize;
+    std::atomic<std::uint32_t>  latest;         ///< number of last complete frame
+    std::atomic<std::uint32_t>  sequences[ringSize];    ///< per slot, odd while written
+};
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == 4, "unexpected atomic size");
+static_assert(sizeof(SharedHeader) == 36 + 4 * ringSize, "unexpected padding in SharedHeader");
+
+/// Returns the given value, aligned to upper bound of given aligment
+static std::size_t align(std::size_t value, std::size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/****************************************************************************/
+
+/** External frame source effect
+ *
+ * Lets other processes drive keys directly through shared memory, at frame
+ * rate. Rendering copies one frame out of the mapping and validates it
+ * against its sequence number, with no system call. A helper thread serves
+ * the socket that hands out the memory.
+ */
+class ExternalEffect final : public plugin::Effect
+{
+public:
+    ExternalEffect(EffectService & service)
+     : m_memfd(-1),
+       m_socket(-1),
+       m_frame(RenderTarget::size_type(service.keyDB().size())),
+       m_copy(RenderTarget::size_type(service.keyDB().size())),
+       m_stop(false)
+    {
+        std::fill(m_frame.data(), m_frame.data() + m_frame.capacity(), RGBAColor(0, 0, 0, 0));
+
+        m_path = service.getConfig("socket");
+        if (m_path.empty()) {
+            const char * runtime = std::getenv("XDG_RUNTIME_DIR");
+            m_path = std::string(runtime != nullptr && runtime[0] != '\0' ? runtime : "/tmp")
+                   + "/keyleds-" + service.deviceSerial() + ".sock";
+        }
+
+        try {
+            createMemory(service.keyDB());
+            createSocket();
+        } catch (std::exception & error) {
+            service.log(2, error.what());
+            return;
+        }
+        m_thread = std::thread(&ExternalEffect::run, this);
+    }
+
+    ~ExternalEffect()
+    {
+        m_stop = true;
+        if (m_thread.joinable()) { m_thread.join(); }
+        if (m_socket >= 0) {
+            ::close(m_socket);
+            // Only remove the socket if it still is ours
+            struct stat info;
+            if (::lstat(m_path.c_str(), &info) == 0
+                && info.st_dev == m_socketDevice && info.st_ino == m_socketInode) {
+                ::unlink(m_path.c_str());
+            }
+        }
+        if (m_header != nullptr) { ::munmap(m_header, m_size); }
+        if (m_memfd >= 0) { ::close(m_memfd); }
+    }
+
+    void render(unsigned long, RenderTarget & target) override
+    {
+        if (m_header == nullptr) { return; }
+        const auto frame = m_header->latest.load(std::memory_order_acquire);
+        const auto slot = frame % ringSize;
+        const auto sequence = m_header->sequences[slot].load(std::memory_order_acquire);
+        if (sequence == 2 * frame) {
+            std::memcpy(m_copy.data(),
+                        reinterpret_cast<const char *>(m_header) + m_framesOffset
+                        + slot * m_frameStride,
+                        m_copy.capacity() * sizeof(RGBAColor));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_header->sequences[slot].load(std::memory_order_relaxed) == sequence) {
+                using std::swap;
+                swap(m_frame, m_copy);
+            }
+        }
+        blend(target, m_frame);
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return m_size + (m_frame.capacity() + m_copy.capacity()) * sizeof(RGBAColor);
+    }
+
+private:
+    void createMemory(const KeyDatabase & keyDB)
+    {
+        const auto nbKeys = keyDB.size();
+        std::size_t namesSize = 0;
+        for (const auto & key : keyDB) { namesSize += key.name.size() + 1; }
+        const auto namesOffset = align(sizeof(SharedHeader), frameAlign);
+        const auto framesOffset = align(namesOffset + namesSize, frameAlign);
+        const auto frameStride = align(RenderTarget::capacityFor(RenderTarget::size_type(nbKeys))
+                                       * sizeof(RGBAColor), frameAlign);
+        m_size = framesOffset + ringSize * frameStride;
+        m_framesOffset = framesOffset;
+        m_frameStride = frameStride;
+
+        m_memfd = ::memfd_create("keyleds-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (m_memfd < 0) { throw std::runtime_error(std::string("memfd_create: ") + std::strerror(errno)); }
+        if (::ftruncate(m_memfd, off_t(m_size)) < 0
+            || ::fcntl(m_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+            throw std::runtime_error(std::string("cannot setup shared memory: ") + std::strerror(errno));
+        }
+        void * data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+        if (data == MAP_FAILED) { throw std::runtime_error(std::string("mmap: ") + std::strerror(errno)); }
+
+        // Mapping starts zeroed: all frames are transparent and frame 0 is complete
+        m_header = static_cast<SharedHeader *>(data);
+        std::memcpy(m_header->magic, sharedMagic, sizeof(sharedMagic));
+        m_header->version = sharedVersion;
+        m_header->byteOrder = sharedByteOrder;
+        m_header->nbKeys = std::uint32_t(nbKeys);
+        m_header->nbFrames = ringSize;
+        m_header->frameStride = std::uint32_t(frameStride);
+        m_header->framesOffset = std::uint32_t(framesOffset);
+        m_header->namesOffset = std::uint32_t(namesOffset);
+        m_header->namesSize = std::uint32_t(namesSize);
+
+        auto * names = static_cast<char *>(data) + namesOffset;
+        for (const auto & key : keyDB) {
+            std::memcpy(names, key.name.c_str(), key.name.size() + 1);
+            names += key.name.size() + 1;
+        }
+    }
+
+    void createSocket()
+    {
+        struct sockaddr_un address;
+        address.sun_family = AF_UNIX;
+        if (m_path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("socket path too long: " + m_path);
+        }
+        std::strcpy(address.sun_path, m_path.c_str());
+
+        m_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_socket < 0) { throw std::runtime_error(std::string("socket: ") + std::strerror(errno)); }
+
+        try {
+            removeStaleSocket(address);
+            struct stat info;
+            if (::bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0
+                || ::listen(m_socket, 4) < 0
+                || ::lstat(m_path.c_str(), &info) < 0) {
+                throw std::runtime_error(std::string("cannot listen on ") + m_path
+                                         + ": " + std::strerror(errno));
+            }
+            m_socketDevice = info.st_dev;
+            m_socketInode = info.st_ino;
+        } catch (...) {
+            ::close(m_socket);
+            m_socket = -1;
+            throw;
+        }
+    }
+
+    /// Removes socket left over by a previous run at our path. Anything that
+    /// is not a socket, or a socket something still listens on, is left alone.
+    void removeStaleSocket(const struct sockaddr_un & address) const
+    {
+        struct stat info;
+        if (::lstat(m_path.c_str(), &info) < 0) { return; }
+        if (!S_ISSOCK(info.st_mode)) {
+            throw std::runtime_error(m_path + " exists and is not a socket");
+        }
+
+        int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe < 0) { throw std::runtime_error(std::string("socket: ") + std::strerror(errno)); }
+        const bool live = ::connect(probe, reinterpret_cast<const struct sockaddr *>(&address),
+                                    sizeof(address)) == 0 || errno != ECONNREFUSED;
+        ::close(probe);
+        if (live) {
+            throw std::runtime_error(m_path + " is in use, set a distinct socket path"
+                                     " for each external effect of a device");
+        }
+        ::unlink(m_path.c_str());
+    }
+
+    /// Socket thread: hands memfd to each connecting client
+    void run()
+    {
+        const std::uint64_t size = m_size;
+        while (!m_stop) {
+            struct pollfd pfd = { m_socket, POLLIN, 0 };
+            if (::poll(&pfd, 1, pollTimeout) <= 0) { continue; }
+            int client = ::accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) { continue; }
+
+            struct iovec iov = { const_cast<std::uint64_t *>(&size), sizeof(size) };
+            union {
+                struct cmsghdr  header;
+                char            buffer[CMSG_SPACE(sizeof(int))];
+            } control;
+            std::memset(&control, 0, sizeof(control));
+            struct msghdr message = {};
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control.buffer;
+            message.msg_controllen = sizeof(control.buffer);
+            auto * cmsg = CMSG_FIRSTHDR(&message);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &m_memfd, sizeof(int));
+
+            ::sendmsg(client, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+            ::close(client);
+        }
+    }
+
+private:
+    std::string             m_path;         ///< socket path
+    int                     m_memfd;        ///< shared memory file
+    int                     m_socket;       ///< listening socket
+    dev_t                   m_socketDevice = 0; ///< filesystem of bound socket
+    ino_t                   m_socketInode = 0;  ///< inode of bound socket, to recognize it
+    SharedHeader *          m_header = nullptr; ///< start of shared mapping
+    std::size_t             m_size = 0;     ///< size of shared mapping in bytes
+    std::size_t             m_framesOffset = 0; ///< offset of frame ring in mapping
+    std::size_t             m_frameStride = 0;  ///< bytes between frames in mapping
+    RenderTarget            m_frame;        ///< last complete frame read from mapping
+    RenderTarget            m_copy;         ///< frame being read, until validated
+    std::atomic<bool>       m_stop;         ///< asks socket thread to exit
+    std::thread             m_thread;       ///< socket thread
+};
+
+KEYLEDSD_SIMPLE_EFFECT("external", ExternalEffect);
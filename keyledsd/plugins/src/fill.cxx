@@ -63,9 +63,9 @@ public:
             std::fill(target.begin(), target.end(), m_fill);
         }
         for (const auto & rule : m_rules) {
-            for (const auto & key : rule.keys()) {
-                target[key.index] = rule.color();
-            }
+            rule.keys().mask().forEach([&target, &rule](auto idx) {
+                target[idx] = rule.color();
+            });
         }
     }
 
@@ -0,0 +1,240 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "keyledsd/Gradient.h"
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/utils.h"
+
+using keyleds::Gradient;
+
+static constexpr unsigned rampSize = 256;           ///< number of entries in color ramp
+
+/****************************************************************************/
+// State file format
+//
+// A header followed by nbKeys floats, the heat of each key indexed by
+// Key::index, in native byte order. The file is mapped shared and rewritten
+// in place at each checkpoint, leaving write-back to the kernel.
+
+static constexpr char fileMagic[4] = { 'K', 'L', 'H', 'M' };
+static constexpr std::uint16_t fileVersion = 1;
+static constexpr std::uint16_t fileByteOrder = 0x0102;
+
+struct FileHeader
+{
+    char            magic[4];
+    std::uint16_t   version;
+    std::uint16_t   byteOrder;
+    std::uint32_t   nbKeys;
+    std::uint32_t   reserved;
+    std::int64_t    timestamp;      ///< time of last checkpoint, in seconds since epoch
+};
+
+static_assert(sizeof(FileHeader) == 24, "unexpected padding in FileHeader");
+
+/****************************************************************************/
+
+/** Typing heatmap effect
+ *
+ * Each key press adds one unit of heat to the key, and heat halves every
+ * half-life. Heat is kept in a flat array indexed by key, so handling an
+ * event is a single increment, and each frame decays and quantizes all keys
+ * in one pass before looking colors up in a precomputed ramp. State can be
+ * persisted to a file so it survives restarts.
+ */
+class HeatmapEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+public:
+    HeatmapEffect(EffectService & service)
+     : m_buffer(service.createRenderTarget()),
+       m_halfLife(300),
+       m_saturation(20),
+       m_checkpoint(10000),
+       m_sinceCheckpoint(0),
+       m_heat(RenderTarget::capacityFor(service.keyDB().size()), 0.0f),
+       m_levels(m_heat.size(), 0),
+       m_enabled(service.keyDB().size(), 0.0f)
+    {
+        keyleds::parseNumber(service.getConfig("half-life"), &m_halfLife);
+        keyleds::parseNumber(service.getConfig("saturation"), &m_saturation);
+        keyleds::parseNumber(service.getConfig("checkpoint"), &m_checkpoint);
+        if (m_halfLife == 0) { m_halfLife = 1; }
+        if (m_saturation == 0) { m_saturation = 1; }
+
+        std::vector<RGBAColor> colors;
+        for (const auto & item : service.configuration()) {
+            RGBAColor color;
+            if (item.first.rfind("color", 0) == 0 && RGBAColor::parse(item.second, &color)) {
+                colors.push_back(color);
+            }
+        }
+        if (colors.empty()) {
+            colors = { RGBAColor(0, 0, 255, 0), RGBAColor(0, 0, 255, 255),
+                       RGBAColor(255, 0, 0, 255), RGBAColor(255, 255, 0, 255) };
+        }
+        m_ramp = Gradient::ramp(colors, rampSize);
+
+        const KeyGroup * keys = nullptr;
+        const auto & groupStr = service.getConfig("group");
+        if (!groupStr.empty()) {
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git != service.keyGroups().end()) { keys = &*git; }
+        }
+        for (const auto & key : service.keyDB()) {
+            m_enabled[key.index] = keys == nullptr || keys->contains(key) ? 1.0f : 0.0f;
+        }
+
+        const auto & path = service.getConfig("file");
+        if (!path.empty() && !openState(path)) {
+            service.log(2, ("cannot use heatmap file '" + path + "': " + std::strerror(errno)).c_str());
+        }
+
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+    }
+
+    ~HeatmapEffect()
+    {
+        if (m_state != nullptr) {
+            saveState();
+            ::munmap(m_state, m_stateSize);
+        }
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        const auto factor = std::exp2(-float(ms) / (float(m_halfLife) * 1000.0f));
+        const auto scale = float(rampSize - 1) / float(m_saturation);
+        const auto top = float(rampSize - 1);
+
+        // Branch-free loop over padded arrays, so it vectorizes
+        float * heat = m_heat.data();
+        std::uint32_t * levels = m_levels.data();
+        for (std::size_t idx = 0; idx < m_heat.size(); ++idx) {
+            heat[idx] *= factor;
+            levels[idx] = std::uint32_t(std::min(heat[idx] * scale, top) + 0.5f);
+        }
+        // Keys outside the group keep the transparent color set at creation
+        for (std::size_t idx = 0; idx < m_buffer->size(); ++idx) {
+            if (m_enabled[idx] == 0.0f) { continue; }
+            (*m_buffer)[idx] = m_ramp[levels[idx]];
+        }
+        blend(target, *m_buffer);
+
+        if (m_state != nullptr && m_checkpoint > 0) {
+            m_sinceCheckpoint += ms;
+            if (m_sinceCheckpoint >= m_checkpoint) {
+                saveState();
+                m_sinceCheckpoint = 0;
+            }
+        }
+    }
+
+    void handleKeyEvent(const KeyDatabase::Key & key, bool press) override
+    {
+        if (press) { m_heat[key.index] += m_enabled[key.index]; }
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return m_heat.size() * sizeof(float) + m_levels.size() * sizeof(std::uint32_t)
+             + m_enabled.size() * sizeof(float) + m_ramp.size() * sizeof(RGBAColor);
+    }
+
+private:
+    /// Maps state file, creating it if needed, and loads heat from it
+    bool openState(const std::string & path)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) { return false; }
+
+        const auto nbKeys = m_enabled.size();
+        const auto size = sizeof(FileHeader) + nbKeys * sizeof(float);
+        struct stat info;
+        if (::fstat(fd, &info) < 0 || ::ftruncate(fd, off_t(size)) < 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return false;
+        }
+        void * data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) { return false; }
+        m_state = data;
+        m_stateSize = size;
+
+        // Reuse saved state if it matches, accounting for time spent stopped
+        const auto & header = *static_cast<const FileHeader *>(m_state);
+        if (std::size_t(info.st_size) == size
+            && std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) == 0
+            && header.version == fileVersion && header.byteOrder == fileByteOrder
+            && header.nbKeys == nbKeys) {
+            const auto elapsed = std::max(std::int64_t(std::time(nullptr)) - header.timestamp,
+                                          std::int64_t(0));
+            const auto factor = std::exp2(-float(elapsed) / float(m_halfLife));
+            const auto * saved = reinterpret_cast<const float *>(&header + 1);
+            for (std::size_t idx = 0; idx < nbKeys; ++idx) {
+                m_heat[idx] = std::isfinite(saved[idx]) ? std::max(saved[idx], 0.0f) * factor : 0.0f;
+            }
+        }
+        return true;
+    }
+
+    /// Writes current heat into the mapping, write-back is asynchronous
+    void saveState()
+    {
+        auto & header = *static_cast<FileHeader *>(m_state);
+        std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+        header.version = fileVersion;
+        header.byteOrder = fileByteOrder;
+        header.nbKeys = std::uint32_t(m_enabled.size());
+        header.reserved = 0;
+        header.timestamp = std::int64_t(std::time(nullptr));
+        std::memcpy(&header + 1, m_heat.data(), m_enabled.size() * sizeof(float));
+        ::msync(m_state, m_stateSize, MS_ASYNC);
+    }
+
+private:
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    unsigned                m_halfLife;     ///< time for heat to halve, in seconds
+    unsigned                m_saturation;   ///< heat at which top color is reached
+    unsigned                m_checkpoint;   ///< time between state saves in ms, 0 to save on exit only
+    unsigned                m_sinceCheckpoint; ///< time since last state save in ms
+
+    std::vector<RGBAColor>  m_ramp;         ///< maps quantized heat onto colors
+    std::vector<float>      m_heat;         ///< per-key heat, padded to render target capacity
+    std::vector<std::uint32_t> m_levels;    ///< per-key ramp index, computed each frame
+    std::vector<float>      m_enabled;      ///< 1 for keys that take part, 0 for others
+
+    void *                  m_state = nullptr;  ///< shared mapping of state file
+    std::size_t             m_stateSize = 0;    ///< size of state mapping in bytes
+};
+
+KEYLEDSD_SIMPLE_EFFECT("heatmap", HeatmapEffect);
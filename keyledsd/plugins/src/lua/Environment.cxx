@@ -25,6 +25,7 @@
 namespace keyleds { namespace lua {
 
 static const void * const controllerToken = &controllerToken;
+static const void * const keyDBToken = &keyDBToken;
 
 /****************************************************************************/
 // Global scope
@@ -119,10 +120,16 @@ void Environment::openKeyleds(Controller * controller)
     lua_pushlightuserdata(m_lua, static_cast<void *>(controller));
     lua_rawset(m_lua, LUA_GLOBALSINDEX);
 
+    // Save database pointer where scripts cannot reach it
+    lua_pushlightuserdata(m_lua, const_cast<void *>(keyDBToken));
+    lua_pushlightuserdata(m_lua, const_cast<KeyDatabase *>(&controller->keyDB()));
+    lua_rawset(m_lua, LUA_REGISTRYINDEX);
+
     // Register types
     registerType<Interpolator>(m_lua);
     registerType<const KeyDatabase *>(m_lua);
     registerType<const KeyDatabase::KeyGroup *>(m_lua);
+    registerType<KeyDatabase::KeyGroup>(m_lua);
     registerType<const KeyDatabase::Key *>(m_lua);
     registerType<RenderTarget *>(m_lua);
     registerType<RGBAColor>(m_lua);
@@ -149,6 +156,19 @@ Environment::Controller * Environment::controller() const
     return controller;
 }
 
+const KeyDatabase * Environment::keyDB() const
+{
+    SAVE_TOP(m_lua);
+
+    lua_pushlightuserdata(m_lua, const_cast<void *>(keyDBToken));
+    lua_rawget(m_lua, LUA_REGISTRYINDEX);
+    auto * db = static_cast<const KeyDatabase *>(lua_topointer(m_lua, -1));
+    lua_pop(m_lua, 1);
+
+    CHECK_TOP(m_lua, 0);
+    return db;
+}
+
 /****************************************************************************/
 
 } } // namespace keyleds::lua
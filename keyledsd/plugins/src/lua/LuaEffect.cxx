@@ -293,6 +293,12 @@ void LuaEffect::handleKeyEvent(const KeyDatabase::Key & key, bool press)
     CHECK_TOP(lua, 0);
 }
 
+std::size_t LuaEffect::memoryUsage() const
+{
+    auto lua = m_state.get();
+    return std::size_t(lua_gc(lua, LUA_GCCOUNT, 0)) * 1024 + std::size_t(lua_gc(lua, LUA_GCCOUNTB, 0));
+}
+
 /****************************************************************************/
 // Lua interface
 
@@ -306,6 +312,11 @@ bool LuaEffect::parseColor(const std::string & str, RGBAColor * color) const
     return RGBAColor::parse(str, color);
 }
 
+const keyleds::KeyDatabase & LuaEffect::keyDB() const
+{
+    return m_service.keyDB();
+}
+
 keyleds::RenderTarget * LuaEffect::createRenderTarget()
 {
     return m_service.createRenderTarget();
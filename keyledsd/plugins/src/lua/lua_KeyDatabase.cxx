@@ -63,7 +63,9 @@ static int findName(lua_State * lua)
 {
     const auto * db = lua_check<const KeyDatabase *>(lua, 1);
 
-    auto it = db->findName(luaL_checkstring(lua, 2));
+    std::size_t size;
+    const char * name = luaL_checklstring(lua, 2, &size);
+    auto it = db->findName(name, size);
     if (it != db->end()) {
         lua_push(lua, &*it);
     } else {
@@ -72,11 +74,104 @@ static int findName(lua_State * lua)
     return 1;
 }
 
+static int center(lua_State * lua)
+{
+    const auto * db = lua_check<const KeyDatabase *>(lua, 1);
+    const auto * key = lua_check<const KeyDatabase::Key *>(lua, 2);
+    auto point = db->center(*key);
+    lua_pushnumber(lua, point.x);
+    lua_pushnumber(lua, point.y);
+    return 2;
+}
+
+static int nearest(lua_State * lua)
+{
+    const auto * db = lua_check<const KeyDatabase *>(lua, 1);
+
+    auto it = db->findNearest({ KeyDatabase::position_type(luaL_checknumber(lua, 2)),
+                                KeyDatabase::position_type(luaL_checknumber(lua, 3)) });
+    if (it != db->end()) {
+        lua_push(lua, &*it);
+    } else {
+        lua_pushnil(lua);
+    }
+    return 1;
+}
+
+/// Pushes a sequence with keys at given indices
+static void pushKeyList(lua_State * lua, const KeyDatabase & db,
+                        const KeyDatabase::index_list & indices)
+{
+    lua_createtable(lua, int(indices.size()), 0);
+    for (std::size_t idx = 0; idx < indices.size(); ++idx) {
+        lua_push(lua, &db[indices[idx]]);
+        lua_rawseti(lua, -2, int(idx + 1));
+    }
+}
+
+static int keysInRect(lua_State * lua)
+{
+    const auto * db = lua_check<const KeyDatabase *>(lua, 1);
+    auto rect = KeyDatabase::Key::Rect{
+        KeyDatabase::position_type(luaL_checknumber(lua, 2)),
+        KeyDatabase::position_type(luaL_checknumber(lua, 3)),
+        KeyDatabase::position_type(luaL_checknumber(lua, 4)),
+        KeyDatabase::position_type(luaL_checknumber(lua, 5))
+    };
+
+    KeyDatabase::index_list result;
+    db->findInRect(rect, result);
+    pushKeyList(lua, *db, result);
+    return 1;
+}
+
+static int keysInRadius(lua_State * lua)
+{
+    const auto * db = lua_check<const KeyDatabase *>(lua, 1);
+
+    // Center is either a key or a pair of coordinates
+    KeyDatabase::Point point;
+    int radiusIdx;
+    if (lua_is<const KeyDatabase::Key *>(lua, 2)) {
+        point = db->center(*lua_to<const KeyDatabase::Key *>(lua, 2));
+        radiusIdx = 3;
+    } else {
+        point = { KeyDatabase::position_type(luaL_checknumber(lua, 2)),
+                  KeyDatabase::position_type(luaL_checknumber(lua, 3)) };
+        radiusIdx = 4;
+    }
+
+    KeyDatabase::index_list result;
+    db->findInRadius(point, KeyDatabase::position_type(luaL_checknumber(lua, radiusIdx)), result);
+    pushKeyList(lua, *db, result);
+    return 1;
+}
+
+static int keysAlongLine(lua_State * lua)
+{
+    const auto * db = lua_check<const KeyDatabase *>(lua, 1);
+    auto from = KeyDatabase::Point{ KeyDatabase::position_type(luaL_checknumber(lua, 2)),
+                                    KeyDatabase::position_type(luaL_checknumber(lua, 3)) };
+    auto to = KeyDatabase::Point{ KeyDatabase::position_type(luaL_checknumber(lua, 4)),
+                                  KeyDatabase::position_type(luaL_checknumber(lua, 5)) };
+    auto width = KeyDatabase::position_type(luaL_optnumber(lua, 6, 1));
+
+    KeyDatabase::index_list result;
+    db->findAlongLine(from, to, width, result);
+    pushKeyList(lua, *db, result);
+    return 1;
+}
+
 static const luaL_Reg methods[] = {
     { "angle",          angle },
+    { "center",         center },
     { "distance",       distance },
     { "findKeyCode",    findKeyCode },
     { "findName",       findName },
+    { "keysAlongLine",  keysAlongLine },
+    { "keysInRadius",   keysInRadius },
+    { "keysInRect",     keysInRect },
+    { "nearest",        nearest },
     { nullptr,          nullptr }
 };
 
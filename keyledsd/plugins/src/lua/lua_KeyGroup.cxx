@@ -18,8 +18,10 @@
 
 #include <lua.hpp>
 #include <sstream>
+#include "lua/Environment.h"
 #include "lua/lua_common.h"
 #include "lua/lua_Key.h"
+#include "lua/lua_KeyDatabase.h"
 
 using keyleds::KeyDatabase;
 
@@ -27,29 +29,102 @@ namespace keyleds { namespace lua {
 
 /****************************************************************************/
 
-static int index(lua_State * lua)
+/// Returns group at index, which is known to be of either group type
+static const KeyDatabase::KeyGroup * toKeyGroup(lua_State * lua, int index)
 {
-    const auto * group = lua_to<const KeyDatabase::KeyGroup *>(lua, 1);
+    if (lua_is<KeyDatabase::KeyGroup>(lua, index)) {
+        return &lua_to<KeyDatabase::KeyGroup>(lua, index);
+    }
+    return lua_to<const KeyDatabase::KeyGroup *>(lua, index);
+}
 
-    auto idx = luaL_checkinteger(lua, 2);
-    if (static_cast<size_t>(std::abs(idx)) > group->size()) {
-        return luaL_error(lua, badIndexErrorMessage, idx);
+const KeyDatabase::KeyGroup * lua_checkkeygroup(lua_State * lua, int index)
+{
+    if (!lua_is<const KeyDatabase::KeyGroup *>(lua, index) &&
+        !lua_is<KeyDatabase::KeyGroup>(lua, index)) {
+        luaL_argerror(lua, index, badTypeErrorMessage);
+        // does not return
     }
-    idx = idx > 0 ? idx - 1 : group->size() + idx;
-    lua_push(lua, &(*group)[idx]);
+    return toKeyGroup(lua, index);
+}
+
+/****************************************************************************/
+
+static int contains(lua_State * lua)
+{
+    const auto * group = lua_checkkeygroup(lua, 1);
+    const auto * key = lua_check<const KeyDatabase::Key *>(lua, 2);
+    lua_pushboolean(lua, group->contains(*key));
     return 1;
 }
 
+/// Pushes a new group holding keys set in mask, owned by lua
+static int pushKeyMask(lua_State * lua, std::string name, const KeyMask & mask)
+{
+    const auto * db = Environment(lua).keyDB();
+    if (!db) { return luaL_error(lua, noEffectTokenErrorMessage); }
+    lua_push(lua, db->makeGroup(std::move(name), mask));
+    return 1;
+}
+
+static int unionWith(lua_State * lua)
+{
+    const auto * group = lua_checkkeygroup(lua, 1);
+    const auto * other = lua_checkkeygroup(lua, 2);
+    return pushKeyMask(lua, group->name() + '|' + other->name(), group->mask() | other->mask());
+}
+
+static int intersection(lua_State * lua)
+{
+    const auto * group = lua_checkkeygroup(lua, 1);
+    const auto * other = lua_checkkeygroup(lua, 2);
+    return pushKeyMask(lua, group->name() + '&' + other->name(), group->mask() & other->mask());
+}
+
+static int difference(lua_State * lua)
+{
+    const auto * group = lua_checkkeygroup(lua, 1);
+    const auto * other = lua_checkkeygroup(lua, 2);
+    return pushKeyMask(lua, group->name() + '-' + other->name(), group->mask() - other->mask());
+}
+
+static const luaL_Reg methods[] = {
+    { "contains",       contains },
+    { "difference",     difference },
+    { "intersection",   intersection },
+    { "union",          unionWith },
+    { nullptr,          nullptr }
+};
+
+/****************************************************************************/
+
+static int index(lua_State * lua)
+{
+    const auto * group = toKeyGroup(lua, 1);
+
+    if (lua_type(lua, 2) == LUA_TNUMBER) {
+        auto idx = lua_tointeger(lua, 2);
+        if (idx == 0 || static_cast<size_t>(std::abs(idx)) > group->size()) {
+            return luaL_error(lua, badIndexErrorMessage, idx);
+        }
+        idx = idx > 0 ? idx - 1 : group->size() + idx;
+        lua_push(lua, &(*group)[idx]);
+        return 1;
+    }
+    if (lua_handleMethodIndex(lua, 2, methods)) { return 1; }
+    return lua_keyError(lua, 2);
+}
+
 static int len(lua_State * lua)
 {
-    const auto * group = lua_to<const KeyDatabase::KeyGroup *>(lua, 1);
+    const auto * group = toKeyGroup(lua, 1);
     lua_pushinteger(lua, group->size());
     return 1;
 }
 
 static int toString(lua_State * lua)
 {
-    const auto * keyGroup = lua_to<const KeyDatabase::KeyGroup *>(lua, 1);
+    const auto * keyGroup = toKeyGroup(lua, 1);
 
     bool isFirst = true;
     std::ostringstream buffer;
@@ -64,6 +139,13 @@ static int toString(lua_State * lua)
     return 1;
 }
 
+static int collect(lua_State * lua)
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+    lua_to<KeyGroup>(lua, 1).~KeyGroup();
+    return 0;
+}
+
 /****************************************************************************/
 
 const char * metatable<const KeyDatabase::KeyGroup *>::name = "LKeyGroup";
@@ -74,4 +156,13 @@ const struct luaL_Reg metatable<const KeyDatabase::KeyGroup *>::meta_methods[] =
     { nullptr,      nullptr}
 };
 
+const char * metatable<KeyDatabase::KeyGroup>::name = "LOwnedKeyGroup";
+const struct luaL_Reg metatable<KeyDatabase::KeyGroup>::meta_methods[] = {
+    { "__gc",       collect },
+    { "__index",    index},
+    { "__len",      len},
+    { "__tostring", toString },
+    { nullptr,      nullptr}
+};
+
 } } // namespace keyleds::lua
@@ -0,0 +1,192 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/utils.h"
+
+static constexpr float unreachable = std::numeric_limits<float>::max();
+
+/****************************************************************************/
+
+/** Ripple effect
+ *
+ * Every key press starts a circular wavefront centered on the key, which
+ * expands and fades out. Wavefronts live in a fixed-capacity ring, oldest
+ * ones being dropped when it is full. Rendering evaluates every wavefront
+ * against all keys using rows of pre-computed distances from each origin key,
+ * so it never allocates and its cost is bounded by the ring capacity.
+ */
+class RippleEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+    using size_type = RenderTarget::size_type;
+
+    struct Wavefront
+    {
+        size_type   origin;     ///< index of key the ripple started from
+        unsigned    age;        ///< how long ago the press happened, in milliseconds
+    };
+
+public:
+    RippleEffect(EffectService & service)
+     : m_keyDB(service.keyDB()),
+       m_buffer(service.createRenderTarget()),
+       m_stride(m_buffer->capacity()),
+       m_color(255, 255, 255, 255),
+       m_speed(1000),
+       m_width(60),
+       m_duration(1500),
+       m_next(0),
+       m_active(0)
+    {
+        unsigned capacity = 32;
+        RGBAColor::parse(service.getConfig("color"), &m_color);
+        keyleds::parseNumber(service.getConfig("speed"), &m_speed);
+        keyleds::parseNumber(service.getConfig("width"), &m_width);
+        keyleds::parseNumber(service.getConfig("duration"), &m_duration);
+        keyleds::parseNumber(service.getConfig("capacity"), &capacity);
+        if (m_width == 0) { m_width = 1; }
+        if (m_duration == 0) { m_duration = 1; }
+        if (capacity == 0) { capacity = 1; }
+
+        const KeyGroup * keys = nullptr;
+        const auto & groupStr = service.getConfig("group");
+        if (!groupStr.empty()) {
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git != service.keyGroups().end()) { keys = &*git; }
+        }
+
+        // Keys outside group or without known position never light up
+        m_enabled.assign(m_stride, 0.0f);
+        for (const auto & key : m_keyDB) {
+            const auto & pos = key.position;
+            if ((pos.x0 != pos.x1 || pos.y0 != pos.y1) && (!keys || keys->contains(key))) {
+                m_enabled[key.index] = 1.0f;
+            }
+        }
+
+        // All storage is allocated upfront, distance rows are filled on first use
+        m_wavefronts.resize(capacity);
+        m_distances.assign(m_stride * m_keyDB.size(), 0.0f);
+        m_hasDistances.assign(m_keyDB.size(), false);
+        m_intensity.assign(m_stride, 0.0f);
+
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        std::fill(m_intensity.begin(), m_intensity.end(), 0.0f);
+
+        for (std::size_t count = 0, idx = firstActive(); count < m_active;
+             ++count, idx = (idx + 1) % m_wavefronts.size()) {
+            auto & wave = m_wavefronts[idx];
+            wave.age = unsigned(std::min<unsigned long>(wave.age + ms, m_duration));
+            accumulate(wave);
+        }
+        // Wavefronts are ordered by age, so expired ones are at the front
+        while (m_active > 0 && m_wavefronts[firstActive()].age >= m_duration) { --m_active; }
+
+        auto * colors = m_buffer->data();
+        for (std::size_t idx = 0; idx < m_stride; ++idx) {
+            colors[idx] = RGBAColor(m_color.red, m_color.green, m_color.blue,
+                                    RGBAColor::channel_type(m_color.alpha * m_intensity[idx]));
+        }
+        blend(target, *m_buffer);
+    }
+
+    void handleKeyEvent(const KeyDatabase::Key & key, bool press) override
+    {
+        if (!press) { return; }
+        if (!m_hasDistances[key.index]) { computeDistances(key); }
+
+        m_wavefronts[m_next] = { key.index, 0 };
+        m_next = (m_next + 1) % m_wavefronts.size();
+        m_active = std::min(m_active + 1, m_wavefronts.size());
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return (m_distances.size() + m_intensity.size() + m_enabled.size()) * sizeof(float)
+             + m_wavefronts.size() * sizeof(Wavefront);
+    }
+
+private:
+    std::size_t firstActive() const
+    {
+        return (m_next + m_wavefronts.size() - m_active) % m_wavefronts.size();
+    }
+
+    /// Adds contribution of a wavefront to m_intensity
+    void accumulate(const Wavefront & wave)
+    {
+        const float radius = float(m_speed) * float(wave.age) / 1000.0f;
+        const float invWidth = 1.0f / float(m_width);
+        const float fade = 1.0f - float(wave.age) / float(m_duration);
+        const float * distances = &m_distances[wave.origin * m_stride];
+        const float * enabled = m_enabled.data();
+        float * intensity = m_intensity.data();
+
+        for (std::size_t idx = 0; idx < m_stride; ++idx) {
+            float value = 1.0f - std::fabs(distances[idx] - radius) * invWidth;
+            value = (value < 0.0f ? 0.0f : value) * fade * enabled[idx];
+            intensity[idx] = intensity[idx] < value ? value : intensity[idx];
+        }
+    }
+
+    void computeDistances(const KeyDatabase::Key & origin)
+    {
+        float * row = &m_distances[origin.index * m_stride];
+        std::fill(row, row + m_stride, unreachable);
+
+        const auto center = m_keyDB.center(origin);
+        for (const auto & key : m_keyDB) {
+            const auto other = m_keyDB.center(key);
+            const auto dx = float(other.x - center.x);
+            const auto dy = float(other.y - center.y);
+            row[key.index] = std::sqrt(dx * dx + dy * dy);
+        }
+        m_hasDistances[origin.index] = true;
+    }
+
+private:
+    const KeyDatabase &     m_keyDB;
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    const std::size_t       m_stride;       ///< number of entries in per-key arrays
+
+    RGBAColor               m_color;        ///< color of wavefronts at full intensity
+    unsigned                m_speed;        ///< how fast wavefronts expand, in layout units per second
+    unsigned                m_width;        ///< half-thickness of wavefronts, in layout units
+    unsigned                m_duration;     ///< how long a ripple lasts, in milliseconds
+
+    std::vector<Wavefront>  m_wavefronts;   ///< ring of active ripples
+    std::size_t             m_next;         ///< ring slot for next ripple
+    std::size_t             m_active;       ///< number of live ripples, ending at m_next
+
+    std::vector<float>      m_distances;    ///< one row of distances from each origin key
+    std::vector<bool>       m_hasDistances; ///< whether each origin's row is filled
+    std::vector<float>      m_enabled;      ///< 1 for keys that can light up, 0 otherwise
+    std::vector<float>      m_intensity;    ///< per-key intensity, rebuilt every frame
+};
+
+KEYLEDSD_SIMPLE_EFFECT("ripple", RippleEffect);
@@ -0,0 +1,561 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/utils.h"
+
+static constexpr float pi = 3.14159265358979f;
+static constexpr float neverPressed = 1.0e9f;   ///< age of keys that were never pressed
+
+/****************************************************************************/
+
+/** Compiled shader program
+ *
+ * Register machine where every register is a vector holding one float per
+ * key. Instructions apply one operation to whole registers at once, in a
+ * plain loop the compiler can vectorize. Registers come in three kinds:
+ * inputs filled by the effect, constants filled once at load time and
+ * temporaries written by instructions.
+ */
+class ShaderProgram final
+{
+public:
+    enum class Opcode : unsigned char {
+        Add, Sub, Mul, Div, Mod, Neg,
+        Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual,
+        Min, Max, Pow, Step,
+        Sin, Cos, Abs, Floor, Fract, Sqrt, Exp,
+        Mix, Clamp, Smoothstep
+    };
+    enum Input : unsigned { X, Y, Width, Height, Time, Age, Pressed, nbInputs };
+
+    struct Instruction final
+    {
+        Opcode      op;
+        unsigned    dst;
+        unsigned    a, b, c;
+    };
+    struct Constant final
+    {
+        unsigned    reg;
+        float       value;
+    };
+    using instruction_list = std::vector<Instruction>;
+    using constant_list = std::vector<Constant>;
+
+public:
+    instruction_list    code;
+    constant_list       constants;
+    unsigned            nbRegisters = nbInputs;
+
+public:
+    /// Runs the program over registers, each of which has stride floats
+    void run(std::vector<float> & registers, std::size_t stride) const
+    {
+        for (const auto & ins : code) {
+            float * d = &registers[ins.dst * stride];
+            const float * a = &registers[ins.a * stride];
+            const float * b = &registers[ins.b * stride];
+            const float * c = &registers[ins.c * stride];
+
+            switch (ins.op) {
+            case Opcode::Add:   apply(stride, d, a, b, [](float x, float y) { return x + y; }); break;
+            case Opcode::Sub:   apply(stride, d, a, b, [](float x, float y) { return x - y; }); break;
+            case Opcode::Mul:   apply(stride, d, a, b, [](float x, float y) { return x * y; }); break;
+            case Opcode::Div:   apply(stride, d, a, b, [](float x, float y) { return x / y; }); break;
+            case Opcode::Mod:   apply(stride, d, a, b, [](float x, float y) { return x - y * std::floor(x / y); }); break;
+            case Opcode::Neg:   apply(stride, d, a, [](float x) { return -x; }); break;
+            case Opcode::Less:  apply(stride, d, a, b, [](float x, float y) { return x < y ? 1.0f : 0.0f; }); break;
+            case Opcode::LessEqual: apply(stride, d, a, b, [](float x, float y) { return x <= y ? 1.0f : 0.0f; }); break;
+            case Opcode::Greater: apply(stride, d, a, b, [](float x, float y) { return x > y ? 1.0f : 0.0f; }); break;
+            case Opcode::GreaterEqual: apply(stride, d, a, b, [](float x, float y) { return x >= y ? 1.0f : 0.0f; }); break;
+            case Opcode::Equal: apply(stride, d, a, b, [](float x, float y) { return x == y ? 1.0f : 0.0f; }); break;
+            case Opcode::NotEqual: apply(stride, d, a, b, [](float x, float y) { return x != y ? 1.0f : 0.0f; }); break;
+            case Opcode::Min:   apply(stride, d, a, b, [](float x, float y) { return y < x ? y : x; }); break;
+            case Opcode::Max:   apply(stride, d, a, b, [](float x, float y) { return x < y ? y : x; }); break;
+            case Opcode::Pow:   apply(stride, d, a, b, [](float x, float y) { return std::pow(x, y); }); break;
+            case Opcode::Step:  apply(stride, d, a, b, [](float e, float x) { return x < e ? 0.0f : 1.0f; }); break;
+            case Opcode::Sin:   apply(stride, d, a, [](float x) { return std::sin(x); }); break;
+            case Opcode::Cos:   apply(stride, d, a, [](float x) { return std::cos(x); }); break;
+            case Opcode::Abs:   apply(stride, d, a, [](float x) { return std::fabs(x); }); break;
+            case Opcode::Floor: apply(stride, d, a, [](float x) { return std::floor(x); }); break;
+            case Opcode::Fract: apply(stride, d, a, [](float x) { return x - std::floor(x); }); break;
+            case Opcode::Sqrt:  apply(stride, d, a, [](float x) { return std::sqrt(x); }); break;
+            case Opcode::Exp:   apply(stride, d, a, [](float x) { return std::exp(x); }); break;
+            case Opcode::Mix:
+                apply(stride, d, a, b, c, [](float x, float y, float t) { return x + (y - x) * t; });
+                break;
+            case Opcode::Clamp:
+                apply(stride, d, a, b, c, [](float x, float lo, float hi) {
+                    return x < lo ? lo : (hi < x ? hi : x);
+                });
+                break;
+            case Opcode::Smoothstep:
+                apply(stride, d, a, b, c, [](float e0, float e1, float x) {
+                    float t = (x - e0) / (e1 - e0);
+                    t = t < 0.0f ? 0.0f : (1.0f < t ? 1.0f : t);
+                    return t * t * (3.0f - 2.0f * t);
+                });
+                break;
+            }
+        }
+    }
+
+    /// Computes the value of an instruction whose operands are all known
+    static float fold(Opcode op, float a, float b, float c)
+    {
+        ShaderProgram program;
+        program.code.push_back({ op, 3, 0, 1, 2 });
+        std::vector<float> registers = { a, b, c, 0.0f };
+        program.run(registers, 1);
+        return registers[3];
+    }
+
+private:
+    template <typename Func>
+    static void apply(std::size_t n, float * d, const float * a, Func && func)
+    {
+        for (std::size_t i = 0; i < n; ++i) { d[i] = func(a[i]); }
+    }
+    template <typename Func>
+    static void apply(std::size_t n, float * d, const float * a, const float * b, Func && func)
+    {
+        for (std::size_t i = 0; i < n; ++i) { d[i] = func(a[i], b[i]); }
+    }
+    template <typename Func>
+    static void apply(std::size_t n, float * d, const float * a, const float * b,
+                      const float * c, Func && func)
+    {
+        for (std::size_t i = 0; i < n; ++i) { d[i] = func(a[i], b[i], c[i]); }
+    }
+};
+
+/****************************************************************************/
+
+/** Expression compiler
+ *
+ * Recursive descent parser emitting code directly into a ShaderProgram.
+ * Operations on constant operands are folded at compile time. Throws
+ * std::runtime_error on syntax errors.
+ *
+ * Grammar:
+ *      expression  := sum [ ('<' | '<=' | '>' | '>=' | '==' | '!=') sum ]
+ *      sum         := product { ('+' | '-') product }
+ *      product     := unary { ('*' | '/' | '%') unary }
+ *      unary       := '-' unary | primary
+ *      primary     := number | name | name '(' expression { ',' expression } ')'
+ *                   | '(' expression ')'
+ */
+class ShaderCompiler final
+{
+    using Opcode = ShaderProgram::Opcode;
+
+    struct Value final
+    {
+        bool        constant;
+        float       value;      ///< if constant
+        unsigned    reg;        ///< if not constant
+    };
+    struct Variable final
+    {
+        std::string name;
+        Value       value;
+    };
+    struct Function final
+    {
+        const char *    name;
+        unsigned        arity;
+        Opcode          op;
+    };
+    static constexpr Value zero = { true, 0.0f, 0 };
+
+public:
+    explicit ShaderCompiler(ShaderProgram & program) : m_program(program)
+    {
+        using Input = ShaderProgram::Input;
+        m_variables = {
+            { "x",          { false, 0.0f, Input::X } },
+            { "y",          { false, 0.0f, Input::Y } },
+            { "w",          { false, 0.0f, Input::Width } },
+            { "h",          { false, 0.0f, Input::Height } },
+            { "t",          { false, 0.0f, Input::Time } },
+            { "age",        { false, 0.0f, Input::Age } },
+            { "pressed",    { false, 0.0f, Input::Pressed } },
+            { "pi",         { true, pi, 0 } }
+        };
+    }
+
+    /// Exposes a color as name.r, name.g, name.b and name.a, in 0-1 range
+    void defineColor(const std::string & name, keyleds::RGBAColor color)
+    {
+        m_variables.push_back({ name + ".r", { true, float(color.red) / 255.0f, 0 } });
+        m_variables.push_back({ name + ".g", { true, float(color.green) / 255.0f, 0 } });
+        m_variables.push_back({ name + ".b", { true, float(color.blue) / 255.0f, 0 } });
+        m_variables.push_back({ name + ".a", { true, float(color.alpha) / 255.0f, 0 } });
+    }
+
+    /// Compiles an expression, returning the register that will hold its value
+    unsigned compile(const std::string & source)
+    {
+        m_source = source.c_str();
+        m_pos = m_source;
+        auto result = parseExpression();
+        skipSpace();
+        if (*m_pos != '\0') { fail("unexpected character"); }
+        return materialize(result);
+    }
+
+private:
+    // Registers
+
+    unsigned allocate()
+    {
+        if (!m_free.empty()) {
+            auto reg = m_free.back();
+            m_free.pop_back();
+            return reg;
+        }
+        m_temporary.resize(m_program.nbRegisters + 1, false);
+        m_temporary[m_program.nbRegisters] = true;
+        return m_program.nbRegisters++;
+    }
+
+    void release(const Value & value)
+    {
+        if (!value.constant && value.reg < m_temporary.size() && m_temporary[value.reg]) {
+            m_free.push_back(value.reg);
+        }
+    }
+
+    unsigned materialize(const Value & value)
+    {
+        if (!value.constant) { return value.reg; }
+        auto it = std::find_if(m_program.constants.begin(), m_program.constants.end(),
+                               [&value](const auto & constant) { return constant.value == value.value; });
+        if (it != m_program.constants.end()) { return it->reg; }
+
+        m_temporary.resize(m_program.nbRegisters + 1, false);
+        auto reg = m_program.nbRegisters++;
+        m_program.constants.push_back({ reg, value.value });
+        return reg;
+    }
+
+    /// Emits an instruction with given operands, unused ones left as constant zero
+    Value emit(Opcode op, unsigned arity, Value a, Value b = zero, Value c = zero)
+    {
+        if (a.constant && b.constant && c.constant) {
+            return { true, ShaderProgram::fold(op, a.value, b.value, c.value), 0 };
+        }
+        // Unused operands point to any valid register, their value is ignored
+        auto ra = materialize(a);
+        auto rb = arity > 1 ? materialize(b) : ra;
+        auto rc = arity > 2 ? materialize(c) : ra;
+        release(a);
+        release(b);
+        release(c);
+        auto dst = allocate();
+        m_program.code.push_back({ op, dst, ra, rb, rc });
+        return { false, 0.0f, dst };
+    }
+
+    // Parsing
+
+    [[noreturn]] void fail(const char * what) const
+    {
+        throw std::runtime_error(std::string(what) + " at position "
+                                 + std::to_string(m_pos - m_source) + " in '" + m_source + "'");
+    }
+
+    void skipSpace() { while (*m_pos == ' ' || *m_pos == '\t') { ++m_pos; } }
+
+    bool accept(const char * token)
+    {
+        skipSpace();
+        auto length = std::strlen(token);
+        if (std::strncmp(m_pos, token, length) != 0) { return false; }
+        m_pos += length;
+        return true;
+    }
+
+    void expect(const char * token)
+    {
+        if (!accept(token)) { fail((std::string("expected '") + token + "'").c_str()); }
+    }
+
+    Value parseExpression()
+    {
+        auto lhs = parseSum();
+        static const std::pair<const char *, Opcode> operators[] = {
+            { "<=", Opcode::LessEqual }, { ">=", Opcode::GreaterEqual },
+            { "==", Opcode::Equal }, { "!=", Opcode::NotEqual },
+            { "<", Opcode::Less }, { ">", Opcode::Greater }
+        };
+        for (const auto & entry : operators) {
+            if (accept(entry.first)) { return emit(entry.second, 2, lhs, parseSum()); }
+        }
+        return lhs;
+    }
+
+    Value parseSum()
+    {
+        auto lhs = parseProduct();
+        for (;;) {
+            if (accept("+")) { lhs = emit(Opcode::Add, 2, lhs, parseProduct()); }
+            else if (accept("-")) { lhs = emit(Opcode::Sub, 2, lhs, parseProduct()); }
+            else { return lhs; }
+        }
+    }
+
+    Value parseProduct()
+    {
+        auto lhs = parseUnary();
+        for (;;) {
+            if (accept("*")) { lhs = emit(Opcode::Mul, 2, lhs, parseUnary()); }
+            else if (accept("/")) { lhs = emit(Opcode::Div, 2, lhs, parseUnary()); }
+            else if (accept("%")) { lhs = emit(Opcode::Mod, 2, lhs, parseUnary()); }
+            else { return lhs; }
+        }
+    }
+
+    Value parseUnary()
+    {
+        if (accept("-")) { return emit(Opcode::Neg, 1, parseUnary()); }
+        return parsePrimary();
+    }
+
+    Value parsePrimary()
+    {
+        skipSpace();
+        if (accept("(")) {
+            auto value = parseExpression();
+            expect(")");
+            return value;
+        }
+        if (std::isdigit(static_cast<unsigned char>(*m_pos)) || *m_pos == '.') {
+            char * end;
+            auto value = std::strtof(m_pos, &end);
+            if (end == m_pos) { fail("invalid number"); }
+            m_pos = end;
+            return { true, value, 0 };
+        }
+        if (std::isalpha(static_cast<unsigned char>(*m_pos)) || *m_pos == '_') {
+            const char * start = m_pos;
+            while (std::isalnum(static_cast<unsigned char>(*m_pos)) || *m_pos == '_'
+                   || *m_pos == '.') {
+                ++m_pos;
+            }
+            auto name = std::string(start, m_pos);
+            if (accept("(")) { return parseCall(name); }
+
+            auto it = std::find_if(m_variables.begin(), m_variables.end(),
+                                   [&name](const auto & var) { return var.name == name; });
+            if (it == m_variables.end()) { m_pos = start; fail("unknown variable"); }
+            return it->value;
+        }
+        fail("unexpected character");
+    }
+
+    Value parseCall(const std::string & name)
+    {
+        static const Function functions[] = {
+            { "sin", 1, Opcode::Sin },      { "cos", 1, Opcode::Cos },
+            { "abs", 1, Opcode::Abs },      { "floor", 1, Opcode::Floor },
+            { "fract", 1, Opcode::Fract },  { "sqrt", 1, Opcode::Sqrt },
+            { "exp", 1, Opcode::Exp },      { "min", 2, Opcode::Min },
+            { "max", 2, Opcode::Max },      { "pow", 2, Opcode::Pow },
+            { "step", 2, Opcode::Step },    { "mix", 3, Opcode::Mix },
+            { "clamp", 3, Opcode::Clamp },  { "smoothstep", 3, Opcode::Smoothstep }
+        };
+        auto it = std::find_if(std::begin(functions), std::end(functions),
+                               [&name](const auto & func) { return name == func.name; });
+        if (it == std::end(functions)) { fail("unknown function"); }
+
+        Value args[3] = { zero, zero, zero };
+        for (unsigned idx = 0; idx < it->arity; ++idx) {
+            if (idx > 0) { expect(","); }
+            args[idx] = parseExpression();
+        }
+        expect(")");
+        return emit(it->op, it->arity, args[0], args[1], args[2]);
+    }
+
+private:
+    ShaderProgram &         m_program;
+    std::vector<Variable>   m_variables;    ///< names usable in expressions
+    std::vector<bool>       m_temporary;    ///< whether each register is a temporary
+    std::vector<unsigned>   m_free;         ///< temporary registers available for reuse
+    const char *            m_source = nullptr;
+    const char *            m_pos = nullptr;
+};
+
+/****************************************************************************/
+
+class ShaderEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+    using Input = ShaderProgram::Input;
+    static constexpr const char * channels[4] = { "red", "green", "blue", "alpha" };
+    static constexpr unsigned long never = ~0ul;    ///< press time of keys never pressed
+public:
+    ShaderEffect(EffectService & service)
+     : m_buffer(service.createRenderTarget()),
+       m_stride(m_buffer->capacity()),
+       m_enabled(m_stride, 0),
+       m_pressTime(m_stride, never),
+       m_pressed(m_stride, false),
+       m_time(0),
+       m_period(3600000)
+    {
+        keyleds::parseNumber(service.getConfig("period"), &m_period);
+        if (m_period == 0) { m_period = 1; }
+
+        const auto & groupStr = service.getConfig("group");
+        const KeyGroup * keys = nullptr;
+        if (!groupStr.empty()) {
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git != service.keyGroups().end()) { keys = &*git; }
+        }
+
+        try {
+            compile(service);
+        } catch (std::exception & err) {
+            service.log(2, err.what());
+            m_program = ShaderProgram();
+            m_valid = false;
+        }
+
+        m_registers.assign(m_program.nbRegisters * m_stride, 0.0f);
+        for (const auto & constant : m_program.constants) {
+            std::fill_n(&m_registers[constant.reg * m_stride], m_stride, constant.value);
+        }
+        loadKeys(service.keyDB(), keys);
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        m_time += ms;
+        if (!m_valid) { return; }
+
+        const auto time = float(m_time % m_period) / 1000.0f;
+        std::fill_n(reg(Input::Time), m_stride, time);
+
+        auto * age = reg(Input::Age);
+        auto * pressed = reg(Input::Pressed);
+        for (std::size_t idx = 0; idx < m_stride; ++idx) {
+            age[idx] = m_pressTime[idx] == never ? neverPressed
+                                                 : float(m_time - m_pressTime[idx]) / 1000.0f;
+            pressed[idx] = m_pressed[idx] ? 1.0f : 0.0f;
+        }
+
+        m_program.run(m_registers, m_stride);
+
+        const float * red = reg(m_outputs[0]);
+        const float * green = reg(m_outputs[1]);
+        const float * blue = reg(m_outputs[2]);
+        const float * alpha = reg(m_outputs[3]);
+        auto * colors = m_buffer->data();
+        for (std::size_t idx = 0; idx < m_stride; ++idx) {
+            colors[idx] = RGBAColor(toChannel(red[idx]), toChannel(green[idx]),
+                                    toChannel(blue[idx]), toChannel(alpha[idx]) & m_enabled[idx]);
+        }
+        blend(target, *m_buffer);
+    }
+
+    void handleKeyEvent(const KeyDatabase::Key & key, bool press) override
+    {
+        if (press) { m_pressTime[key.index] = m_time; }
+        m_pressed[key.index] = press;
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        return m_registers.size() * sizeof(float)
+             + m_program.code.size() * sizeof(ShaderProgram::Instruction);
+    }
+
+private:
+    void compile(EffectService & service)
+    {
+        ShaderCompiler compiler(m_program);
+        for (const auto & item : service.configuration()) {
+            if (std::find(std::begin(channels), std::end(channels), item.first) != std::end(channels)) {
+                continue;
+            }
+            RGBAColor color;
+            if (RGBAColor::parse(item.second, &color)) { compiler.defineColor(item.first, color); }
+        }
+
+        static const char * const defaults[4] = { "0", "0", "0", "1" };
+        for (unsigned idx = 0; idx < 4; ++idx) {
+            const auto & source = service.getConfig(channels[idx]);
+            m_outputs[idx] = compiler.compile(source.empty() ? defaults[idx] : source);
+        }
+    }
+
+    void loadKeys(const KeyDatabase & keyDB, const KeyGroup * keys)
+    {
+        const auto bounds = keyDB.bounds();
+        const auto width = float(std::max(1, bounds.x1 - bounds.x0));
+        const auto height = float(std::max(1, bounds.y1 - bounds.y0));
+
+        for (const auto & key : keyDB) {
+            const auto center = keyDB.center(key);
+            reg(Input::X)[key.index] = float(center.x - bounds.x0) / width;
+            reg(Input::Y)[key.index] = float(center.y - bounds.y0) / height;
+            reg(Input::Width)[key.index] = float(key.position.x1 - key.position.x0) / width;
+            reg(Input::Height)[key.index] = float(key.position.y1 - key.position.y0) / height;
+            if (!keys || keys->contains(key)) { m_enabled[key.index] = 0xff; }
+        }
+    }
+
+    float * reg(unsigned idx) { return &m_registers[idx * m_stride]; }
+
+    static RGBAColor::channel_type toChannel(float value)
+    {
+        value = std::min(1.0f, std::max(0.0f, value));   // order matters for NaN
+        return RGBAColor::channel_type(value * 255.0f + 0.5f);
+    }
+
+private:
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    const std::size_t       m_stride;       ///< number of floats per register
+    ShaderProgram           m_program;      ///< compiled channel expressions
+    unsigned                m_outputs[4];   ///< registers holding red, green, blue, alpha
+    bool                    m_valid = true; ///< whether expressions compiled successfully
+    std::vector<float>      m_registers;    ///< register file, m_stride floats per register
+    std::vector<RGBAColor::channel_type> m_enabled; ///< alpha mask, 0 for keys outside group
+    std::vector<unsigned long> m_pressTime; ///< time of last press, never if none
+    std::vector<bool>       m_pressed;      ///< whether each key is currently held
+
+    unsigned long           m_time;         ///< time in milliseconds since effect creation
+    unsigned                m_period;       ///< t wraps around with this period, in milliseconds
+};
+
+constexpr ShaderCompiler::Value ShaderCompiler::zero;
+constexpr const char * ShaderEffect::channels[4];
+
+KEYLEDSD_SIMPLE_EFFECT("shader", ShaderEffect);
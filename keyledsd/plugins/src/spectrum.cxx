@@ -0,0 +1,379 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "keyledsd/OnDemandThread.h"
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/TripleBuffer.h"
+#include "keyledsd/utils.h"
+
+static constexpr float pi = 3.14159265358979f;
+static constexpr unsigned fftSize = 1024;       ///< samples per analysis window
+static constexpr unsigned hopSize = fftSize / 2;///< new samples between two analyses
+static constexpr float dynamicRange = 60.0f;    ///< dB mapped onto full key height
+static constexpr int pollTimeout = 100;         ///< ms, bounds how long stopping takes
+
+/****************************************************************************/
+
+/** Real-input FFT
+ *
+ * Computes the power spectrum of size real samples, using a complex FFT of
+ * half the size on samples packed as even/odd pairs, followed by a split
+ * step. Data is kept as separate real and imaginary arrays, and twiddles are
+ * stored contiguously per stage, so butterfly loops run over contiguous
+ * floats and can be vectorized.
+ */
+class RealFFT final
+{
+public:
+    explicit RealFFT(unsigned size)
+     : m_half(size / 2),
+       m_re(m_half), m_im(m_half),
+       m_splitRe(m_half), m_splitIm(m_half),
+       m_reverse(m_half)
+    {
+        unsigned bits = 0;
+        while ((1u << bits) < m_half) { ++bits; }
+        for (unsigned idx = 0; idx < m_half; ++idx) {
+            unsigned rev = 0;
+            for (unsigned bit = 0; bit < bits; ++bit) { rev |= ((idx >> bit) & 1) << (bits - 1 - bit); }
+            m_reverse[idx] = rev;
+        }
+        // Stage with half-size h uses h twiddles, stored at offset h - 1
+        for (unsigned half = 1; half < m_half; half *= 2) {
+            for (unsigned idx = 0; idx < half; ++idx) {
+                m_twiddleRe.push_back(std::cos(-pi * float(idx) / float(half)));
+                m_twiddleIm.push_back(std::sin(-pi * float(idx) / float(half)));
+            }
+        }
+        for (unsigned idx = 0; idx < m_half; ++idx) {
+            m_splitRe[idx] = std::cos(-pi * float(idx) / float(m_half));
+            m_splitIm[idx] = std::sin(-pi * float(idx) / float(m_half));
+        }
+    }
+
+    /// Fills power with size / 2 + 1 squared magnitudes
+    void powerSpectrum(const float * input, float * power)
+    {
+        for (unsigned idx = 0; idx < m_half; ++idx) {
+            m_re[m_reverse[idx]] = input[2 * idx];
+            m_im[m_reverse[idx]] = input[2 * idx + 1];
+        }
+
+        float * re = m_re.data();
+        float * im = m_im.data();
+        for (unsigned half = 1; half < m_half; half *= 2) {
+            const float * twRe = &m_twiddleRe[half - 1];
+            const float * twIm = &m_twiddleIm[half - 1];
+            for (unsigned start = 0; start < m_half; start += 2 * half) {
+                float * aRe = re + start, * aIm = im + start;
+                float * bRe = aRe + half, * bIm = aIm + half;
+                for (unsigned idx = 0; idx < half; ++idx) {
+                    const float tRe = bRe[idx] * twRe[idx] - bIm[idx] * twIm[idx];
+                    const float tIm = bRe[idx] * twIm[idx] + bIm[idx] * twRe[idx];
+                    bRe[idx] = aRe[idx] - tRe;
+                    bIm[idx] = aIm[idx] - tIm;
+                    aRe[idx] += tRe;
+                    aIm[idx] += tIm;
+                }
+            }
+        }
+
+        // Split: X[k] = (Z[k] + Z*[M-k]) / 2 - i W^k (Z[k] - Z*[M-k]) / 2
+        for (unsigned idx = 0; idx <= m_half; ++idx) {
+            const unsigned k = idx % m_half, c = (m_half - idx) % m_half;
+            const float evenRe = 0.5f * (re[k] + re[c]), evenIm = 0.5f * (im[k] - im[c]);
+            const float oddRe = 0.5f * (im[k] + im[c]), oddIm = -0.5f * (re[k] - re[c]);
+            const float wRe = idx < m_half ? m_splitRe[idx] : -1.0f;
+            const float wIm = idx < m_half ? m_splitIm[idx] : 0.0f;
+            const float xRe = evenRe + oddRe * wRe - oddIm * wIm;
+            const float xIm = evenIm + oddRe * wIm + oddIm * wRe;
+            power[idx] = xRe * xRe + xIm * xIm;
+        }
+    }
+
+private:
+    const unsigned      m_half;
+    std::vector<float>  m_re, m_im;             ///< working buffer, N/2 complex values
+    std::vector<float>  m_twiddleRe, m_twiddleIm;
+    std::vector<float>  m_splitRe, m_splitIm;   ///< e^(-2i.pi.k/N)
+    std::vector<unsigned> m_reverse;            ///< bit-reversal permutation
+};
+
+/****************************************************************************/
+
+/** Audio spectrum effect
+ *
+ * Reads signed 16-bit native-endian PCM from a FIFO, a regular file (looped,
+ * paced in real time) or an inherited file descriptor ("fd:N"). A background
+ * thread runs a windowed FFT every half window, reduces it to log-spaced
+ * bands and publishes them through a triple buffer. Each key shows the band for
+ * its horizontal position, lighting up as a bar graph from bottom to top.
+ * The thread only runs while the effect is rendered.
+ */
+class SpectrumEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+public:
+    SpectrumEffect(EffectService & service)
+     : m_buffer(service.createRenderTarget()),
+       m_low(0, 0, 255, 255),
+       m_high(255, 0, 0, 255),
+       m_fall(1000),
+       m_rate(44100),
+       m_channels(2),
+       m_fd(-1),
+       m_filled(0),
+       m_thread([this] { run(); })
+    {
+        unsigned nbBands = 16, minFrequency = 40, maxFrequency = 16000;
+        RGBAColor::parse(service.getConfig("low"), &m_low);
+        RGBAColor::parse(service.getConfig("high"), &m_high);
+        keyleds::parseNumber(service.getConfig("bands"), &nbBands);
+        keyleds::parseNumber(service.getConfig("min-frequency"), &minFrequency);
+        keyleds::parseNumber(service.getConfig("max-frequency"), &maxFrequency);
+        keyleds::parseNumber(service.getConfig("fall"), &m_fall);
+        keyleds::parseNumber(service.getConfig("rate"), &m_rate);
+        keyleds::parseNumber(service.getConfig("channels"), &m_channels);
+        nbBands = std::max(nbBands, 1u);
+        m_rate = std::max(m_rate, 1000u);
+        m_channels = std::max(m_channels, 1u);
+
+        loadKeys(service, nbBands);
+        computeBands(nbBands, minFrequency, maxFrequency);
+        m_slot.reset(new keyleds::TripleBuffer<float>(nbBands, 0.0f));
+        m_levels.assign(nbBands, 0.0f);
+        m_raw.resize(hopSize * m_channels);
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+
+        m_source = service.getConfig("source");
+        m_hasSource = openSource();
+        if (!m_hasSource) {
+            service.log(2, ("cannot open audio source '" + m_source + "': " + std::strerror(errno)).c_str());
+        }
+    }
+
+    ~SpectrumEffect()
+    {
+        m_thread.stop();
+        if (m_fd >= 0) { ::close(m_fd); }
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        if (m_hasSource) { m_thread.touch(); }
+        const float * bands = m_slot->front();
+        const float fall = float(m_fall) * float(ms) / 1000.0f / 1000.0f;
+        for (std::size_t idx = 0; idx < m_levels.size(); ++idx) {
+            m_levels[idx] = std::max(bands[idx], m_levels[idx] - fall);
+        }
+
+        for (const auto & key : m_keys) {
+            const auto level = m_levels[key.band];
+            auto & color = (*m_buffer)[key.index];
+            if (key.height < level) {
+                const auto ratio = key.height;
+                color = RGBAColor(
+                    RGBAColor::channel_type(m_low.red * (1.0f - ratio) + m_high.red * ratio),
+                    RGBAColor::channel_type(m_low.green * (1.0f - ratio) + m_high.green * ratio),
+                    RGBAColor::channel_type(m_low.blue * (1.0f - ratio) + m_high.blue * ratio),
+                    RGBAColor::channel_type(m_low.alpha * (1.0f - ratio) + m_high.alpha * ratio));
+            } else {
+                color = RGBAColor(0, 0, 0, 0);
+            }
+        }
+        blend(target, *m_buffer);
+    }
+
+private:
+    struct KeyInfo
+    {
+        RenderTarget::size_type index;
+        unsigned                band;       ///< which band this key displays
+        float                   height;     ///< from 0 at bottom of keyboard to 1 at top
+    };
+
+    void loadKeys(EffectService & service, unsigned nbBands)
+    {
+        const KeyGroup * keys = nullptr;
+        const auto & groupStr = service.getConfig("group");
+        if (!groupStr.empty()) {
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git != service.keyGroups().end()) { keys = &*git; }
+        }
+
+        const auto & keyDB = service.keyDB();
+        const auto bounds = keyDB.bounds();
+        const auto width = float(std::max(1, bounds.x1 - bounds.x0));
+        const auto height = float(std::max(1, bounds.y1 - bounds.y0));
+        for (const auto & key : keyDB) {
+            if (key.position.x0 == key.position.x1 && key.position.y0 == key.position.y1) { continue; }
+            if (keys && !keys->contains(key)) { continue; }
+            const auto center = keyDB.center(key);
+            const auto x = float(center.x - bounds.x0) / width;
+            m_keys.push_back({
+                key.index,
+                std::min(unsigned(x * float(nbBands)), nbBands - 1),
+                1.0f - float(center.y - bounds.y0) / height
+            });
+        }
+    }
+
+    /// Assigns FFT bins to log-spaced bands, each getting at least one bin
+    void computeBands(unsigned nbBands, unsigned minFrequency, unsigned maxFrequency)
+    {
+        const auto nyquist = float(m_rate) / 2.0f;
+        const auto low = std::max(1.0f, std::min(float(minFrequency), nyquist / 2.0f));
+        const auto high = std::max(low * 2.0f, std::min(float(maxFrequency), nyquist));
+        const auto binWidth = float(m_rate) / float(fftSize);
+
+        m_bandEdges.clear();
+        unsigned previous = 0;
+        for (unsigned band = 0; band <= nbBands; ++band) {
+            const auto frequency = low * std::pow(high / low, float(band) / float(nbBands));
+            auto bin = std::min(unsigned(frequency / binWidth + 0.5f), fftSize / 2 + 1);
+            if (band > 0) { bin = std::max(bin, previous + 1); }
+            m_bandEdges.push_back(std::min(bin, fftSize / 2 + 1));
+            previous = bin;
+        }
+    }
+
+    bool openSource()
+    {
+        if (m_source.compare(0, 3, "fd:") == 0) {
+            m_fd = ::fcntl(std::atoi(m_source.c_str() + 3), F_DUPFD_CLOEXEC, 0);
+            if (m_fd >= 0) { ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) | O_NONBLOCK); }
+            m_isFile = false;
+        } else {
+            // Non-blocking open, so a FIFO with no writer yet does not block
+            m_fd = ::open(m_source.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            struct stat info;
+            m_isFile = m_fd >= 0 && ::fstat(m_fd, &info) == 0 && S_ISREG(info.st_mode);
+        }
+        return m_fd >= 0;
+    }
+
+    /// Background thread: reads samples and publishes band levels
+    void run()
+    {
+        RealFFT fft(fftSize);
+        std::vector<float> window(fftSize), samples(fftSize, 0.0f), input(fftSize);
+        std::vector<float> power(fftSize / 2 + 1);
+        auto & raw = m_raw;
+        for (unsigned idx = 0; idx < fftSize; ++idx) {
+            window[idx] = 0.5f - 0.5f * std::cos(2.0f * pi * float(idx) / float(fftSize - 1));
+        }
+        // Full-scale sine under Hann window peaks at (N/4)^2
+        const float reference = float(fftSize) * float(fftSize) / 16.0f;
+
+        const auto hopDuration = std::chrono::microseconds(1000000ull * hopSize / m_rate);
+        auto nextHop = std::chrono::steady_clock::now();
+        auto & filled = m_filled;
+        bool readSinceRewind = false;           // a test file that yields nothing is not looped
+
+        while (m_thread.running()) {
+            if (!m_isFile) {
+                struct pollfd pfd = { m_fd, POLLIN, 0 };
+                if (::poll(&pfd, 1, pollTimeout) <= 0) { continue; }
+            }
+            auto * bytes = reinterpret_cast<char *>(raw.data());
+            auto nread = ::read(m_fd, bytes + filled, raw.size() * sizeof(raw[0]) - filled);
+            if (nread < 0) {
+                if (errno == EAGAIN || errno == EINTR) { continue; }
+                break;
+            }
+            if (nread == 0) {
+                if (m_isFile) {                 // loop test files
+                    if (!readSinceRewind) { break; }
+                    readSinceRewind = false;
+                    ::lseek(m_fd, 0, SEEK_SET);
+                    continue;
+                }
+                if (m_source.compare(0, 3, "fd:") == 0) { break; }
+                ::close(m_fd);                  // writer left the FIFO, wait for another
+                if (!openSource()) { break; }
+                continue;
+            }
+            filled += std::size_t(nread);
+            readSinceRewind = true;
+            if (filled < raw.size() * sizeof(raw[0])) { continue; }
+            filled = 0;
+
+            // Mix channels down and slide analysis window by one hop
+            std::copy(samples.begin() + hopSize, samples.end(), samples.begin());
+            for (unsigned idx = 0; idx < hopSize; ++idx) {
+                int sum = 0;
+                for (unsigned ch = 0; ch < m_channels; ++ch) { sum += raw[idx * m_channels + ch]; }
+                samples[fftSize - hopSize + idx] = float(sum) / (32768.0f * float(m_channels));
+            }
+            for (unsigned idx = 0; idx < fftSize; ++idx) { input[idx] = samples[idx] * window[idx]; }
+            fft.powerSpectrum(input.data(), power.data());
+
+            float * bands = m_slot->back();
+            for (std::size_t band = 0; band + 1 < m_bandEdges.size(); ++band) {
+                float sum = 0.0f;
+                for (auto bin = m_bandEdges[band]; bin < m_bandEdges[band + 1]; ++bin) { sum += power[bin]; }
+                const auto mean = sum / float(std::max(1u, m_bandEdges[band + 1] - m_bandEdges[band]));
+                const auto db = 10.0f * std::log10(mean / reference + 1e-12f);
+                bands[band] = std::min(1.0f, std::max(0.0f, (db + dynamicRange) / dynamicRange));
+            }
+            m_slot->publish();
+
+            if (m_isFile) {                     // files are read in real time
+                nextHop += hopDuration;
+                m_thread.sleepUntil(nextHop);
+            }
+        }
+    }
+
+private:
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    RGBAColor               m_low;          ///< color of bottom keys
+    RGBAColor               m_high;         ///< color of top keys
+    unsigned                m_fall;         ///< how fast bars fall, in thousandths of height per second
+    unsigned                m_rate;         ///< sample rate of source, in Hz
+    unsigned                m_channels;     ///< interleaved channels in source
+
+    std::vector<KeyInfo>    m_keys;         ///< keys that display bands
+    std::vector<unsigned>   m_bandEdges;    ///< first FFT bin of each band, plus end bin
+    std::vector<float>      m_levels;       ///< displayed level of each band, 0 to 1
+    std::unique_ptr<keyleds::TripleBuffer<float>> m_slot; ///< latest band levels from audio thread
+
+    std::string             m_source;       ///< path, or fd:N
+    bool                    m_hasSource = false; ///< source opened at creation, render thread uses this
+    int                     m_fd;           ///< audio source, only used by audio thread after creation
+    bool                    m_isFile = false; ///< source is a regular file
+    std::vector<std::int16_t> m_raw;        ///< samples of current hop, kept across pauses
+    std::size_t             m_filled;       ///< bytes of m_raw filled, so frames stay aligned
+    keyleds::OnDemandThread m_thread;       ///< audio thread, runs while rendered
+};
+
+KEYLEDSD_SIMPLE_EFFECT("spectrum", SpectrumEffect);
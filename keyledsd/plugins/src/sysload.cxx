@@ -0,0 +1,311 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "keyledsd/OnDemandThread.h"
+#include "keyledsd/PluginHelper.h"
+#include "keyledsd/TripleBuffer.h"
+#include "keyledsd/utils.h"
+
+/****************************************************************************/
+
+/** Cached /proc file reader
+ *
+ * Keeps the file open and reads it again from offset zero with pread,
+ * into a buffer that is reused across reads and only grows when the file
+ * does. Once warmed up, a read does no allocation and no path lookup.
+ */
+class ProcFile final
+{
+public:
+    explicit ProcFile(const char * path)
+     : m_fd(::open(path, O_RDONLY | O_CLOEXEC)), m_buffer(4096) {}
+    ProcFile(const ProcFile &) = delete;
+    ~ProcFile() { if (m_fd >= 0) { ::close(m_fd); } }
+
+    bool            isOpen() const noexcept { return m_fd >= 0; }
+
+    /// Reads whole file, returns pointer to NUL-terminated contents or nullptr
+    const char *    read()
+    {
+        if (m_fd < 0) { return nullptr; }
+        std::size_t size = 0;
+        for (;;) {
+            auto nread = ::pread(m_fd, &m_buffer[size], m_buffer.size() - size - 1, off_t(size));
+            if (nread < 0) {
+                if (errno == EINTR) { continue; }
+                return nullptr;
+            }
+            if (nread == 0) { break; }
+            size += std::size_t(nread);
+            if (size + 1 == m_buffer.size()) { m_buffer.resize(2 * m_buffer.size()); }
+        }
+        m_buffer[size] = '\0';
+        return m_buffer.data();
+    }
+
+private:
+    int                 m_fd;               ///< open file descriptor, -1 if open failed
+    std::vector<char>   m_buffer;           ///< contents of last read
+};
+
+/****************************************************************************/
+// Minimal parsing helpers, working in place on NUL-terminated buffers
+
+static const char * skipSpaces(const char * ptr)
+{
+    while (*ptr == ' ' || *ptr == '\t') { ++ptr; }
+    return ptr;
+}
+
+static const char * nextLine(const char * ptr)
+{
+    while (*ptr != '\0' && *ptr != '\n') { ++ptr; }
+    return *ptr == '\n' ? ptr + 1 : ptr;
+}
+
+static const char * parseField(const char * ptr, std::uint64_t * value)
+{
+    ptr = skipSpaces(ptr);
+    std::uint64_t result = 0;
+    while (*ptr >= '0' && *ptr <= '9') { result = 10 * result + std::uint64_t(*ptr++ - '0'); }
+    *value = result;
+    return ptr;
+}
+
+static bool startsWith(const char * ptr, const char * prefix)
+{
+    return std::strncmp(ptr, prefix, std::strlen(prefix)) == 0;
+}
+
+/****************************************************************************/
+
+/** System load sampler
+ *
+ * Turns successive reads of /proc files into activity ratios, from 0 to 1.
+ */
+class LoadSampler final
+{
+public:
+    enum Meter : unsigned { Cpu = 0, Memory, Disk, nbMeters };
+
+    LoadSampler() : m_stat("/proc/stat"), m_meminfo("/proc/meminfo"), m_diskstats("/proc/diskstats") {}
+
+    /// Updates levels, using elapsed time in ms since last call
+    void sample(unsigned long elapsed, float * levels)
+    {
+        levels[Cpu] = sampleCpu();
+        levels[Memory] = sampleMemory();
+        levels[Disk] = sampleDisk(elapsed);
+    }
+
+private:
+    /// Busy ratio of all CPUs, from the aggregated first line of /proc/stat
+    float sampleCpu()
+    {
+        const char * ptr = m_stat.read();
+        if (ptr == nullptr || !startsWith(ptr, "cpu ")) { return 0.0f; }
+        ptr += 3;
+
+        // user nice system idle iowait irq softirq steal
+        std::uint64_t total = 0, idle = 0;
+        for (unsigned field = 0; field < 8; ++field) {
+            std::uint64_t value;
+            ptr = parseField(ptr, &value);
+            total += value;
+            if (field == 3 || field == 4) { idle += value; }
+        }
+        const auto deltaTotal = total - m_cpuTotal, deltaIdle = idle - m_cpuIdle;
+        m_cpuTotal = total;
+        m_cpuIdle = idle;
+        if (deltaTotal == 0) { return 0.0f; }
+        return float(deltaTotal - std::min(deltaIdle, deltaTotal)) / float(deltaTotal);
+    }
+
+    /// Share of memory not available to new allocations
+    float sampleMemory()
+    {
+        const char * ptr = m_meminfo.read();
+        if (ptr == nullptr) { return 0.0f; }
+        std::uint64_t total = 0, available = 0;
+        for (; *ptr != '\0'; ptr = nextLine(ptr)) {
+            if (startsWith(ptr, "MemTotal:")) { parseField(ptr + 9, &total); }
+            else if (startsWith(ptr, "MemAvailable:")) { parseField(ptr + 13, &available); }
+        }
+        if (total == 0) { return 0.0f; }
+        return float(total - std::min(available, total)) / float(total);
+    }
+
+    /// Busy ratio of the busiest block device, from time spent doing I/O
+    float sampleDisk(unsigned long elapsed)
+    {
+        const char * ptr = m_diskstats.read();
+        if (ptr == nullptr) { return 0.0f; }
+
+        std::size_t device = 0;
+        std::uint64_t busiest = 0;
+        for (; *ptr != '\0'; ptr = nextLine(ptr)) {
+            // major minor name, then I/O statistics; the tenth is ms spent doing I/O
+            std::uint64_t value;
+            ptr = parseField(ptr, &value);
+            ptr = parseField(ptr, &value);
+            ptr = skipSpaces(ptr);
+            const bool virtualDevice = startsWith(ptr, "loop") || startsWith(ptr, "ram");
+            while (*ptr != '\0' && *ptr != ' ' && *ptr != '\n') { ++ptr; }
+            for (unsigned field = 0; field < 10; ++field) { ptr = parseField(ptr, &value); }
+
+            if (device == m_diskTicks.size()) { m_diskTicks.push_back(value); }
+            const auto delta = value >= m_diskTicks[device] ? value - m_diskTicks[device] : 0;
+            m_diskTicks[device++] = value;
+            if (!virtualDevice) { busiest = std::max(busiest, delta); }
+        }
+        if (elapsed == 0) { return 0.0f; }
+        return std::min(1.0f, float(busiest) / float(elapsed));
+    }
+
+private:
+    ProcFile                    m_stat;
+    ProcFile                    m_meminfo;
+    ProcFile                    m_diskstats;
+    std::uint64_t               m_cpuTotal = 0;     ///< jiffies at last sample
+    std::uint64_t               m_cpuIdle = 0;      ///< idle jiffies at last sample
+    std::vector<std::uint64_t>  m_diskTicks;        ///< per-device I/O ms at last sample
+};
+
+/****************************************************************************/
+
+/** System load meter effect
+ *
+ * Shows CPU, memory and disk activity as bar graphs over key groups. A
+ * background thread samples /proc at a fixed interval and publishes levels
+ * through a triple buffer. Each group fills in order, the partially filled
+ * key fading in, lit keys going from low to high color along the bar.
+ * Sampling only runs while the effect is rendered.
+ */
+class SysloadEffect final : public plugin::Effect
+{
+    using KeyGroup = KeyDatabase::KeyGroup;
+public:
+    SysloadEffect(EffectService & service)
+     : m_buffer(service.createRenderTarget()),
+       m_low(0, 255, 0, 255),
+       m_high(255, 0, 0, 255),
+       m_interval(500),
+       m_levels(LoadSampler::nbMeters, 0.0f),
+       m_thread([this] { run(); })
+    {
+        RGBAColor::parse(service.getConfig("low"), &m_low);
+        RGBAColor::parse(service.getConfig("high"), &m_high);
+        keyleds::parseNumber(service.getConfig("interval"), &m_interval);
+        if (m_interval == 0) { m_interval = 1; }
+
+        static constexpr std::array<const char *, LoadSampler::nbMeters> names = {{ "cpu", "memory", "disk" }};
+        for (unsigned meter = 0; meter < LoadSampler::nbMeters; ++meter) {
+            const auto & groupStr = service.getConfig(names[meter]);
+            if (groupStr.empty()) { continue; }
+            auto git = std::find_if(
+                service.keyGroups().begin(), service.keyGroups().end(),
+                [groupStr](const auto & group) { return group.name() == groupStr; });
+            if (git == service.keyGroups().end()) {
+                service.log(2, ("unknown key group '" + groupStr + "'").c_str());
+                continue;
+            }
+            for (const auto & key : *git) { m_bars[meter].push_back(key.index); }
+        }
+
+        m_slot.reset(new keyleds::TripleBuffer<float>(LoadSampler::nbMeters, 0.0f));
+        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+    }
+
+    void render(unsigned long ms, RenderTarget & target) override
+    {
+        m_thread.touch();
+
+        // Ease towards sampled levels so bars move smoothly between samples
+        const auto * levels = m_slot->front();
+        const auto ratio = std::min(1.0f, float(ms) / float(m_interval));
+        for (unsigned meter = 0; meter < LoadSampler::nbMeters; ++meter) {
+            m_levels[meter] += (levels[meter] - m_levels[meter]) * ratio;
+        }
+
+        for (unsigned meter = 0; meter < LoadSampler::nbMeters; ++meter) {
+            const auto & bar = m_bars[meter];
+            const auto filled = m_levels[meter] * float(bar.size());
+            for (std::size_t idx = 0; idx < bar.size(); ++idx) {
+                const auto position = bar.size() > 1 ? float(idx) / float(bar.size() - 1) : 0.0f;
+                const auto opacity = std::max(0.0f, std::min(1.0f, filled - float(idx)));
+                (*m_buffer)[bar[idx]] = RGBAColor(
+                    RGBAColor::channel_type(m_low.red * (1.0f - position) + m_high.red * position),
+                    RGBAColor::channel_type(m_low.green * (1.0f - position) + m_high.green * position),
+                    RGBAColor::channel_type(m_low.blue * (1.0f - position) + m_high.blue * position),
+                    RGBAColor::channel_type((m_low.alpha * (1.0f - position) + m_high.alpha * position)
+                                            * opacity));
+            }
+        }
+        blend(target, *m_buffer);
+    }
+
+    std::size_t memoryUsage() const override
+    {
+        std::size_t total = 0;
+        for (const auto & bar : m_bars) { total += bar.size() * sizeof(bar[0]); }
+        return total + 4 * LoadSampler::nbMeters * sizeof(float);
+    }
+
+private:
+    /// Sampling thread: reads /proc at configured interval until paused
+    void run()
+    {
+        LoadSampler sampler;
+        const auto interval = std::chrono::milliseconds(m_interval);
+        auto last = std::chrono::steady_clock::now();
+        sampler.sample(0, m_slot->back());      // establish counter baselines
+
+        for (;;) {
+            m_thread.sleepUntil(last + interval);
+            if (!m_thread.running()) { break; }
+            const auto now = std::chrono::steady_clock::now();
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last);
+            last = now;
+            sampler.sample(static_cast<unsigned long>(elapsed.count()), m_slot->back());
+            m_slot->publish();
+        }
+    }
+
+private:
+    RenderTarget *          m_buffer;       ///< this plugin's rendered state
+    RGBAColor               m_low;          ///< color at start of bars
+    RGBAColor               m_high;         ///< color at end of bars
+    unsigned                m_interval;     ///< time between samples, in ms
+
+    std::array<std::vector<RenderTarget::size_type>, LoadSampler::nbMeters> m_bars; ///< keys of each bar, in order
+    std::vector<float>      m_levels;       ///< displayed level of each meter, 0 to 1
+    std::unique_ptr<keyleds::TripleBuffer<float>> m_slot; ///< latest levels from sampling thread
+
+    keyleds::OnDemandThread m_thread;       ///< sampling thread, runs while rendered
+};
+
+KEYLEDSD_SIMPLE_EFFECT("sysload", SysloadEffect);
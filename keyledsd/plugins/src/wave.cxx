@@ -15,18 +15,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <algorithm>
-#include <cassert>
 #include <cmath>
-#include <cstddef>
 #include <string>
+#include "keyledsd/Gradient.h"
 #include "keyledsd/PluginHelper.h"
 #include "keyledsd/utils.h"
 
-static constexpr float pi = 3.14159265358979f;
-static constexpr int accuracy = 1024;
+using keyleds::Gradient;
 
-static_assert(accuracy && ((accuracy & (accuracy - 1)) == 0),
-              "accuracy must be a power of two");
+static constexpr float pi = 3.14159265358979f;
+static constexpr int accuracy = Gradient::resolution;
 
 /****************************************************************************/
 
@@ -36,7 +34,7 @@ class WaveEffect final : public plugin::Effect
 public:
     WaveEffect(EffectService & service)
      : m_buffer(service.createRenderTarget()),
-       m_keys(nullptr),
+       m_gradient(m_buffer->size()),
        m_time(0),
        m_period(10000),
        m_length(1000),
@@ -54,20 +52,20 @@ public:
                 colors.push_back(color);
             }
         }
-        m_colors = generateColorTable(colors);
+        m_gradient.setTable(Gradient::interpolate(colors));
 
         // Load key list
+        const KeyGroup * keys = nullptr;
         const auto & groupStr = service.getConfig("group");
         if (!groupStr.empty()) {
             auto git = std::find_if(
                 service.keyGroups().begin(), service.keyGroups().end(),
                 [groupStr](const auto & group) { return group.name() == groupStr; });
-            if (git != service.keyGroups().end()) { m_keys = &*git; }
+            if (git != service.keyGroups().end()) { keys = &*git; }
         }
 
         // Get ready
-        computePhases(service.keyDB());
-        std::fill(m_buffer->begin(), m_buffer->end(), RGBAColor{0, 0, 0, 0});
+        computePhases(service.keyDB(), keys);
     }
 
     void render(unsigned long ms, RenderTarget & target) override
@@ -75,88 +73,40 @@ public:
         m_time += ms;
         if (m_time >= m_period) { m_time -= m_period; }
 
-        int t = accuracy * m_time / m_period;
-
-        if (m_keys) {
-            assert(m_keys->size() == m_phases.size());
-            for (std::size_t idx = 0; idx < m_keys->size(); ++idx) {
-                int tphi = t - m_phases[idx];
-                if (tphi < 0) { tphi += accuracy; }
-
-                (*m_buffer)[(*m_keys)[idx].index] = m_colors[tphi];
-            }
-        } else {
-            assert(m_buffer->size() == m_phases.size());
-            for (std::size_t idx = 0; idx < m_buffer->size(); ++idx) {
-                int tphi = t - m_phases[idx];
-                if (tphi < 0) { tphi += accuracy; }
-
-                (*m_buffer)[idx] = m_colors[tphi];
-            }
-        }
+        m_gradient.render(Gradient::phase_type(accuracy * m_time / m_period), *m_buffer);
         blend(target, *m_buffer);
     }
 
 private:
-    void computePhases(const KeyDatabase & keyDB)
+    void computePhases(const KeyDatabase & keyDB, const KeyGroup * keys)
     {
         float frequency = float(accuracy) * 1000.0f / float(m_length);
         int freqX = int(frequency * std::sin(2.0f * pi / 360.0f * float(m_direction)));
         int freqY = int(frequency * std::cos(2.0f * pi / 360.0f * float(m_direction)));
         auto bounds = keyDB.bounds();
 
-        m_phases.clear();
-
         auto keyPhase = [&bounds, freqX, freqY](const auto & key) {
             int x = (key.position.x0 + key.position.x1) / 2;
             int y = (key.position.y0 + key.position.y1) / 2;
             // Reverse Y axis as keyboard layout uses top<down
             x = accuracy * (x - bounds.x0) / (bounds.x1 - bounds.x0);
-            y = accuracy - accuracy * (y - bounds.x0) / (bounds.x1 - bounds.x0);
+            y = accuracy - accuracy * (y - bounds.y0) / (bounds.y1 - bounds.y0);
             auto val = (freqX * x + freqY * y) / accuracy % accuracy;
             if (val < 0) { val += accuracy; }
-            return val;
+            return Gradient::phase_type(val);
         };
 
-        if (m_keys) {
-            std::transform(m_keys->begin(), m_keys->end(),
-                           std::back_inserter(m_phases), keyPhase);
+        if (keys) {
+            for (const auto & key : *keys) { m_gradient.setPhase(key.index, keyPhase(key)); }
         } else {
-            std::transform(keyDB.begin(), keyDB.end(),
-                           std::back_inserter(m_phases), keyPhase);
-        }
-    }
-
-    static std::vector<RGBAColor> generateColorTable(const std::vector<RGBAColor> & colors)
-    {
-        std::vector<RGBAColor> table(accuracy);
-
-        for (std::vector<RGBAColor>::size_type range = 0; range < colors.size(); ++range) {
-            auto first = range * table.size() / colors.size();
-            auto last = (range + 1) * table.size() / colors.size();
-            auto colorA = colors[range];
-            auto colorB = colors[range + 1 >= colors.size() ? 0 : range + 1];
-
-            for (std::vector<RGBAColor>::size_type idx = first; idx < last; ++idx) {
-                float ratio = float(idx - first) / float(last - first);
-
-                table[idx] = RGBAColor{
-                    RGBAColor::channel_type(colorA.red * (1.0f - ratio) + colorB.red * ratio),
-                    RGBAColor::channel_type(colorA.green * (1.0f - ratio) + colorB.green * ratio),
-                    RGBAColor::channel_type(colorA.blue * (1.0f - ratio) + colorB.blue * ratio),
-                    RGBAColor::channel_type(colorA.alpha * (1.0f - ratio) + colorB.alpha * ratio),
-                };
-            }
+            for (const auto & key : keyDB) { m_gradient.setPhase(key.index, keyPhase(key)); }
         }
-        return table;
     }
 
 private:
-    RenderTarget *          m_buffer;   ///< this plugin's rendered state
-    const KeyGroup *        m_keys;     ///< what keys the effect applies to. Empty for whole keyboard.
-    std::vector<unsigned>   m_phases;   ///< one per key in m_keys or one per key in m_buffer.
-                                        ///< From 0 (no phase shift) to 1000 (2*pi shift)
-    std::vector<RGBAColor>  m_colors;   ///< pre-computed color samples, build by generateColorTable.
+    RenderTarget *      m_buffer;       ///< this plugin's rendered state
+    Gradient            m_gradient;     ///< per-key phases into pre-computed color samples.
+                                        ///< Keys outside configured group are disabled.
 
     unsigned            m_time;         ///< time in milliseconds since beginning of current cycle.
     unsigned            m_period;       ///< total duration of a cycle in milliseconds.
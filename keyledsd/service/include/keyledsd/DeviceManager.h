@@ -18,10 +18,13 @@
 #define KEYLEDSD_DEVICEMANAGER_H_0517383B
 
 #include <QObject>
+#include <QTimer>
+#include <cstddef>
 #include "keyledsd/Configuration.h"
 #include "keyledsd/Device.h"
 #include "keyledsd/EffectManager.h"
 #include "keyledsd/KeyDatabase.h"
+#include "keyledsd/ProfileMatcher.h"
 #include "keyledsd/RenderLoop.h"
 #include "tools/FileWatcher.h"
 #include <memory>
@@ -29,20 +32,34 @@
 #include <utility>
 #include <vector>
 
+class QSocketNotifier;
 namespace device { class Description; }
 
 namespace keyleds {
 
 class LayoutDescription;
+namespace effect { class EffectService; }
 
 /****************************************************************************/
 
 /** Main device manager
  *
  * Centralizes all operations and information for a specific device.
- * It is given a device instance to manage and a reference to current
- * configuration at creation time, and coordinates feature detection,
- * layout management, and related objects' life cycle.
+ * It is given a device instance to manage, its key database and a reference
+ * to current configuration at creation time, and coordinates feature
+ * detection, layout management, and related objects' life cycle.
+ *
+ * If configuration asks for it, effect groups of likely profiles are loaded
+ * ahead of use, one at a time whenever the event loop is idle, so first switch
+ * to a profile does not stall on effect creation. Profiles are ranked by most
+ * recent use, then by configuration order.
+ *
+ * Loaded effect groups are kept for instant switching. If configuration sets
+ * a memory budget, least recently used groups are dropped when over budget.
+ *
+ * Events the device sends on its own are read when its event descriptor
+ * becomes readable. They make the render loop send all colors again, and are
+ * passed to active effects as generic events with event=device.
  */
 class DeviceManager final : public QObject
 {
@@ -54,22 +71,31 @@ private:
     /** An effect group, fully loaded with effects
      *
      * Holds a list of loaded effects to include while rendering device status
-     * and the matching effect is enabled.
+     * and the matching effect is enabled, along with bookkeeping for the
+     * effect group cache.
      */
     class EffectGroup final
     {
         using effect_list = std::vector<EffectManager::effect_ptr>;
+        using service_list = std::vector<const effect::EffectService *>;
     public:
-                            EffectGroup(std::string name, effect_list && effects);
+                            EffectGroup(std::string name, effect_list && effects, service_list services);
                             EffectGroup(EffectGroup &&) noexcept = default;
                             ~EffectGroup();
         EffectGroup &       operator=(EffectGroup &&) = default;
 
         const std::string & name() const noexcept { return m_name; }
         const effect_list & effects() const { return m_effects; }
+        unsigned long       lastUse() const noexcept { return m_lastUse; }
+        void                setLastUse(unsigned long tick) noexcept { m_lastUse = tick; }
+
+        /// Estimates memory held by effects and their buffers, in bytes
+        std::size_t         memoryUsage() const;
     private:
         std::string         m_name;
         effect_list         m_effects;
+        service_list        m_services;     ///< Services of m_effects, owned by their deleters
+        unsigned long       m_lastUse;      ///< Tick of last activation, 0 if never active
     };
     using effect_group_list = std::vector<EffectGroup>;
 
@@ -79,6 +105,15 @@ public:
                             DeviceManager(EffectManager &, FileWatcher &,
                                           const ::device::Description &,
                                           std::unique_ptr<Device>,
+                                          KeyDatabase,
+                                          const Configuration *,
+                                          QObject *parent = nullptr);
+    /// Manages a device that udev does not know about, such as a simulator socket.
+    /// It has no event devices, and its serial number is queried from the device.
+                            DeviceManager(EffectManager &, FileWatcher &,
+                                          const std::string & devNode,
+                                          std::unique_ptr<Device>,
+                                          KeyDatabase,
                                           const Configuration *,
                                           QObject *parent = nullptr);
                             ~DeviceManager() override;
@@ -94,6 +129,11 @@ public:
 
           bool              paused() const { return m_renderLoop.paused(); }
 
+    /// Estimates memory held by loaded effect groups, in bytes
+    std::size_t             memoryUsage();
+    /// Maximum memory loaded effect groups may hold before eviction, in bytes, 0 if unlimited
+    std::size_t             memoryBudget() const;
+
 public:
     void                    setConfiguration(const Configuration *);
     void                    setContext(const string_map &);
@@ -102,23 +142,48 @@ public:
     void                    handleKeyEvent(int, bool);
     void                    setPaused(bool);
 
+    /// Loads device layout, patches missing keys and builds the key database.
+    /// Blocking, but safe to invoke from any thread before creating the manager.
+    static KeyDatabase      setupKeyDatabase(Device &);
+
 private:
+                            DeviceManager(EffectManager &, FileWatcher &,
+                                          const std::string & devNode,
+                                          std::string sysPath, std::string serial, dev_list,
+                                          std::unique_ptr<Device> &&,
+                                          KeyDatabase,
+                                          const Configuration *,
+                                          QObject *parent);
+
     // Static loaders, invoked once at manager creation to set it up
     static std::string      getSerial(const ::device::Description &);
     static std::string      getName(const Configuration &, const std::string & serial);
     static dev_list         findEventDevices(const ::device::Description &);
-    static KeyDatabase      setupKeyDatabase(Device &);
     static KeyDatabase      buildKeyDatabase(const Device &, const LayoutDescription &);
 
-    /// Loads the list of effects to activate for the given context
-    std::vector<Effect *>   loadEffects(const string_map & context);
+    /// Loads the list of effects to activate for the given profile selection
+    std::vector<Effect *>   loadEffects(const ProfileMatcher::Selection *);
 
     /// Instanciates an effect, combining its configuration with this device's info
     EffectGroup &           getEffectGroup(const Configuration::EffectGroup &);
 
+    /// Queues effect groups of likely profiles for loading ahead of use
+    void                    schedulePrewarm();
+    /// Loads next queued effect group, invoked by m_prewarmTimer
+    void                    prewarmNext();
+    /// Drops least recently used inactive effect groups until within memory budget.
+    /// Returns whether usage is within budget.
+    bool                    enforceBudget();
+
+    /// Reads pending device events, invoked by m_eventNotifier
+    void                    readDeviceEvents();
+    /// Reacts to an event the device sent on its own
+    void                    handleDeviceEvent(const Device::Event &);
+
 private:
     EffectManager &         m_effectManager;    ///< Manages the lifecycle of effects
     const Configuration *   m_configuration;    ///< Reference to service configuration
+    ProfileMatcher          m_profileMatcher;   ///< Selects profile from context, built from m_configuration
 
     const std::string       m_sysPath;          ///< Device path on sys filesystem
     const std::string       m_serial;           ///< Device serial number
@@ -126,12 +191,20 @@ private:
     const dev_list          m_eventDevices;     ///< List of event device paths that the
                                                 ///  physical device can communicate on.
     std::unique_ptr<Device> m_device;           ///< The device handled by this manager
+    std::unique_ptr<QSocketNotifier> m_eventNotifier; ///< Watches device event descriptor
     FileWatcher::subscription m_fileWatcherSub; ///< Ensures we get notifications for devnode events
     const KeyDatabase       m_keyDB;            ///< Fully loaded key descriptions
 
     effect_group_list       m_effectGroups;     ///< Loaded effect group instances
     RenderLoop              m_renderLoop;       ///< The RenderLoop in charge of the device
     std::vector<Effect *>   m_activeEffects;    ///< Effects currently active on m_renderLoop
+    const ProfileMatcher::Selection * m_selection; ///< Profile selection m_activeEffects come from
+    bool                    m_hasSelection;     ///< Whether m_selection is valid, it may be null
+    unsigned long           m_useTick;          ///< Incremented on every profile switch, for LRU
+
+    std::vector<std::string> m_recentProfiles;  ///< Names of selected profiles, most recent first
+    std::vector<const Configuration::EffectGroup *> m_prewarmQueue; ///< Effect groups to load, last first
+    QTimer                  m_prewarmTimer;     ///< Runs prewarmNext when event loop is idle
 };
 
 /****************************************************************************/
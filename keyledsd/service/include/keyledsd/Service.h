@@ -18,10 +18,14 @@
 #define KEYLEDSD_KEYLEDSSERVICE_884F711D
 
 #include <QObject>
+#include <QThreadPool>
+#include <QTimer>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "keyledsd/Device.h"
+#include "keyledsd/KeyDatabase.h"
 #include "keyledsd/device/Logitech.h"
 #include "tools/DeviceWatcher.h"
 #include "tools/FileWatcher.h"
@@ -42,6 +46,13 @@ class EffectManager;
  * Only one instance typically exists per run. It ties all other objects
  * together, notably managing event watchers and device managers, and
  * passing messages around.
+ *
+ * New devices are opened on a thread pool, so several devices can come up
+ * concurrently without blocking the event loop. Once a device is probed,
+ * its manager is created back on the service's thread.
+ *
+ * Context changes are coalesced: they are merged as they come, and applied
+ * to devices at most once per settle window, as set by configuration.
  */
 class Service final : public QObject
 {
@@ -52,6 +63,17 @@ class Service final : public QObject
 
     using device_list = std::vector<std::unique_ptr<DeviceManager>>;
     using display_list = std::vector<std::unique_ptr<DisplayManager>>;
+
+    class DeviceProbe;
+    /// A device being probed, or done probing and waiting for its manager
+    struct ProbedDevice {
+        unsigned                id;             ///< Unique probe identifier
+        std::unique_ptr<::device::Description> description; ///< Only used from service thread
+        std::unique_ptr<Device> device;         ///< Opened device, null until done or on failure
+        std::unique_ptr<KeyDatabase> keyDB;     ///< Key database built for device
+        std::string             devNode;        ///< Device path, when description is null
+    };
+    using probe_list = std::vector<ProbedDevice>;
 public:
                         Service(EffectManager &,
                                 std::unique_ptr<Configuration>, QObject *parent = nullptr);
@@ -73,6 +95,8 @@ public:
     void                setContext(const string_map &);
     void                handleGenericEvent(const string_map &);
     void                handleKeyEvent(const std::string &, int, bool);
+    /// Opens a device that udev does not report, such as a simulator socket
+    void                attachDevice(const std::string & devNode);
 
 signals:
     /// Fires whenever a device is added - whether it is in devices list is undefined
@@ -87,16 +111,28 @@ private:
     void                onDeviceRemoved(const ::device::Description &);
     void                onDisplayAdded(std::unique_ptr<xlib::Display> &);
     void                onDisplayRemoved();
+    Q_INVOKABLE void    onDeviceProbed();
+
+    /// Pushes current context to devices, unless it is what they already have
+    void                deliverContext(bool force);
 private:
     EffectManager &     m_effectManager;    ///< Controls lifecycle of effects (injected)
     std::unique_ptr<Configuration> m_configuration;
     bool                m_autoQuit;         ///< Quit when last device is removed?
 
     string_map          m_context;          ///< Current context. Used when instanciating new managers
+    string_map          m_deliveredContext; ///< Context devices were last given
+    QTimer              m_contextTimer;     ///< Runs settle window of context changes
     bool                m_active;           ///< If clear, the service stops watching devices
     device_list         m_devices;          ///< Map of serial number to DeviceManager instances
     display_list        m_displays;         ///< Connections to X displays
 
+    QThreadPool         m_probePool;        ///< Runs device probes off the event loop
+    unsigned            m_nextProbeId;      ///< Identifier for next device probe
+    probe_list          m_probing;          ///< Devices being probed, only used from service thread
+    std::mutex          m_probedLock;       ///< Protects m_probed
+    probe_list          m_probed;           ///< Probed devices waiting for hand-off to service thread
+
     DeviceWatcher       m_deviceWatcher;    ///< Connection to libudev
     FileWatcher         m_fileWatcher;      ///< Connection to inotify
     FileWatcher::subscription m_fileWatcherSub; ///< Notifications for conf change
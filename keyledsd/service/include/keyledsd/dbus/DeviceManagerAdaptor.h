@@ -60,6 +60,8 @@ class DeviceManagerAdaptor final : public QDBusAbstractAdaptor
     Q_PROPERTY(QString firmware READ firmware)
     Q_PROPERTY(DBusDeviceKeyInfoList keys READ keys)
     Q_PROPERTY(bool paused READ paused WRITE setPaused)
+    Q_PROPERTY(qulonglong memoryUsage READ memoryUsage)
+    Q_PROPERTY(qulonglong memoryBudget READ memoryBudget)
 public:
                 DeviceManagerAdaptor(DeviceManager *parent);
 
@@ -74,6 +76,8 @@ public:         // Simple pass-through methods accessing the DeviceManager
     DBusDeviceKeyInfoList keys() const;
     bool        paused() const;
     void        setPaused(bool val);
+    qulonglong  memoryUsage() const;
+    qulonglong  memoryBudget() const;
 
 private:
     DeviceManager * parent() const;    ///< instance this adapter is attached to
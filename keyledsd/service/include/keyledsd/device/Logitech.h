@@ -29,6 +29,7 @@
 
 struct keyleds_device;
 struct keyleds_key_color;
+struct keyleds_notification;
 
 namespace std {
     template <> struct default_delete<struct keyleds_device> {
@@ -44,7 +45,8 @@ namespace keyleds { namespace device {
  *
  * Handles communication with the underlying device. This class is built as a
  * wrapper around libkeyleds, with additional checks and caching. It also
- * converts library errors into exceptions.
+ * converts library errors into exceptions. As libkeyleds serializes requests,
+ * device methods may be invoked from any thread, concurrently with rendering.
  */
 class Logitech final : public Device
 {
@@ -81,6 +83,7 @@ public:
     bool            hasLayout() const override;
     std::string     resolveKey(key_block_id_type, key_id_type) const override;
     int             decodeKeyId(key_block_id_type, key_id_type) const override;
+    int             eventFd() override;
 
     // Manipulate
     void            setTimeout(unsigned us) override;
@@ -97,6 +100,8 @@ private:
     static block_list   getBlocks(struct keyleds_device *);
     static void         parseVersion(struct keyleds_device *, std::string * model,
                                      std::string * serial, std::string * firmware);
+    static void         onNotification(struct keyleds_device *,
+                                       const struct keyleds_notification *, void *);
 
 private:
     std::unique_ptr<struct keyleds_device> m_device;    ///< Underlying libkeyleds opaque handle
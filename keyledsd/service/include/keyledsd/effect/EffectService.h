@@ -54,9 +54,14 @@ public:
 
     void                log(unsigned, const char * msg) override;
 
+    std::string         findFile(const std::string &) const override;
+
+    /// Memory held by render targets created through this service, in bytes
+    std::size_t         memoryUsage() const;
+
 private:
     const DeviceManager &                       m_manager;
-    const Configuration::Effect &               m_configuration;
+    const Configuration::Effect                 m_configuration;    ///< Copied, so effect can outlive a reload
     const std::vector<KeyGroup>                 m_keyGroups;
     std::vector<std::unique_ptr<RenderTarget>>  m_renderTargets;
     std::string                                 m_fileData;
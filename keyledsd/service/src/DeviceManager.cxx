@@ -16,10 +16,12 @@
  */
 #include "keyledsd/DeviceManager.h"
 
+#include <QSocketNotifier>
 #include <unistd.h>
 #include <algorithm>
 #include <cassert>
 #include <iomanip>
+#include <numeric>
 #include <sstream>
 #include "keyledsd/device/Logitech.h"
 #include "keyledsd/effect/EffectService.h"
@@ -32,47 +34,88 @@ LOGGING("dev-manager");
 
 using keyleds::DeviceManager;
 
-static constexpr char defaultProfileName[] = "__default__";
-static constexpr char overlayProfileName[] = "__overlay__";
-
 /****************************************************************************/
 
 static std::string layoutName(const keyleds::Device & device)
 {
     std::ostringstream fileNameBuf;
     fileNameBuf.fill('0');
-    fileNameBuf <<device.model() <<'_' <<std::hex <<std::setw(4) <<device.layout() <<".xml";
+    fileNameBuf <<device.model() <<'_' <<std::hex <<std::setw(4) <<device.layout();
     return fileNameBuf.str();
 }
 
 /****************************************************************************/
 
-DeviceManager::EffectGroup::EffectGroup(std::string name, effect_list && effects)
+DeviceManager::EffectGroup::EffectGroup(std::string name, effect_list && effects,
+                                        service_list services)
  : m_name(std::move(name)),
-   m_effects(std::move(effects))
+   m_effects(std::move(effects)),
+   m_services(std::move(services)),
+   m_lastUse(0)
 {}
 
 DeviceManager::EffectGroup::~EffectGroup() {}
 
+std::size_t DeviceManager::EffectGroup::memoryUsage() const
+{
+    std::size_t total = 0;
+    for (const auto & effect : m_effects) { total += effect->memoryUsage(); }
+    for (const auto * service : m_services) { total += service->memoryUsage(); }
+    return total;
+}
+
 /****************************************************************************/
 
 DeviceManager::DeviceManager(EffectManager & effectManager, FileWatcher & fileWatcher,
                              const ::device::Description & description, std::unique_ptr<Device> device,
-                             const Configuration * conf, QObject *parent)
+                             KeyDatabase keyDB, const Configuration * conf, QObject *parent)
+    : DeviceManager(effectManager, fileWatcher, description.devNode(),
+                    description.sysPath(), getSerial(description), findEventDevices(description),
+                    std::move(device), std::move(keyDB), conf, parent)
+{}
+
+DeviceManager::DeviceManager(EffectManager & effectManager, FileWatcher & fileWatcher,
+                             const std::string & devNode, std::unique_ptr<Device> device,
+                             KeyDatabase keyDB, const Configuration * conf, QObject *parent)
+    : DeviceManager(effectManager, fileWatcher, devNode,
+                    devNode, device->serial(), dev_list(),
+                    std::move(device), std::move(keyDB), conf, parent)
+{}
+
+DeviceManager::DeviceManager(EffectManager & effectManager, FileWatcher & fileWatcher,
+                             const std::string & devNode,
+                             std::string sysPath, std::string serial, dev_list eventDevices,
+                             std::unique_ptr<Device> && device,
+                             KeyDatabase keyDB, const Configuration * conf, QObject *parent)
     : QObject(parent),
       m_effectManager(effectManager),
       m_configuration(nullptr),
-      m_sysPath(description.sysPath()),
-      m_serial(getSerial(description)),
-      m_eventDevices(findEventDevices(description)),
+      m_sysPath(std::move(sysPath)),
+      m_serial(std::move(serial)),
+      m_eventDevices(std::move(eventDevices)),
       m_device(std::move(device)),
-      m_fileWatcherSub(fileWatcher.subscribe(description.devNode(), FileWatcher::event::Attrib,
+      m_fileWatcherSub(fileWatcher.subscribe(devNode, FileWatcher::event::Attrib,
                                              std::bind(&DeviceManager::handleFileEvent, this,
                                                        std::placeholders::_1, std::placeholders::_2,
                                                        std::placeholders::_3))),
-      m_keyDB(setupKeyDatabase(*m_device)),
-      m_renderLoop(*m_device, KEYLEDSD_RENDER_FPS)
+      m_keyDB(std::move(keyDB)),
+      m_renderLoop(*m_device, KEYLEDSD_RENDER_FPS),
+      m_selection(nullptr),
+      m_hasSelection(false),
+      m_useTick(0)
 {
+    QObject::connect(&m_prewarmTimer, &QTimer::timeout, this, &DeviceManager::prewarmNext);
+
+    m_device->setEventHandler([this](const Device::Event & event) { handleDeviceEvent(event); });
+    const int eventFd = m_device->eventFd();
+    if (eventFd >= 0) {
+        m_eventNotifier = std::make_unique<QSocketNotifier>(eventFd, QSocketNotifier::Read);
+        QObject::connect(m_eventNotifier.get(), &QSocketNotifier::activated,
+                         this, &DeviceManager::readDeviceEvents);
+    } else {
+        WARNING("cannot watch events of device ", m_serial);
+    }
+
     setConfiguration(conf);
     m_renderLoop.start();
 }
@@ -80,25 +123,76 @@ DeviceManager::DeviceManager(EffectManager & effectManager, FileWatcher & fileWa
 DeviceManager::~DeviceManager()
 {
     m_renderLoop.stop();            // destroying the loop is UB if the thread is still running
+    m_eventNotifier.reset();        // stop watching before the device closes its descriptor
 }
 
+/// Switches to a new configuration. Previous configuration must still be alive,
+/// it is compared against the new one to keep effect groups that did not change,
+/// along with their running state.
 void DeviceManager::setConfiguration(const Configuration * conf)
 {
     assert(conf != nullptr);
     auto lock = m_renderLoop.lock();
 
     m_renderLoop.renderers().clear();
-    m_effectGroups.clear();
     m_activeEffects.clear();
+    m_hasSelection = false;
+
+    auto name = getName(*conf, m_serial);
+    if (m_configuration == nullptr || name != m_name ||
+        conf->keyGroups() != m_configuration->keyGroups()) {
+        // Device name and global key groups are seen by all effect groups
+        m_effectGroups.clear();
+    } else {
+        auto findConf = [](const Configuration & config, const std::string & groupName) {
+            auto it = std::find_if(config.effectGroups().begin(), config.effectGroups().end(),
+                                   [&groupName](const auto & group) { return group.name() == groupName; });
+            return it != config.effectGroups().end() ? &*it : nullptr;
+        };
+        auto before = m_effectGroups.size();
+        m_effectGroups.erase(
+            std::remove_if(m_effectGroups.begin(), m_effectGroups.end(),
+                           [&](const auto & group) {
+                               const auto * oldConf = findConf(*m_configuration, group.name());
+                               const auto * newConf = findConf(*conf, group.name());
+                               return oldConf == nullptr || newConf == nullptr || *oldConf != *newConf;
+                           }),
+            m_effectGroups.end()
+        );
+        VERBOSE("configuration reload keeps ", m_effectGroups.size(), " of ", before, " effect groups");
+    }
 
     m_configuration = conf;
-    m_name = getName(*conf, m_serial);
+    m_name = std::move(name);
+    m_profileMatcher = ProfileMatcher(*conf, m_name);
+    schedulePrewarm();
 }
 
 
 void DeviceManager::setContext(const string_map & context)
 {
-    m_activeEffects = loadEffects(context);
+    const auto * selection = m_profileMatcher.match(context);
+    if (m_hasSelection && selection == m_selection) {
+        // Same profile as before, active effects only need to see the change
+        auto lock = m_renderLoop.lock();
+        for (auto * effect : m_activeEffects) {
+            effect->handleContextChange(context);
+        }
+        return;
+    }
+    m_selection = selection;
+    m_hasSelection = true;
+    if (selection != nullptr) {
+        const auto & name = selection->profile->name();
+        auto it = std::find(m_recentProfiles.begin(), m_recentProfiles.end(), name);
+        if (it == m_recentProfiles.end()) {
+            m_recentProfiles.insert(m_recentProfiles.begin(), name);
+        } else {
+            std::rotate(m_recentProfiles.begin(), it, it + 1);
+        }
+    }
+
+    m_activeEffects = loadEffects(selection);
     DEBUG("enabling ", m_activeEffects.size(), " effects for loop ", &m_renderLoop);
 
     // Notify newly-active effects of context change
@@ -112,6 +206,9 @@ void DeviceManager::setContext(const string_map & context)
     std::transform(m_activeEffects.begin(), m_activeEffects.end(), std::back_inserter(renderers),
                    [](const auto & effect) { return effect->renderer(); });
     m_renderLoop.renderers() = std::move(renderers);
+    lock.unlock();
+
+    enforceBudget();
 }
 
 void DeviceManager::handleFileEvent(FileWatcher::event, uint32_t, std::string)
@@ -144,6 +241,36 @@ void DeviceManager::handleKeyEvent(int keyCode, bool press)
 void DeviceManager::setPaused(bool val)
 {
     m_renderLoop.setPaused(val);
+    if (m_eventNotifier) { m_eventNotifier->setEnabled(!val); }
+}
+
+void DeviceManager::readDeviceEvents()
+{
+    try {
+        m_device->flush();
+    } catch (Device::error & error) {
+        // Descriptor stays readable on errors, stop watching until device is resumed
+        if (!error.expected()) { WARNING("reading events of device ", m_serial, ": ", error.what()); }
+        m_eventNotifier->setEnabled(false);
+    }
+}
+
+void DeviceManager::handleDeviceEvent(const Device::Event & event)
+{
+    std::ostringstream feature;
+    feature <<std::hex <<std::setfill('0') <<std::setw(4) <<event.feature;
+    DEBUG("event from device ", m_serial, " feature ", feature.str(),
+          " function ", unsigned(event.function));
+
+    // Events such as waking up or switching onboard profiles may have changed
+    // what the device displays behind our back
+    m_renderLoop.refresh();
+
+    handleGenericEvent({
+        { "event", "device" },
+        { "feature", feature.str() },
+        { "function", std::to_string(event.function) }
+    });
 }
 
 std::string DeviceManager::getSerial(const ::device::Description & description)
@@ -194,11 +321,15 @@ keyleds::KeyDatabase DeviceManager::setupKeyDatabase(Device & device)
     // Some keyboards do not report all keys, look for missing keys and patch device
     for (const auto & block : device.blocks()) {
         std::vector<Device::key_id_type> keyIds;
-
-        for (const auto & key : layout.keys()) {
-            if (key.block != block.id()) { continue; }
-            if (std::find(block.keys().begin(), block.keys().end(), key.code) == block.keys().end()) {
-                keyIds.push_back(key.code);
+        std::vector<Device::key_id_type> blockKeys = block.keys();
+        std::sort(blockKeys.begin(), blockKeys.end());
+
+        // Layout keys are sorted by block then code, so this block's keys are contiguous
+        auto first = std::lower_bound(layout.keys().begin(), layout.keys().end(), block.id(),
+                                      [](const auto & key, auto id) { return key.block < id; });
+        for (auto it = first; it != layout.keys().end() && it->block == block.id(); ++it) {
+            if (!std::binary_search(blockKeys.begin(), blockKeys.end(), it->code)) {
+                keyIds.push_back(it->code);
             }
         }
         if (!keyIds.empty()) {
@@ -220,17 +351,15 @@ keyleds::KeyDatabase DeviceManager::buildKeyDatabase(const Device & device, cons
             std::string name;
             auto position = KeyDatabase::Key::Rect{0, 0, 0, 0};
 
-            for (const auto & key : layout.keys()) {
-                if (key.block == block.id() && key.code == keyId) {
-                    name = key.name;
-                    position = {
-                        KeyDatabase::position_type(key.position.x0),
-                        KeyDatabase::position_type(key.position.y0),
-                        KeyDatabase::position_type(key.position.x1),
-                        KeyDatabase::position_type(key.position.y1)
-                    };
-                    break;
-                }
+            const auto * key = layout.find(block.id(), keyId);
+            if (key != nullptr) {
+                name = key->name;
+                position = {
+                    KeyDatabase::position_type(key->position.x0),
+                    KeyDatabase::position_type(key->position.y0),
+                    KeyDatabase::position_type(key->position.x1),
+                    KeyDatabase::position_type(key->position.y1)
+                };
             }
             if (name.empty()) { name = device.resolveKey(block.id(), keyId); }
 
@@ -246,69 +375,24 @@ keyleds::KeyDatabase DeviceManager::buildKeyDatabase(const Device & device, cons
     return db;
 }
 
-/// Applies the configuration to a string_map, matching profiles and resolving
-/// effect names. Returns the list of Effect entries in the configuration that
-/// should be loaded for the context. Returned list references Configuration
-/// entries directly, and are therefore invalidated by any operation that
-/// invalidates configuration's iterators.
-std::vector<keyleds::effect::interface::Effect *> DeviceManager::loadEffects(const string_map & context)
+/// Loads effect groups of a profile selection. Returns the list of Effect
+/// entries in the configuration that should be loaded for the context.
+/// Returned list references Configuration entries directly, and are therefore
+/// invalidated by any operation that invalidates configuration's iterators.
+std::vector<keyleds::effect::interface::Effect *>
+DeviceManager::loadEffects(const ProfileMatcher::Selection * selection)
 {
-    // Match context against profile lookups
-    const Configuration::Profile * profile = nullptr;
-    const Configuration::Profile * defaultProfile = nullptr;
-    const Configuration::Profile * overlayProfile = nullptr;
-
-    for (const auto & profileEntry : m_configuration->profiles()) {
-        const auto & devices = profileEntry.devices();
-        if (!devices.empty() && std::find(devices.begin(), devices.end(), m_name) == devices.end())
-            continue;
-        if (profileEntry.name() == defaultProfileName) {
-            defaultProfile = &profileEntry;
-        } else if (profileEntry.name() == overlayProfileName) {
-            overlayProfile = &profileEntry;
-        } else if (profileEntry.lookup().match(context)) {
-            DEBUG("profile matches: ", profileEntry.name());
-            profile = &profileEntry;
-        }
-    }
-    if (!profile) {
-        if (!defaultProfile) {
-            ERROR("no profile matches and no default profile defined");
-            return {};
-        }
-        profile = defaultProfile;
-    }
-    VERBOSE("selected profile <", profile->name(), ">");
-
-    // Collect effect names from selected profile and resolve them
-    std::vector<const Configuration::EffectGroup *> effectGroups;
-
-    for (const auto & name : profile->effectGroups()) {
-        auto eit = std::find_if(m_configuration->effectGroups().begin(),
-                                m_configuration->effectGroups().end(),
-                                [&name](auto & group) { return group.name() == name; });
-        if (eit == m_configuration->effectGroups().end()) {
-            ERROR("profile <", profile->name(), "> references unknown effect group <", name, ">");
-            continue;
-        }
-        effectGroups.push_back(&*eit);
-    }
-    if (overlayProfile != nullptr) {
-        for (const auto & name : overlayProfile->effectGroups()) {
-            auto eit = std::find_if(m_configuration->effectGroups().begin(),
-                                    m_configuration->effectGroups().end(),
-                                    [&name](auto & group) { return group.name() == name; });
-            if (eit == m_configuration->effectGroups().end()) {
-                ERROR("profile <", profile->name(), "> references unknown effect group <", name, ">");
-                continue;
-            }
-            effectGroups.push_back(&*eit);
-        }
+    if (selection == nullptr) {
+        ERROR("no profile matches and no default profile defined");
+        return {};
     }
+    VERBOSE("selected profile <", selection->profile->name(), ">");
 
+    ++m_useTick;
     std::vector<Effect *> effectPtrs;
-    for (const auto & effectGroup : effectGroups) {
-        const auto & loadedEffectGroup = getEffectGroup(*effectGroup);
+    for (const auto * effectGroup : selection->effectGroups) {
+        auto & loadedEffectGroup = getEffectGroup(*effectGroup);
+        loadedEffectGroup.setLastUse(m_useTick);
         const auto & effects = loadedEffectGroup.effects();
         std::transform(effects.begin(), effects.end(), std::back_inserter(effectPtrs),
                        [](const auto & ptr) { return ptr.get(); });
@@ -337,19 +421,129 @@ DeviceManager::EffectGroup & DeviceManager::getEffectGroup(const Configuration::
 
     // Load effects
     std::vector<EffectManager::effect_ptr> effects;
+    std::vector<const effect::EffectService *> services;
     for (const auto & effectConf : conf.effects()) {
-        auto effect = m_effectManager.createEffect(
-            effectConf.name(), std::make_unique<effect::EffectService>(*this, effectConf, keyGroups)
-        );
+        auto service = std::make_unique<effect::EffectService>(*this, effectConf, keyGroups);
+        const auto * servicePtr = service.get();
+        auto effect = m_effectManager.createEffect(effectConf.name(), std::move(service));
         if (!effect) {
             ERROR("plugin for effect ", effectConf.name(), " not found");
             continue;
         }
         VERBOSE("loaded plugin effect ", effectConf.name());
         effects.emplace_back(std::move(effect));
+        services.push_back(servicePtr);
     }
 
-    eit = m_effectGroups.emplace(eit, conf.name(), std::move(effects));
+    eit = m_effectGroups.emplace(eit, conf.name(), std::move(effects), std::move(services));
     return *eit;
 }
 
+void DeviceManager::schedulePrewarm()
+{
+    m_prewarmQueue.clear();
+    m_prewarmTimer.stop();
+    if (m_configuration->prewarm() == 0) { return; }
+
+    // Rank profiles: recently used ones first, then in configuration order
+    const auto & selections = m_profileMatcher.selections();
+    std::vector<const ProfileMatcher::Selection *> ranked;
+    for (const auto & name : m_recentProfiles) {
+        auto it = std::find_if(selections.begin(), selections.end(),
+                               [&name](const auto & item) { return item.profile->name() == name; });
+        if (it != selections.end()) { ranked.push_back(&*it); }
+    }
+    for (const auto & selection : selections) {
+        if (std::find(ranked.begin(), ranked.end(), &selection) == ranked.end()) {
+            ranked.push_back(&selection);
+        }
+    }
+    if (ranked.size() > m_configuration->prewarm()) { ranked.resize(m_configuration->prewarm()); }
+
+    for (const auto * selection : ranked) {
+        for (const auto * group : selection->effectGroups) {
+            if (std::find(m_prewarmQueue.begin(), m_prewarmQueue.end(), group) == m_prewarmQueue.end()) {
+                m_prewarmQueue.push_back(group);
+            }
+        }
+    }
+    std::reverse(m_prewarmQueue.begin(), m_prewarmQueue.end());
+
+    if (!m_prewarmQueue.empty()) {
+        DEBUG("pre-warming ", m_prewarmQueue.size(), " effect groups from ", ranked.size(), " profiles");
+        m_prewarmTimer.start(0);
+    }
+}
+
+void DeviceManager::prewarmNext()
+{
+    if (m_prewarmQueue.empty()) {
+        m_prewarmTimer.stop();
+        return;
+    }
+    const auto * group = m_prewarmQueue.back();
+    m_prewarmQueue.pop_back();
+    getEffectGroup(*group);
+
+    if (!enforceBudget()) {
+        VERBOSE("memory budget reached, pre-warming stopped");
+        m_prewarmQueue.clear();
+        m_prewarmTimer.stop();
+    }
+}
+
+std::size_t DeviceManager::memoryUsage()
+{
+    auto lock = m_renderLoop.lock();    // effects may not be queried while rendering
+    std::size_t total = 0;
+    for (const auto & group : m_effectGroups) { total += group.memoryUsage(); }
+    return total;
+}
+
+std::size_t DeviceManager::memoryBudget() const
+{
+    return std::size_t(m_configuration->memoryBudget()) * 1024;
+}
+
+bool DeviceManager::enforceBudget()
+{
+    const auto budget = memoryBudget();
+    if (budget == 0) { return true; }
+
+    std::vector<std::size_t> usage;
+    usage.reserve(m_effectGroups.size());
+    {
+        auto lock = m_renderLoop.lock();    // effects may not be queried while rendering
+        std::transform(m_effectGroups.begin(), m_effectGroups.end(), std::back_inserter(usage),
+                       [](const auto & group) { return group.memoryUsage(); });
+    }
+    auto total = std::accumulate(usage.begin(), usage.end(), std::size_t(0));
+    if (total <= budget) { return true; }
+
+    // Candidates are groups not in use by current profile, least recently used first
+    std::vector<std::size_t> candidates;
+    for (std::size_t idx = 0; idx < m_effectGroups.size(); ++idx) {
+        if (!m_hasSelection || m_effectGroups[idx].lastUse() != m_useTick) {
+            candidates.push_back(idx);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [this](auto a, auto b) {
+        return m_effectGroups[a].lastUse() < m_effectGroups[b].lastUse();
+    });
+
+    std::vector<bool> evict(m_effectGroups.size(), false);
+    for (auto idx : candidates) {
+        if (total <= budget) { break; }
+        VERBOSE("evicting effect group ", m_effectGroups[idx].name(), ", ", usage[idx], " bytes");
+        evict[idx] = true;
+        total -= usage[idx];
+    }
+
+    std::size_t idx = 0;
+    m_effectGroups.erase(
+        std::remove_if(m_effectGroups.begin(), m_effectGroups.end(),
+                       [&evict, &idx](const auto &) { return evict[idx++]; }),
+        m_effectGroups.end()
+    );
+    return total <= budget;
+}
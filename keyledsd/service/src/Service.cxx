@@ -17,6 +17,7 @@
 #include "keyledsd/Service.h"
 
 #include <QCoreApplication>
+#include <QRunnable>
 #include <cassert>
 #include <functional>
 #include <sstream>
@@ -75,6 +76,53 @@ static std::string to_string(const std::vector<std::pair<std::string, std::strin
 
 /****************************************************************************/
 
+/** Device probe
+ *
+ * Opens a device and builds its key database on a pool thread. Both involve
+ * many blocking round trips to the device. The outcome is queued on the
+ * service, which is then told to pick it up from its own thread.
+ */
+class Service::DeviceProbe final : public QRunnable
+{
+public:
+    DeviceProbe(Service & service, unsigned id, std::string devNode)
+     : m_service(service), m_id(id), m_devNode(std::move(devNode)) {}
+
+    void run() override
+    {
+        ProbedDevice result = { m_id, nullptr, nullptr, nullptr };
+        try {
+            result.device = device::Logitech::open(m_devNode);
+            result.keyDB = std::make_unique<KeyDatabase>(
+                DeviceManager::setupKeyDatabase(*result.device)
+            );
+        } catch (Device::error & error) {
+            result.device = nullptr;
+            if (error.expected()) {
+                VERBOSE("not opening device ", m_devNode, ": ", error.what());
+            } else {
+                ERROR("not opening device ", m_devNode, ": ", error.what());
+            }
+        } catch (std::exception & error) {
+            result.device = nullptr;
+            ERROR("not opening device ", m_devNode, ": ", error.what());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_service.m_probedLock);
+            m_service.m_probed.push_back(std::move(result));
+        }
+        QMetaObject::invokeMethod(&m_service, "onDeviceProbed", Qt::QueuedConnection);
+    }
+
+private:
+    Service &           m_service;  ///< Service to hand the result to
+    const unsigned      m_id;       ///< Probe identifier, matching an entry in service's m_probing
+    const std::string   m_devNode;  ///< Device node to open
+};
+
+/****************************************************************************/
+
 Service::Service(EffectManager & effectManager,
                  std::unique_ptr<Configuration> configuration, QObject * parent)
     : QObject(parent),
@@ -82,12 +130,15 @@ Service::Service(EffectManager & effectManager,
       m_configuration(nullptr),
       m_autoQuit(false),
       m_active(false),
+      m_nextProbeId(0),
       m_deviceWatcher(nullptr)
 {
     QObject::connect(&m_deviceWatcher, &DeviceWatcher::deviceAdded,
                      this, &Service::onDeviceAdded);
     QObject::connect(&m_deviceWatcher, &DeviceWatcher::deviceRemoved,
                      this, &Service::onDeviceRemoved);
+    m_contextTimer.setSingleShot(true);
+    QObject::connect(&m_contextTimer, &QTimer::timeout, this, [this]() { deliverContext(false); });
     setConfiguration(std::move(configuration));
     DEBUG("created");
 }
@@ -95,6 +146,7 @@ Service::Service(EffectManager & effectManager,
 Service::~Service()
 {
     setActive(false);
+    m_probePool.waitForDone();      // probes reference this service
     m_devices.clear();
 }
 
@@ -123,7 +175,8 @@ void Service::setConfiguration(std::unique_ptr<Configuration> config)
 
     // Propagate configuration
     for (auto & device : m_devices) { device->setConfiguration(m_configuration.get()); }
-    setContext({}); // force context reloading without changing it
+    m_contextTimer.stop();
+    deliverContext(true);   // devices need a context to reload effects
 
     // Setup configuration file watch
     if (!m_configuration->path().empty()) {
@@ -149,8 +202,23 @@ void Service::setActive(bool active)
 void Service::setContext(const string_map & context)
 {
     merge(m_context, context);
+    if (m_configuration->contextDelay() == 0) {
+        deliverContext(false);
+    } else if (!m_contextTimer.isActive()) {
+        // Changes within the window are merged, and delivered when it closes
+        m_contextTimer.start(int(m_configuration->contextDelay()));
+    }
+}
+
+void Service::deliverContext(bool force)
+{
+    if (!force && m_context == m_deliveredContext) {
+        DEBUG("context unchanged, not delivering");
+        return;
+    }
     VERBOSE("setContext ", ::to_string(m_context));
     for (auto & device : m_devices) { device->setContext(m_context); }
+    m_deliveredContext = m_context;
 }
 
 void Service::handleGenericEvent(const string_map & context)
@@ -198,36 +266,82 @@ void Service::onConfigurationFileChanged(FileWatcher::event event)
 void Service::onDeviceAdded(const ::device::Description & description)
 {
     VERBOSE("device added: ", description.devNode());
-    try {
-        auto device = device::Logitech::open(description.devNode());
-        auto manager = std::make_unique<DeviceManager>(
-            m_effectManager, m_fileWatcher,
-            description, std::move(device), m_configuration.get()
-        );
-        manager->setContext(m_context);
-
-        emit deviceManagerAdded(*manager);
+    auto id = m_nextProbeId++;
+    m_probing.push_back({
+        id, std::make_unique<::device::Description>(description), nullptr, nullptr
+    });
+    m_probePool.start(new DeviceProbe(*this, id, description.devNode()));
+}
 
-        INFO("opened device ", description.devNode(),
-             " [", manager->name(), ']',
-             ", model ", manager->device().model(),
-             " firmware ", manager->device().firmware(),
-             ", <", manager->device().name(), ">");
+void Service::attachDevice(const std::string & devNode)
+{
+    VERBOSE("device attached: ", devNode);
+    auto id = m_nextProbeId++;
+    m_probing.push_back({ id, nullptr, nullptr, nullptr, devNode });
+    m_probePool.start(new DeviceProbe(*this, id, devNode));
+}
 
-        manager->setPaused(false);
-        m_devices.emplace_back(std::move(manager));
+void Service::onDeviceProbed()
+{
+    probe_list probed;
+    {
+        std::lock_guard<std::mutex> lock(m_probedLock);
+        std::swap(probed, m_probed);
+    }
 
-    } catch (Device::error & error) {
-        if (error.expected()) {
-            VERBOSE("not opening device ", description.devNode(), ": ", error.what());
-        } else {
-            ERROR("not opening device ", description.devNode(), ": ", error.what());
+    for (auto & result : probed) {
+        auto it = std::find_if(m_probing.begin(), m_probing.end(),
+                               [&result](const auto & item) { return item.id == result.id; });
+        if (it == m_probing.end()) { continue; }    // device was removed while being probed
+        auto description = std::move(it->description);
+        auto devNode = description != nullptr ? description->devNode() : it->devNode;
+        m_probing.erase(it);
+
+        if (result.device == nullptr) { continue; } // probe failed, it logged the reason
+        try {
+            auto manager = description != nullptr
+                ? std::make_unique<DeviceManager>(
+                    m_effectManager, m_fileWatcher, *description,
+                    std::move(result.device), std::move(*result.keyDB), m_configuration.get())
+                : std::make_unique<DeviceManager>(
+                    m_effectManager, m_fileWatcher, devNode,
+                    std::move(result.device), std::move(*result.keyDB), m_configuration.get());
+            manager->setContext(m_context);
+
+            emit deviceManagerAdded(*manager);
+
+            INFO("opened device ", devNode,
+                 " [", manager->name(), ']',
+                 ", model ", manager->device().model(),
+                 " firmware ", manager->device().firmware(),
+                 ", <", manager->device().name(), ">");
+
+            manager->setPaused(false);
+            m_devices.emplace_back(std::move(manager));
+
+        } catch (Device::error & error) {
+            if (error.expected()) {
+                VERBOSE("not opening device ", devNode, ": ", error.what());
+            } else {
+                ERROR("not opening device ", devNode, ": ", error.what());
+            }
         }
     }
 }
 
 void Service::onDeviceRemoved(const ::device::Description & description)
 {
+    auto pit = std::find_if(m_probing.begin(), m_probing.end(),
+                            [&description](const auto & item) {
+                                return item.description != nullptr &&
+                                       item.description->sysPath() == description.sysPath();
+                            });
+    if (pit != m_probing.end()) {
+        VERBOSE("device removed while being probed: ", description.sysPath());
+        m_probing.erase(pit);       // result will be discarded when probe completes
+        return;
+    }
+
     auto it = std::find_if(m_devices.begin(), m_devices.end(),
                            [&description](const auto & device) {
                                return device->sysPath() == description.sysPath();
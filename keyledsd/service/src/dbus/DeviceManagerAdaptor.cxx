@@ -138,3 +138,13 @@ void DeviceManagerAdaptor::setPaused(bool val)
 {
     parent()->setPaused(val);
 }
+
+qulonglong DeviceManagerAdaptor::memoryUsage() const
+{
+    return parent()->memoryUsage();
+}
+
+qulonglong DeviceManagerAdaptor::memoryBudget() const
+{
+    return parent()->memoryBudget();
+}
@@ -53,9 +53,14 @@ Logitech::Logitech(std::unique_ptr<struct keyleds_device> device,
  : Device(std::move(path), type, std::move(name), std::move(model), std::move(serial),
           std::move(firmware), layout, std::move(blocks)),
    m_device(std::move(device))
-{}
+{
+    keyleds_register_notification_handler(m_device.get(), &Logitech::onNotification, this);
+}
 
-Logitech::~Logitech() {}
+Logitech::~Logitech()
+{
+    keyleds_unregister_notification_handler(m_device.get(), &Logitech::onNotification, this);
+}
 
 std::unique_ptr<keyleds::Device> Logitech::open(const std::string & path)
 {
@@ -79,6 +84,15 @@ std::unique_ptr<keyleds::Device> Logitech::open(const std::string & path)
     ));
 }
 
+void Logitech::onNotification(struct keyleds_device *,
+                              const struct keyleds_notification * notification, void * data)
+{
+    auto & self = *static_cast<Logitech *>(data);
+    if (notification->app_id != 0) { return; }   // reply to another application
+    if (notification->error != 0) { return; }    // error reply to another application
+    self.notifyEvent({ notification->feature_id, notification->function });
+}
+
 /****************************************************************************/
 /****************************************************************************/
 
@@ -100,6 +114,11 @@ int Logitech::decodeKeyId(key_block_id_type blockId, key_id_type keyId) const
     return keyleds_translate_scancode(keyleds_block_id_t(blockId), keyId);
 }
 
+int Logitech::eventFd()
+{
+    return keyleds_event_fd(m_device.get());
+}
+
 /****************************************************************************/
 
 void Logitech::setTimeout(unsigned us)
@@ -112,6 +131,7 @@ void Logitech::flush()
     if (!keyleds_flush_fd(m_device.get())) {
         throw error(keyleds_get_error_str(), keyleds_get_errno());
     }
+    keyleds_dispatch_notifications(m_device.get());
 }
 
 bool Logitech::resync() noexcept
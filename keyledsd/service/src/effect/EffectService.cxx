@@ -102,7 +102,27 @@ const std::string & EffectService::getFile(const std::string & name)
     return m_fileData;
 }
 
+std::string EffectService::findFile(const std::string & name) const
+{
+    if (name.empty()) { return {}; }
+    std::ifstream file;
+    std::string actualPath;
+    tools::paths::open(file, tools::paths::XDG::Data, KEYLEDSD_DATA_PREFIX "/" + name,
+                       std::ios::binary, &actualPath);
+    if (!file) { return {}; }
+    return actualPath;
+}
+
 void EffectService::log(unsigned level, const char * msg)
 {
     l_logger.print(level, m_configuration.name() + ": " + msg);
 }
+
+std::size_t EffectService::memoryUsage() const
+{
+    std::size_t total = 0;
+    for (const auto & target : m_renderTargets) {
+        total += sizeof(*target) + target->capacity() * sizeof(RGBAColor);
+    }
+    return total;
+}
@@ -37,6 +37,7 @@
 #include "keyledsd/effect/StaticModuleRegistry.h"
 #include "keyledsd/Configuration.h"
 #include "keyledsd/Service.h"
+#include "tools/XWindow.h"
 #include "config.h"
 #include "logging.h"
 
@@ -50,6 +51,7 @@ using keyleds::Configuration;
 #ifdef _GNU_SOURCE
 static const struct option optionDescriptions[] = {
     {"config",      1, nullptr, 'c' },
+    {"device",      1, nullptr, 'd' },
     {"help",        0, nullptr, 'h' },
     {"module-path", 1, nullptr, 'm' },
     {"quiet",       0, nullptr, 'q' },
@@ -64,6 +66,7 @@ class Options final
 {
 public:
     const char *                configPath;
+    std::vector<std::string>    devicePaths;
     std::vector<std::string>    modulePaths;
     logging::level_t            logLevel;
     bool                        autoQuit;
@@ -82,19 +85,20 @@ public:
         std::ostringstream msgBuf;
         ::opterr = 0;
 #ifdef _GNU_SOURCE
-        while ((opt = ::getopt_long(argc, argv, ":c:hm:qsvD", optionDescriptions, nullptr)) >= 0) {
+        while ((opt = ::getopt_long(argc, argv, ":c:d:hm:qsvD", optionDescriptions, nullptr)) >= 0) {
 #else
-        while ((opt = ::getopt(argc, argv, ":c:hm:qsvD")) >= 0) {
+        while ((opt = ::getopt(argc, argv, ":c:d:hm:qsvD")) >= 0) {
 #endif
             switch(opt) {
             case 'c': options.configPath = optarg; break;
+            case 'd': options.devicePaths.push_back(optarg); break;
             case 'm': options.modulePaths.push_back(optarg); break;
             case 'q': options.logLevel = logging::critical::value; break;
             case 's': options.autoQuit = true; break;
             case 'v': options.logLevel += 1; break;
             case 'D': options.noDBus = true; break;
             case 'h':
-                std::cout <<"Usage: " <<argv[0] <<" [-c path] [-h] [-q] [-s] [-v] [-D]" <<std::endl;
+                std::cout <<"Usage: " <<argv[0] <<" [-c path] [-d device] [-h] [-q] [-s] [-v] [-D]" <<std::endl;
                 ::exit(EXIT_SUCCESS);
             case ':':
                 msgBuf <<argv[0] <<": option -- '" <<(char)::optopt <<"' requires an argument";
@@ -164,6 +168,8 @@ static void handleSignalEvent(const Options & options, keyleds::Service * servic
 
 int main(int argc, char * argv[])
 {
+    xlib::initThreads();    // before anything touches Xlib, plugins may use it from threads
+
     // Must be before app, so its destructor runs after, since Service holds a ref
     keyleds::EffectManager effectManager;
 
@@ -217,6 +223,7 @@ int main(int argc, char * argv[])
     auto service = new keyleds::Service(effectManager, std::move(configuration), &app);
     service->setAutoQuit(options.autoQuit);
     QTimer::singleShot(0, service, &keyleds::Service::init);
+    for (const auto & path : options.devicePaths) { service->attachDevice(path); }
 
 #ifndef NO_DBUS
     if (!options.noDBus) {
@@ -0,0 +1,81 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/****************************************************************************/
+/* Device model */
+
+#define SIM_BLOCK_NB    (16)    /* one per bit of the led feature block mask */
+
+struct sim_key {
+    uint8_t     id;
+    uint8_t     red;
+    uint8_t     green;
+    uint8_t     blue;
+};
+
+struct sim_block {
+    uint16_t    block_id;       /* 0 if block is not present */
+    unsigned    keys_nb;
+    struct sim_key keys[KEYLEDSSIM_MAX_KEYS];
+};
+
+struct sim_device {
+    /* Identity */
+    char        name[64];
+    uint8_t     model[6];
+    uint8_t     serial[4];
+    uint8_t     layout;
+
+    /* Features */
+    struct sim_block blocks[SIM_BLOCK_NB];
+    uint8_t     gamemode[KEYLEDSSIM_GAMEMODE_MAX];
+    unsigned    gamemode_nb;
+    uint8_t     reportrate;     /* in milliseconds */
+    unsigned    commits;        /* number of led commits received */
+};
+
+void sim_device_init(/*@out@*/ struct sim_device *);
+bool sim_device_add_key(struct sim_device *, uint16_t block_id, uint8_t key_id);
+
+/* Handle one request, building the reply into reply. Returns the size of the
+ * reply, or 0 if the request must be ignored. */
+size_t sim_device_handle(struct sim_device *, const uint8_t * request, size_t size,
+                         /*@out@*/ uint8_t * reply);
+size_t sim_device_error(const uint8_t * request, uint8_t code, /*@out@*/ uint8_t * reply);
+
+#define SIM_REPORT_SHORT        (0x10)
+#define SIM_REPORT_SHORT_SIZE   (7)
+#define SIM_REPORT_LONG         (0x11)
+#define SIM_REPORT_LONG_SIZE    (20)
+
+#define SIM_ERROR_BUSY          (8)
+
+extern const uint8_t sim_report_descriptor[];
+extern const unsigned sim_report_descriptor_size;
+
+/****************************************************************************/
+/* Layout loading */
+
+bool sim_load_layout(struct sim_device *, const char * path);
+
+#endif
@@ -0,0 +1,390 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "simulator.h"
+
+/* Two vendor-defined output reports: short (0x10, 6 bytes) and long (0x11,
+ * 19 bytes), as exposed by actual devices on their HID++ interface. */
+const uint8_t sim_report_descriptor[] = {
+    0x06, 0x00, 0xff,   /* usage page (vendor 0xff00) */
+    0x09, 0x01,         /* usage (1) */
+    0xa1, 0x01,         /* collection (application) */
+    0x85, SIM_REPORT_SHORT,
+    0x95, SIM_REPORT_SHORT_SIZE - 1,
+    0x75, 0x08,         /* report size (8) */
+    0x15, 0x00,         /* logical minimum (0) */
+    0x26, 0xff, 0x00,   /* logical maximum (255) */
+    0x09, 0x01, 0x81, 0x00,     /* input */
+    0x09, 0x01, 0x91, 0x00,     /* output */
+    0xc0,               /* end collection */
+    0x06, 0x00, 0xff,
+    0x09, 0x02,
+    0xa1, 0x01,
+    0x85, SIM_REPORT_LONG,
+    0x95, SIM_REPORT_LONG_SIZE - 1,
+    0x75, 0x08,
+    0x15, 0x00,
+    0x26, 0xff, 0x00,
+    0x09, 0x02, 0x81, 0x00,
+    0x09, 0x02, 0x91, 0x00,
+    0xc0
+};
+const unsigned sim_report_descriptor_size = sizeof(sim_report_descriptor);
+
+/****************************************************************************/
+
+enum feature_index {
+    IDX_ROOT = 0,
+    IDX_FEATURE,
+    IDX_VERSION,
+    IDX_NAME,
+    IDX_GAMEMODE,
+    IDX_LAYOUT,
+    IDX_REPORTRATE,
+    IDX_LEDS,
+    IDX_COUNT
+};
+
+static const uint16_t feature_ids[IDX_COUNT] = {
+    0x0000, 0x0001, 0x0003, 0x0005, 0x4522, 0x4540, 0x8060, 0x8080
+};
+
+enum hidpp_error {
+    ERR_INVALID_ARGUMENT = 2,
+    ERR_OUT_OF_RANGE = 3,
+    ERR_INVALID_FUNCTION = 7
+};
+
+#define RATES_SUPPORTED ((1 << 0) | (1 << 1) | (1 << 3) | (1 << 7))    /* 1, 2, 4, 8ms */
+#define KEYS_PER_REPLY  ((SIM_REPORT_LONG_SIZE - 3 - 4) / 4)
+
+void sim_device_init(struct sim_device * device)
+{
+    memset(device, 0, sizeof(*device));
+    strcpy(device->name, "Keyleds Simulator");
+    memcpy(device->model, (uint8_t[]){0xc3, 0x30, 0, 0, 0, 0}, 6);
+    memcpy(device->serial, (uint8_t[]){0x5e, 0x71, 0xa1, 0x00}, 4);
+    device->layout = 2;
+    device->reportrate = 1;
+}
+
+bool sim_device_add_key(struct sim_device * device, uint16_t block_id, uint8_t key_id)
+{
+    unsigned idx;
+    for (idx = 0; idx < SIM_BLOCK_NB; idx += 1) {
+        if (block_id == (1 << idx)) { break; }
+    }
+    if (idx == SIM_BLOCK_NB) {
+        LOG(WARNING, "Ignoring key %#x in invalid block %#x", key_id, block_id);
+        return false;
+    }
+
+    struct sim_block * block = &device->blocks[idx];
+    if (block->keys_nb >= KEYLEDSSIM_MAX_KEYS) { return false; }
+    block->block_id = block_id;
+    block->keys[block->keys_nb].id = key_id;
+    block->keys[block->keys_nb].red = 0;
+    block->keys[block->keys_nb].green = 0;
+    block->keys[block->keys_nb].blue = 0;
+    block->keys_nb += 1;
+    return true;
+}
+
+static struct sim_block * find_block(struct sim_device * device, const uint8_t * data)
+{
+    uint16_t block_id = (uint16_t)data[0] << 8 | data[1];
+    for (unsigned idx = 0; idx < SIM_BLOCK_NB; idx += 1) {
+        if (device->blocks[idx].block_id != 0 && device->blocks[idx].block_id == block_id) {
+            return &device->blocks[idx];
+        }
+    }
+    return NULL;
+}
+
+static struct sim_key * find_key(struct sim_block * block, uint8_t key_id)
+{
+    for (unsigned idx = 0; idx < block->keys_nb; idx += 1) {
+        if (block->keys[idx].id == key_id) { return &block->keys[idx]; }
+    }
+    return NULL;
+}
+
+/****************************************************************************/
+/* Feature handlers. They fill out with reply data and return 0 on success,
+ * or a HID++ error code. */
+
+static int handle_root(struct sim_device * device, unsigned function,
+                       const uint8_t * data, uint8_t * out)
+{
+    (void)device;
+    switch (function) {
+    case 0:     /* get feature index */
+        out[0] = 0;
+        for (unsigned idx = 0; idx < IDX_COUNT; idx += 1) {
+            if (feature_ids[idx] == ((uint16_t)data[0] << 8 | data[1])) { out[0] = idx; }
+        }
+        return 0;
+    case 1:     /* ping, also used to get protocol version */
+        out[0] = KEYLEDSSIM_PROTOCOL_MAJOR;
+        out[1] = KEYLEDSSIM_PROTOCOL_MINOR;
+        out[2] = data[2];
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+static int handle_feature(struct sim_device * device, unsigned function,
+                          const uint8_t * data, uint8_t * out)
+{
+    (void)device;
+    switch (function) {
+    case 0:     /* get feature count, root feature is not counted */
+        out[0] = IDX_COUNT - 1;
+        return 0;
+    case 1:     /* get feature id */
+        if (data[0] >= IDX_COUNT) { return ERR_OUT_OF_RANGE; }
+        out[0] = (uint8_t)(feature_ids[data[0]] >> 8);
+        out[1] = (uint8_t)feature_ids[data[0]];
+        out[2] = 0;
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+static int handle_version(struct sim_device * device, unsigned function,
+                          const uint8_t * data, uint8_t * out)
+{
+    switch (function) {
+    case 0:     /* get device info */
+        out[0] = 1;
+        memcpy(&out[1], device->serial, 4);
+        out[5] = 0;
+        out[6] = 0x04;      /* usb */
+        memcpy(&out[7], device->model, 6);
+        return 0;
+    case 1:     /* get firmware info */
+        if (data[0] != 0) { return ERR_OUT_OF_RANGE; }
+        out[0] = 0;         /* main application */
+        memcpy(&out[1], "U1 ", 3);
+        out[4] = 0x10;      /* version 110.0, bcd encoded */
+        out[5] = 0x00;
+        out[6] = 0x00;
+        out[7] = 0x01;
+        out[8] = 1;         /* active */
+        out[9] = device->model[0];
+        out[10] = device->model[1];
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+static int handle_name(struct sim_device * device, unsigned function,
+                       const uint8_t * data, uint8_t * out)
+{
+    size_t length = strlen(device->name);
+    switch (function) {
+    case 0:     /* get name length */
+        out[0] = (uint8_t)length;
+        return 0;
+    case 1:     /* get name chunk */
+        if (data[0] > length) { return ERR_OUT_OF_RANGE; }
+        strncpy((char *)out, device->name + data[0], SIM_REPORT_LONG_SIZE - 4);
+        return 0;
+    case 2:     /* get type */
+        out[0] = 0;         /* keyboard */
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+static int handle_gamemode(struct sim_device * device, unsigned function,
+                           const uint8_t * data, uint8_t * out)
+{
+    unsigned idx, gidx;
+    switch (function) {
+    case 0:     /* get max */
+        out[0] = KEYLEDSSIM_GAMEMODE_MAX;
+        return 0;
+    case 1:     /* block keys */
+        for (idx = 0; idx < SIM_REPORT_LONG_SIZE - 4 && data[idx] != 0; idx += 1) {
+            for (gidx = 0; gidx < device->gamemode_nb; gidx += 1) {
+                if (device->gamemode[gidx] == data[idx]) { break; }
+            }
+            if (gidx < device->gamemode_nb) { continue; }
+            if (device->gamemode_nb >= KEYLEDSSIM_GAMEMODE_MAX) { return ERR_OUT_OF_RANGE; }
+            device->gamemode[device->gamemode_nb++] = data[idx];
+        }
+        return 0;
+    case 2:     /* unblock keys */
+        for (idx = 0; idx < SIM_REPORT_LONG_SIZE - 4 && data[idx] != 0; idx += 1) {
+            for (gidx = 0; gidx < device->gamemode_nb; gidx += 1) {
+                if (device->gamemode[gidx] == data[idx]) {
+                    device->gamemode[gidx] = device->gamemode[--device->gamemode_nb];
+                    break;
+                }
+            }
+        }
+        return 0;
+    case 3:     /* clear */
+        device->gamemode_nb = 0;
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+static int handle_layout(struct sim_device * device, unsigned function,
+                         const uint8_t * data, uint8_t * out)
+{
+    (void)data;
+    if (function != 0) { return ERR_INVALID_FUNCTION; }
+    out[0] = device->layout;
+    return 0;
+}
+
+static int handle_reportrate(struct sim_device * device, unsigned function,
+                             const uint8_t * data, uint8_t * out)
+{
+    switch (function) {
+    case 0:     /* get supported rates */
+        out[0] = RATES_SUPPORTED;
+        return 0;
+    case 1:     /* get rate */
+        out[0] = device->reportrate;
+        return 0;
+    case 2:     /* set rate */
+        if (data[0] < 1 || data[0] > 8 || (RATES_SUPPORTED & (1 << (data[0] - 1))) == 0) {
+            return ERR_INVALID_ARGUMENT;
+        }
+        device->reportrate = data[0];
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+static int handle_leds(struct sim_device * device, unsigned function,
+                       const uint8_t * data, uint8_t * out)
+{
+    struct sim_block * block;
+    unsigned idx, offset, count;
+    uint16_t mask;
+
+    switch (function) {
+    case 0:     /* get block mask */
+        mask = 0;
+        for (idx = 0; idx < SIM_BLOCK_NB; idx += 1) { mask |= device->blocks[idx].block_id; }
+        out[0] = (uint8_t)(mask >> 8);
+        out[1] = (uint8_t)mask;
+        return 0;
+    case 1:     /* get block info */
+        if ((block = find_block(device, data)) == NULL) { return ERR_INVALID_ARGUMENT; }
+        out[0] = (uint8_t)(block->keys_nb >> 8);
+        out[1] = (uint8_t)block->keys_nb;
+        out[2] = out[3] = out[4] = 255;
+        return 0;
+    case 2:     /* get leds */
+        if ((block = find_block(device, data)) == NULL) { return ERR_INVALID_ARGUMENT; }
+        offset = (unsigned)data[2] << 8 | data[3];
+        if (offset >= block->keys_nb) { return ERR_OUT_OF_RANGE; }
+        memcpy(out, data, 4);
+        for (idx = 0; idx < KEYS_PER_REPLY && offset + idx < block->keys_nb; idx += 1) {
+            const struct sim_key * key = &block->keys[offset + idx];
+            out[4 + 4 * idx + 0] = key->id;
+            out[4 + 4 * idx + 1] = key->red;
+            out[4 + 4 * idx + 2] = key->green;
+            out[4 + 4 * idx + 3] = key->blue;
+        }
+        return 0;
+    case 3:     /* set leds */
+        if ((block = find_block(device, data)) == NULL) { return ERR_INVALID_ARGUMENT; }
+        count = (unsigned)data[2] << 8 | data[3];
+        if (count > KEYS_PER_REPLY) { return ERR_INVALID_ARGUMENT; }
+        for (idx = 0; idx < count; idx += 1) {
+            struct sim_key * key = find_key(block, data[4 + 4 * idx]);
+            if (key == NULL) { return ERR_INVALID_ARGUMENT; }
+            key->red = data[4 + 4 * idx + 1];
+            key->green = data[4 + 4 * idx + 2];
+            key->blue = data[4 + 4 * idx + 3];
+        }
+        return 0;
+    case 4:     /* set block */
+        if ((block = find_block(device, data)) == NULL) { return ERR_INVALID_ARGUMENT; }
+        for (idx = 0; idx < block->keys_nb; idx += 1) {
+            block->keys[idx].red = data[2];
+            block->keys[idx].green = data[3];
+            block->keys[idx].blue = data[4];
+        }
+        return 0;
+    case 5:     /* commit */
+        device->commits += 1;
+        return 0;
+    }
+    return ERR_INVALID_FUNCTION;
+}
+
+typedef int (*feature_handler)(struct sim_device *, unsigned, const uint8_t *, uint8_t *);
+static const feature_handler feature_handlers[IDX_COUNT] = {
+    handle_root, handle_feature, handle_version, handle_name,
+    handle_gamemode, handle_layout, handle_reportrate, handle_leds
+};
+
+/****************************************************************************/
+
+size_t sim_device_error(const uint8_t * request, uint8_t code, uint8_t * reply)
+{
+    memset(reply, 0, SIM_REPORT_LONG_SIZE);
+    reply[0] = SIM_REPORT_LONG;
+    reply[1] = request[1];
+    reply[2] = 0xff;
+    reply[3] = request[2];
+    reply[4] = request[3];
+    reply[5] = code;
+    return SIM_REPORT_LONG_SIZE;
+}
+
+size_t sim_device_handle(struct sim_device * device, const uint8_t * request, size_t size,
+                         uint8_t * reply)
+{
+    uint8_t data[SIM_REPORT_LONG_SIZE - 4];
+    int error;
+
+    if (size < SIM_REPORT_SHORT_SIZE) { return 0; }
+    if (request[0] != SIM_REPORT_SHORT && request[0] != SIM_REPORT_LONG) { return 0; }
+    if (request[0] == SIM_REPORT_SHORT && size != SIM_REPORT_SHORT_SIZE) { return 0; }
+    if (request[0] == SIM_REPORT_LONG && size != SIM_REPORT_LONG_SIZE) { return 0; }
+
+    /* Pad short requests so handlers can always read a full set of parameters */
+    memset(data, 0, sizeof(data));
+    memcpy(data, request + 4, size - 4);
+
+    if (request[2] >= IDX_COUNT) {
+        return sim_device_error(request, 6, reply);     /* invalid feature index */
+    }
+
+    memset(reply, 0, SIM_REPORT_LONG_SIZE);
+    reply[0] = SIM_REPORT_LONG;
+    memcpy(reply + 1, request + 1, 3);
+
+    error = (*feature_handlers[request[2]])(device, request[3] >> 4, data, reply + 4);
+    if (error != 0) {
+        LOG(INFO, "Request feature %d function %d failed with error %d",
+            request[2], request[3] >> 4, error);
+        return sim_device_error(request, (uint8_t)error, reply);
+    }
+    return SIM_REPORT_LONG_SIZE;
+}
@@ -0,0 +1,266 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "config.h"
+#include "logging.h"
+#include "simulator.h"
+
+/* Userspace HID++ 2.0 device, serving libkeyleds clients over a unix socket.
+ * Every connection first receives the report descriptor as a single packet,
+ * then each packet is a HID report, as they would be on a hidraw node.
+ */
+
+struct main_options {
+    const char *    layout;
+    const char *    name;
+    const char *    socket_path;
+    int             socket_fd;
+    unsigned        latency;        /* microseconds added to every reply */
+    unsigned        jitter;         /* maximum random microseconds added on top of latency */
+    unsigned        error_rate;     /* percentage of requests answered with a busy error */
+    unsigned        drop_rate;      /* percentage of requests never answered */
+    unsigned        seed;
+};
+
+struct sim_stats {
+    unsigned long   requests;
+    unsigned long   errors;
+    unsigned long   dropped;
+};
+
+static volatile sig_atomic_t g_terminate = 0;
+
+static void on_signal(int signum)
+{
+    (void)signum;
+    g_terminate = 1;
+}
+
+static void usage(FILE * stream, const char * name)
+{
+    (void)fprintf(stream,
+        "Usage: %s [-qv] [-l layout.xml] [-n name] [-L latency_us] [-J jitter_us]\n"
+        "       %*s [-e error_percent] [-x drop_percent] [-r seed] -s path | -f fd\n",
+        name, (int)strlen(name), "");
+}
+
+static bool parse_uint_option(const char * str, unsigned max, unsigned * out)
+{
+    char * end;
+    unsigned long value = strtoul(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || value > max) { return false; }
+    *out = (unsigned)value;
+    return true;
+}
+
+static bool parse_main_options(int argc, char * argv[], struct main_options * options)
+{
+    int opt;
+    options->layout = NULL;
+    options->name = NULL;
+    options->socket_path = NULL;
+    options->socket_fd = -1;
+    options->latency = 0;
+    options->jitter = 0;
+    options->error_rate = 0;
+    options->drop_rate = 0;
+    options->seed = (unsigned)time(NULL);
+
+    while ((opt = getopt(argc, argv, "e:f:hJ:l:L:n:qr:s:vx:")) != -1) {
+        unsigned value;
+        switch (opt) {
+        case 'e': if (!parse_uint_option(optarg, 100, &options->error_rate)) { return false; } break;
+        case 'f':
+            if (!parse_uint_option(optarg, 65535, &value)) { return false; }
+            options->socket_fd = (int)value;
+            break;
+        case 'h': usage(stdout, argv[0]); exit(EXIT_SUCCESS);
+        case 'J': if (!parse_uint_option(optarg, 10000000, &options->jitter)) { return false; } break;
+        case 'l': options->layout = optarg; break;
+        case 'L': if (!parse_uint_option(optarg, 10000000, &options->latency)) { return false; } break;
+        case 'n': options->name = optarg; break;
+        case 'q': g_debug_level = LOG_ERROR; break;
+        case 'r': if (!parse_uint_option(optarg, ~0u, &options->seed)) { return false; } break;
+        case 's': options->socket_path = optarg; break;
+        case 'v': g_debug_level += 1; break;
+        case 'x': if (!parse_uint_option(optarg, 100, &options->drop_rate)) { return false; } break;
+        default:
+            return false;
+        }
+    }
+    if ((options->socket_path == NULL) == (options->socket_fd < 0)) { return false; }
+    return optind == argc;
+}
+
+/****************************************************************************/
+
+static void delay_reply(const struct main_options * options)
+{
+    unsigned delay = options->latency;
+    if (options->jitter > 0) { delay += (unsigned)rand() % (options->jitter + 1); }
+    if (delay == 0) { return; }
+
+    struct timespec remaining = { delay / 1000000, (long)(delay % 1000000) * 1000 };
+    while (nanosleep(&remaining, &remaining) < 0 && errno == EINTR && !g_terminate) {
+        /* resume sleeping */
+    }
+}
+
+static bool serve(int fd, struct sim_device * device, const struct main_options * options,
+                  struct sim_stats * stats)
+{
+    uint8_t request[SIM_REPORT_LONG_SIZE + 1];
+    uint8_t reply[SIM_REPORT_LONG_SIZE];
+    ssize_t nread;
+    size_t size;
+
+    if (write(fd, sim_report_descriptor, sim_report_descriptor_size) < 0) {
+        LOG(ERROR, "Cannot send report descriptor: %s", strerror(errno));
+        return false;
+    }
+
+    while (!g_terminate && (nread = read(fd, request, sizeof(request))) > 0) {
+        stats->requests += 1;
+
+        if (options->drop_rate > 0 && (unsigned)rand() % 100 < options->drop_rate) {
+            LOG(DEBUG, "Dropping request %lu", stats->requests);
+            stats->dropped += 1;
+            continue;
+        }
+        if (options->error_rate > 0 && (unsigned)rand() % 100 < options->error_rate) {
+            LOG(DEBUG, "Failing request %lu", stats->requests);
+            stats->errors += 1;
+            size = sim_device_error(request, SIM_ERROR_BUSY, reply);
+        } else {
+            size = sim_device_handle(device, request, (size_t)nread, reply);
+        }
+        if (size == 0) { continue; }
+
+        delay_reply(options);
+        if (write(fd, reply, size) < 0) {
+            LOG(WARNING, "Cannot send reply: %s", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static int serve_socket(const char * path, struct sim_device * device,
+                        const struct main_options * options, struct sim_stats * stats)
+{
+    struct sockaddr_un address;
+    int listen_fd, fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        (void)fprintf(stderr, "Socket path too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0 ||
+        bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listen_fd, 1) < 0) {
+        (void)fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        if (listen_fd >= 0) { close(listen_fd); }
+        return EXIT_FAILURE;
+    }
+    LOG(INFO, "Listening on %s", path);
+
+    while (!g_terminate) {
+        if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+            if (errno == EINTR) { continue; }
+            (void)fprintf(stderr, "Cannot accept connection: %s\n", strerror(errno));
+            break;
+        }
+        LOG(INFO, "Client connected");
+        (void)serve(fd, device, options, stats);
+        close(fd);
+        LOG(INFO, "Client disconnected, %lu requests and %u commits so far",
+            stats->requests, device->commits);
+    }
+
+    close(listen_fd);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+/****************************************************************************/
+
+static void add_default_keys(struct sim_device * device)
+{
+    /* A plain keyboard with the usual usb scancode range and a logo */
+    for (unsigned code = 0x04; code <= 0x65; code += 1) {
+        (void)sim_device_add_key(device, 1 << 0, (uint8_t)code);
+    }
+    (void)sim_device_add_key(device, 1 << 4, 1);
+}
+
+int main(int argc, char * argv[])
+{
+    struct main_options options;
+    struct sim_device device;
+    struct sim_stats stats = { 0, 0, 0 };
+    struct sigaction action;
+    int result;
+
+    g_debug_level = LOG_WARNING;
+    if (!parse_main_options(argc, argv, &options)) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+    srand(options.seed);
+
+    sim_device_init(&device);
+    if (options.layout != NULL) {
+        if (!sim_load_layout(&device, options.layout)) { return EXIT_FAILURE; }
+    } else {
+        add_default_keys(&device);
+    }
+    if (options.name != NULL) {
+        (void)snprintf(device.name, sizeof(device.name), "%s", options.name);
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (options.socket_path != NULL) {
+        result = serve_socket(options.socket_path, &device, &options, &stats);
+    } else {
+        result = serve(options.socket_fd, &device, &options, &stats) ? EXIT_SUCCESS
+                                                                      : EXIT_FAILURE;
+        close(options.socket_fd);
+    }
+
+    LOG(INFO, "Served %lu requests, %lu failed, %lu dropped",
+        stats.requests, stats.errors, stats.dropped);
+    return result;
+}
@@ -0,0 +1,106 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include "config.h"
+#include "logging.h"
+#include "simulator.h"
+
+/* Layout files are those keyledsd uses, see keyledsd/layouts/README. Only
+ * key codes and their blocks are relevant here, geometry is ignored. File
+ * names follow <model>_<layout>.xml, which gives device identity.
+ */
+
+static bool parse_uint(xmlNode * node, const char * name, int base, unsigned * out)
+{
+    xmlChar * value = xmlGetProp(node, (const xmlChar *)name);
+    char * end;
+    if (value == NULL) { return false; }
+    *out = (unsigned)strtoul((const char *)value, &end, base);
+    bool result = *end == '\0';
+    xmlFree(value);
+    return result;
+}
+
+static void parse_identity(struct sim_device * device, const char * path)
+{
+    const char * base = strrchr(path, '/');
+    unsigned idx, layout;
+    char byte[3] = { 0, 0, 0 };
+    char * end;
+
+    base = base == NULL ? path : base + 1;
+    if (strlen(base) != 21 || base[12] != '_' || strcmp(base + 17, ".xml") != 0) {
+        LOG(WARNING, "Layout file name %s does not match <model>_<layout>.xml", base);
+        return;
+    }
+    for (idx = 0; idx < 6; idx += 1) {
+        memcpy(byte, base + 2 * idx, 2);
+        device->model[idx] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0') { return; }
+    }
+    layout = (unsigned)strtoul(base + 13, &end, 16);
+    if (end == base + 17) { device->layout = (uint8_t)layout; }
+}
+
+bool sim_load_layout(struct sim_device * device, const char * path)
+{
+    xmlDoc * document;
+    xmlNode * root, * keyboard, * row, * key;
+    unsigned zone, code, keys_nb = 0;
+
+    if ((document = xmlReadFile(path, NULL, XML_PARSE_NONET)) == NULL) {
+        LOG(ERROR, "Cannot parse layout file %s", path);
+        return false;
+    }
+    if ((root = xmlDocGetRootElement(document)) == NULL) {
+        LOG(ERROR, "Layout file %s is empty", path);
+        xmlFreeDoc(document);
+        return false;
+    }
+
+    for (keyboard = root->children; keyboard != NULL; keyboard = keyboard->next) {
+        if (keyboard->type != XML_ELEMENT_NODE ||
+            xmlStrcmp(keyboard->name, (const xmlChar *)"keyboard") != 0) { continue; }
+        if (!parse_uint(keyboard, "zone", 0, &zone)) {
+            LOG(WARNING, "Skipping keyboard element without valid zone on line %ld",
+                xmlGetLineNo(keyboard));
+            continue;
+        }
+
+        for (row = keyboard->children; row != NULL; row = row->next) {
+            if (row->type != XML_ELEMENT_NODE ||
+                xmlStrcmp(row->name, (const xmlChar *)"row") != 0) { continue; }
+
+            for (key = row->children; key != NULL; key = key->next) {
+                if (key->type != XML_ELEMENT_NODE ||
+                    xmlStrcmp(key->name, (const xmlChar *)"key") != 0) { continue; }
+                if (!parse_uint(key, "code", 0, &code)) { continue; }   /* hole */
+                if (sim_device_add_key(device, (uint16_t)zone, (uint8_t)code)) {
+                    keys_nb += 1;
+                }
+            }
+        }
+    }
+    xmlFreeDoc(document);
+
+    parse_identity(device, path);
+    LOG(INFO, "Loaded %u keys from %s", keys_nb, path);
+    return keys_nb > 0;
+}
@@ -20,6 +20,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,10 +37,54 @@ typedef struct keyleds_device Keyleds;
 #define KEYLEDS_APP_ID_MIN  ((uint8_t)0x0)
 #define KEYLEDS_APP_ID_MAX  ((uint8_t)0xf)
 
+/* Transports move raw reports between the library and the device. Backends
+ * embed struct keyleds_transport as their first member. Send and receive return
+ * the number of bytes transferred, or -1 with errno set. Receive returns 0 on
+ * timeout, waits forever if timeout_us is negative and does not wait if it is 0.
+ */
+struct keyleds_transport;
+
+struct keyleds_transport_ops {
+    void    (*close)(/*@only@*/ struct keyleds_transport *);
+    bool    (*get_descriptor)(struct keyleds_transport *,
+                              /*@out@*/ uint8_t * buffer, unsigned * size);
+    ssize_t (*send)(struct keyleds_transport *, const uint8_t * data, size_t size);
+    ssize_t (*receive)(struct keyleds_transport *, /*@out@*/ uint8_t * data, size_t size,
+                       int timeout_us);
+    int     (*poll_fd)(struct keyleds_transport *);     /* -1 if transport has no fd */
+};
+
+struct keyleds_transport {
+    const struct keyleds_transport_ops * ops;
+};
+
+typedef void (*keyleds_loopback_handler)(struct keyleds_transport * transport,
+                                         const uint8_t * report, size_t size, void * userdata);
+
+struct keyleds_transport * keyleds_transport_hidraw(const char * path);
+struct keyleds_transport * keyleds_transport_socket(int fd, const uint8_t * descriptor,
+                                                    unsigned size);  /* takes ownership of fd */
+struct keyleds_transport * keyleds_transport_socketpair(/*@out@*/ int * peer,
+                                                        const uint8_t * descriptor,
+                                                        unsigned size);
+struct keyleds_transport * keyleds_transport_unix(const char * path);
+struct keyleds_transport * keyleds_transport_loopback(const uint8_t * descriptor, unsigned size,
+                                                      keyleds_loopback_handler, void * userdata);
+bool keyleds_transport_loopback_push(struct keyleds_transport * transport,
+                                     const uint8_t * report, size_t size);
+struct keyleds_transport * keyleds_transport_recorder(/*@only@*/ struct keyleds_transport * inner,
+                                                      const char * path);
+struct keyleds_transport * keyleds_transport_replay(const char * path);
+
+/* Path may be a hidraw node, a unix socket or a recording to replay. If the
+ * KEYLEDS_RECORD environment variable is set, traffic is recorded into the
+ * file it names, with a numeric suffix for devices opened after the first. */
 Keyleds * keyleds_open(const char * path, uint8_t app_id);
+Keyleds * keyleds_open_transport(/*@only@*/ struct keyleds_transport * transport, uint8_t app_id);
 void keyleds_close(Keyleds * device);
 void keyleds_set_timeout(Keyleds * device, unsigned us);
 int keyleds_device_fd(Keyleds * device);
+int keyleds_event_fd(Keyleds * device);     /* readable when flush + dispatch have work to do */
 bool keyleds_flush_fd(Keyleds * device);
 
 /****************************************************************************/
@@ -59,6 +104,33 @@ unsigned keyleds_get_feature_count(Keyleds * dev, uint8_t target_id);
 uint16_t keyleds_get_feature_id(Keyleds * dev, uint8_t target_id, uint8_t feature_idx);
 uint8_t keyleds_get_feature_index(Keyleds * dev, uint8_t target_id, uint16_t feature_id);
 
+/****************************************************************************/
+/* Notifications */
+
+/* Reports the device sends that are not a reply to one of our calls, such as
+ * device-originated events or replies destined to other applications. For
+ * error reports, feature and function are those of the failed request. */
+struct keyleds_notification {
+    uint8_t     target_id;
+    uint8_t     feature_idx;
+    uint16_t    feature_id;     /* 0 if feature index was never resolved */
+    uint8_t     function;
+    uint8_t     app_id;         /* 0 for events originating from the device */
+    uint8_t     error;          /* HID++ error code, 0 if this is not an error report */
+    unsigned    length;
+    const uint8_t * data;       /* for error reports, bytes following the error code */
+};
+
+typedef void (*keyleds_notification_handler)(Keyleds * device,
+                                             const struct keyleds_notification * notification,
+                                             void * userdata);
+
+bool keyleds_register_notification_handler(Keyleds * device, keyleds_notification_handler,
+                                           void * userdata);
+bool keyleds_unregister_notification_handler(Keyleds * device, keyleds_notification_handler,
+                                             void * userdata);  /* waits for running dispatch */
+unsigned keyleds_dispatch_notifications(Keyleds * device); /* invoke handlers on queued reports */
+
 /****************************************************************************/
 /* Device information */
 
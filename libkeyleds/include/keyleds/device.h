@@ -17,6 +17,7 @@
 #ifndef KEYLEDS_DEVICE_H
 #define KEYLEDS_DEVICE_H
 
+#include <pthread.h>
 #include <stdint.h>
 
 struct keyleds_device_reports {
@@ -34,8 +35,14 @@ struct keyleds_device_feature {
     bool        obsolete;
 };
 
+struct keyleds_device_handler {
+    keyleds_notification_handler handler;
+    void *      userdata;
+};
+
 struct keyleds_device {
-    int         fd;                             /* device file descriptor */
+    pthread_mutex_t lock;                       /* serializes requests and protects state */
+    struct keyleds_transport * transport;       /* link to the device */
     uint8_t     app_id;                         /* our application identifier */
     uint8_t     ping_seq;                       /* using for resyncing after errors */
     unsigned    timeout;                        /* read timeout in microseconds */
@@ -44,11 +51,26 @@ struct keyleds_device {
     unsigned    max_report_size;                /* maximum number of bytes in a report */
 
     struct keyleds_device_feature * features;   /* feature index cache */
+
+    struct keyleds_device_handler * handlers;   /* registered notification handlers */
+    unsigned    handlers_nb;                    /* number of registered handlers */
+    uint8_t *   notifications;                  /* ring of pending unsolicited reports */
+    unsigned    notifications_head;             /* index of oldest pending report */
+    unsigned    notifications_nb;               /* number of pending reports */
+    pthread_cond_t dispatch_done;               /* signalled when dispatch_depth drops to 0 */
+    pthread_t   dispatch_thread;                /* thread running handlers, if dispatch_depth > 0 */
+    unsigned    dispatch_depth;                 /* nesting level of keyleds_dispatch_notifications */
+    int         event_fd;                       /* epoll set returned by keyleds_event_fd, or -1 */
+    int         notify_fd;                      /* eventfd signalled on queueing, if event_fd is set */
 };
 
 /****************************************************************************/
 /* Core functions */
 
+/* Functions below expect the caller to hold device->lock, except keyleds_call,
+ * which takes it for the duration of the request/reply exchange.
+ */
+
 bool keyleds_send(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
                   uint8_t function, size_t length, const uint8_t * data);
 bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
@@ -56,6 +78,9 @@ bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
 int keyleds_call(Keyleds * device, /*@null@*/ /*@out@*/ uint8_t * result, size_t result_len,
                  uint8_t target_id, uint16_t feature_id, uint8_t function,
                  size_t length, const uint8_t * data);
+void keyleds_queue_notification(Keyleds * device, const uint8_t * message);
+void keyleds_signal_notification(Keyleds * device);
+unsigned keyleds_find_report_size(const Keyleds * device, uint8_t report_id);
 
 /****************************************************************************/
 /* Helpers */
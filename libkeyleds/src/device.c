@@ -16,14 +16,13 @@
  */
 #include <assert.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <linux/hidraw.h>
-#include <sys/ioctl.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "keyleds.h"
@@ -36,38 +35,79 @@
 
 KEYLEDS_EXPORT Keyleds * keyleds_open(const char * path, uint8_t app_id)
 {
+    struct keyleds_transport * transport;
+    struct stat info;
+
+    KEYLEDS_LOG(DEBUG, "Opening device %s", path);
+    if (stat(path, &info) < 0) { info.st_mode = 0; }    /* let hidraw report the error */
+    if (S_ISSOCK(info.st_mode)) {
+        transport = keyleds_transport_unix(path);
+    } else if (S_ISREG(info.st_mode)) {
+        transport = keyleds_transport_replay(path);
+    } else {
+        transport = keyleds_transport_hidraw(path);
+    }
+    if (transport == NULL) { return NULL; }
+
+    Keyleds * dev = keyleds_open_transport(transport, app_id);
+    if (dev != NULL) { KEYLEDS_LOG(INFO, "Opened device %s", path); }
+    return dev;
+}
+
+KEYLEDS_EXPORT Keyleds * keyleds_open_transport(struct keyleds_transport * transport,
+                                                uint8_t app_id)
+{
+    assert(transport != NULL);
+    static unsigned record_count = 0;
+    const char * record_path = getenv("KEYLEDS_RECORD");
+    if (record_path != NULL && record_path[0] != '\0') {
+        unsigned record_idx = __sync_fetch_and_add(&record_count, 1);
+        if (record_idx == 0) {
+            transport = keyleds_transport_recorder(transport, record_path);
+        } else {
+            char indexed_path[strlen(record_path) + 12];
+            sprintf(indexed_path, "%s.%u", record_path, record_idx);
+            transport = keyleds_transport_recorder(transport, indexed_path);
+        }
+        if (transport == NULL) { return NULL; }
+    }
+
     Keyleds * dev = malloc(sizeof(Keyleds));
-    struct hidraw_report_descriptor descriptor;
+    uint8_t descriptor[KEYLEDS_DESCRIPTOR_MAX_SIZE];
+    unsigned descriptor_size = sizeof(descriptor);
     unsigned version;
 
+    if (dev == NULL) {
+        keyleds_set_error_errno();
+        goto error_close_transport;
+    }
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_cond_init(&dev->dispatch_done, NULL);
+    dev->transport = transport;
     dev->app_id = app_id;
     do { dev->ping_seq = rand(); } while (dev->ping_seq == 0);
     dev->timeout = KEYLEDS_CALL_TIMEOUT_US;
-
-    /* Open device */
-    KEYLEDS_LOG(DEBUG, "Opening device %s", path);
-    if ((dev->fd = open(path, O_RDWR)) < 0) {
-        keyleds_set_error_errno();
-        goto error_free_dev;
-    }
-    fcntl(dev->fd, F_SETFD, FD_CLOEXEC);
+    dev->handlers = NULL;
+    dev->handlers_nb = 0;
+    dev->notifications = NULL;
+    dev->notifications_head = 0;
+    dev->notifications_nb = 0;
+    dev->dispatch_depth = 0;
+    dev->event_fd = -1;
+    dev->notify_fd = -1;
 
     /* Read REPORT descriptor */
-    if (ioctl(dev->fd, HIDIOCGRDESCSIZE, &descriptor.size) < 0) {
+    if (!(*transport->ops->get_descriptor)(transport, descriptor, &descriptor_size)) {
         keyleds_set_error_errno();
-        goto error_close_fd;
-    }
-    if (ioctl(dev->fd, HIDIOCGRDESC, &descriptor) < 0) {
-        keyleds_set_error_errno();
-        goto error_close_fd;
+        goto error_free_dev;
     }
-    KEYLEDS_LOG(DEBUG, "Parsing report descriptor (%d bytes)", descriptor.size);
+    KEYLEDS_LOG(DEBUG, "Parsing report descriptor (%u bytes)", descriptor_size);
 
     /* Parse report descriptor */
-    if (!keyleds_parse_hid(descriptor.value, descriptor.size,
+    if (!keyleds_parse_hid(descriptor, descriptor_size,
                            &dev->reports, &dev->max_report_size)) {
         keyleds_set_error(KEYLEDS_ERROR_HIDREPORT);
-        goto error_close_fd;
+        goto error_free_dev;
     }
     if (dev->max_report_size == 0) {
         keyleds_set_error(KEYLEDS_ERROR_HIDNOPP);
@@ -90,37 +130,105 @@ KEYLEDS_EXPORT Keyleds * keyleds_open(const char * path, uint8_t app_id)
     dev->features = malloc(sizeof(struct keyleds_device_feature));
     dev->features[0].id = 0;
 
-    KEYLEDS_LOG(INFO, "Opened device %s protocol version %d", path, version);
+    KEYLEDS_LOG(DEBUG, "Device uses protocol version %d", version);
     return dev;
 
 error_free_reports:
     free(dev->reports);
-error_close_fd:
-    close(dev->fd);
 error_free_dev:
+    pthread_cond_destroy(&dev->dispatch_done);
+    pthread_mutex_destroy(&dev->lock);
     free(dev);
+error_close_transport:
+    (*transport->ops->close)(transport);
     return NULL;
 }
 
 KEYLEDS_EXPORT void keyleds_close(Keyleds * device)
 {
     assert(device != NULL);
-    close(device->fd);
+    (*device->transport->ops->close)(device->transport);
     free(device->reports);
     free(device->features);
+    free(device->handlers);
+    free(device->notifications);
+    if (device->event_fd >= 0) {
+        close(device->event_fd);
+        close(device->notify_fd);
+    }
+    pthread_cond_destroy(&device->dispatch_done);
+    pthread_mutex_destroy(&device->lock);
     free(device);
 }
 
 KEYLEDS_EXPORT void keyleds_set_timeout(Keyleds * device, unsigned us)
 {
     assert(device != NULL);
+    pthread_mutex_lock(&device->lock);
     device->timeout = us;
+    pthread_mutex_unlock(&device->lock);
 }
 
 KEYLEDS_EXPORT int keyleds_device_fd(Keyleds * device)
 {
     assert(device != NULL);
-    return device->fd;
+    return (*device->transport->ops->poll_fd)(device->transport);
+}
+
+/* Build an epoll set over the transport and an eventfd that queueing a
+ * notification signals. It catches notifications the device sends while
+ * some thread is waiting for a reply, as those are read off the transport
+ * along with the reply.
+ */
+KEYLEDS_EXPORT int keyleds_event_fd(Keyleds * device)
+{
+    assert(device != NULL);
+    struct epoll_event event = { .events = EPOLLIN };
+    int transport_fd, result;
+
+    pthread_mutex_lock(&device->lock);
+    if (device->event_fd < 0) {
+        transport_fd = (*device->transport->ops->poll_fd)(device->transport);
+        if ((device->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+            (device->event_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            epoll_ctl(device->event_fd, EPOLL_CTL_ADD, device->notify_fd, &event) < 0 ||
+            (transport_fd >= 0 &&
+             epoll_ctl(device->event_fd, EPOLL_CTL_ADD, transport_fd, &event) < 0)) {
+            keyleds_set_error_errno();
+            if (device->event_fd >= 0) { close(device->event_fd); }
+            if (device->notify_fd >= 0) { close(device->notify_fd); }
+            device->event_fd = -1;
+            device->notify_fd = -1;
+        } else if (device->notifications_nb > 0) {
+            keyleds_signal_notification(device);
+        }
+    }
+    result = device->event_fd;
+    pthread_mutex_unlock(&device->lock);
+    return result;
+}
+
+/* Locate the report descriptor matching a received message, returning its size
+ * or zero if we do not know that report.
+ */
+unsigned keyleds_find_report_size(const Keyleds * device, uint8_t report_id)
+{
+    unsigned idx;
+    for (idx = 0; device->reports[idx].id != DEVICE_REPORT_INVALID; idx += 1) {
+        if (device->reports[idx].id == report_id) { return device->reports[idx].size; }
+    }
+    return 0;
+}
+
+/* Tell whether a message is a reply to a request we sent, either the one we are
+ * waiting for or a stale one. Everything else is a notification.
+ */
+static bool is_own_reply(const Keyleds * device, const uint8_t * message)
+{
+    if (message[2] == 0xff || message[2] == 0x8f) {
+        return (message[4] & 0xf) == device->app_id;
+    }
+    return (message[3] & 0xf) == device->app_id;
 }
 
 KEYLEDS_EXPORT bool keyleds_flush_fd(Keyleds * device)
@@ -129,15 +237,19 @@ KEYLEDS_EXPORT bool keyleds_flush_fd(Keyleds * device)
     uint8_t buffer[device->max_report_size + 1];
     ssize_t nread;
 
-    fcntl(device->fd, F_SETFL, O_NONBLOCK);
-    while ((nread = read(device->fd, buffer, device->max_report_size + 1)) > 0) {
-        /* do nothing */
+    pthread_mutex_lock(&device->lock);
+    while ((nread = (*device->transport->ops->receive)(
+                device->transport, buffer, device->max_report_size + 1, 0)) > 0) {
+        unsigned size = keyleds_find_report_size(device, buffer[0]);
+        if (size > 0 && (size_t)nread == 1 + size && !is_own_reply(device, buffer)) {
+            keyleds_queue_notification(device, buffer);
+        }
     }
-    if (errno != EAGAIN) {
+    pthread_mutex_unlock(&device->lock);
+    if (nread < 0) {
         keyleds_set_error_errno();
         return false;
     }
-    fcntl(device->fd, F_SETFL, 0);
     return true;
 }
 
@@ -183,13 +295,14 @@ bool keyleds_send(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
     }
 #endif
 
-    ssize_t nwritten = write(device->fd, buffer, 1 + report_size);
+    ssize_t nwritten = (*device->transport->ops->send)(device->transport,
+                                                       buffer, 1 + report_size);
     if (nwritten < 0) {
         keyleds_set_error_errno();
         return false;
     }
     if ((size_t)nwritten != 1 + report_size) {
-        KEYLEDS_LOG(DEBUG, "Unexpected write size %zd on fd %d", nwritten, device->fd);
+        KEYLEDS_LOG(DEBUG, "Unexpected write size %zd", nwritten);
         keyleds_set_error(KEYLEDS_ERROR_IO_LENGTH);
         return false;
     }
@@ -199,36 +312,26 @@ bool keyleds_send(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
 bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
                      uint8_t * message, size_t * size)
 {
-    int err, idx;
+    unsigned expected;
     ssize_t nread;
 
     assert(device != NULL);
     assert(message != NULL);
 
-    do {
-        if (device->timeout > 0) {
-            fd_set set;
-            struct timeval timeout;
-
-            FD_ZERO(&set);
-            FD_SET(device->fd, &set);
-            timeout.tv_sec = KEYLEDS_CALL_TIMEOUT_US / 1000000;
-            timeout.tv_usec = KEYLEDS_CALL_TIMEOUT_US % 1000000;
-            if ((err = select(device->fd + 1, &set, NULL, NULL, &timeout)) < 0) {
-                keyleds_set_error_errno();
-                return false;
-            }
-            if (err == 0) {
-                KEYLEDS_LOG(INFO, "Device timeout while reading fd %d", device->fd);
-                keyleds_set_error(KEYLEDS_ERROR_TIMEDOUT);
-                return false;
-            }
-        }
-
-        if ((nread = read(device->fd, message, device->max_report_size + 1)) < 0) {
+    for (;;) {
+        nread = (*device->transport->ops->receive)(
+            device->transport, message, device->max_report_size + 1,
+            device->timeout > 0 ? (int)device->timeout : -1
+        );
+        if (nread < 0) {
             keyleds_set_error_errno();
             return false;
         }
+        if (nread == 0) {
+            KEYLEDS_LOG(INFO, "Device timeout while reading");
+            keyleds_set_error(KEYLEDS_ERROR_TIMEDOUT);
+            return false;
+        }
 #ifndef NDEBUG
         if (g_keyleds_debug_level >= KEYLEDS_LOG_DEBUG) {
             char debug_buffer[3 * nread + 1];
@@ -236,33 +339,34 @@ bool keyleds_receive(Keyleds * device, uint8_t target_id, uint8_t feature_idx,
             KEYLEDS_LOG(DEBUG, "Recv [%s]", debug_buffer);
         }
 #endif
-        for (idx = 0; device->reports[idx].id != DEVICE_REPORT_INVALID; idx += 1)
-        {
-            if (device->reports[idx].id == message[0]) { break; }
-        }
-        if (device->reports[idx].id == DEVICE_REPORT_INVALID) { continue; }
+        expected = keyleds_find_report_size(device, message[0]);
+        if (expected == 0) { continue; }
 
-        if (nread != 1 + device->reports[idx].size) {
-            KEYLEDS_LOG(DEBUG, "Unexpected read size %zd on fd %d", nread, device->fd);
+        if ((size_t)nread != 1 + expected) {
+            KEYLEDS_LOG(DEBUG, "Unexpected read size %zd", nread);
             keyleds_set_error(KEYLEDS_ERROR_IO_LENGTH);
             return false;
         }
 
-    } while(!(
-        message[1] == target_id && (                /* message is from this device */
-        (
-            message[2] == feature_idx &&            /* message is for correct feature */
-            (message[3] & 0xf) == device->app_id    /* message is for us */
-        ) || (
-            message[2] == 0xff &&                   /* message is an error */
-            message[3] == feature_idx &&            /* message if for correct feature */
-            (message[4] & 0xf) == device->app_id    /* message is for us */
-        ) || (                                          /* special handling for getprotocol */
-            message[2] == 0x8f &&                       /* message is HIDPP1 error */
-            message[3] == KEYLEDS_FEATURE_IDX_ROOT &&   /* feature is root feature */
-            (message[4] & 0xf) == device->app_id        /* message is for us */
-        )
-    )));
+        if (message[1] == target_id && (            /* message is from this device */
+            (
+                message[2] == feature_idx &&            /* message is for correct feature */
+                (message[3] & 0xf) == device->app_id    /* message is for us */
+            ) || (
+                message[2] == 0xff &&                   /* message is an error */
+                message[3] == feature_idx &&            /* message if for correct feature */
+                (message[4] & 0xf) == device->app_id    /* message is for us */
+            ) || (                                          /* special handling for getprotocol */
+                message[2] == 0x8f &&                       /* message is HIDPP1 error */
+                message[3] == KEYLEDS_FEATURE_IDX_ROOT &&   /* feature is root feature */
+                (message[4] & 0xf) == device->app_id        /* message is for us */
+            )
+        )) { break; }
+
+        if (!is_own_reply(device, message)) {
+            keyleds_queue_notification(device, message);
+        }
+    }
 
     if (message[2] == 0xff) {
         keyleds_set_error_hidpp(message[5]);
@@ -289,11 +393,15 @@ int keyleds_call(Keyleds * device, uint8_t * result, size_t result_len,
         if (feature_idx == 0) { return -1; }
     }
 
-    if (!keyleds_send(device, target_id, feature_idx, function, length, data)) { return -1; }
-
     uint8_t buffer[1 + device->max_report_size];
     size_t nread;
-    if (!keyleds_receive(device, target_id, feature_idx, buffer, &nread)) { return -1; }
+    bool ok;
+
+    pthread_mutex_lock(&device->lock);
+    ok = keyleds_send(device, target_id, feature_idx, function, length, data) &&
+         keyleds_receive(device, target_id, feature_idx, buffer, &nread);
+    pthread_mutex_unlock(&device->lock);
+    if (!ok) { return -1; }
 
     const uint8_t * res_data = keyleds_response_data(device, buffer);
     size_t ret = nread - (res_data - buffer);
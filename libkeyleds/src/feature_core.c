@@ -36,15 +36,15 @@ enum feature_feature_function {
 KEYLEDS_EXPORT bool keyleds_get_protocol(struct keyleds_device * device, uint8_t target_id,
                                          unsigned * version, keyleds_device_handler_t * handler)
 {
-    if (!keyleds_send(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, F_PING, 0, NULL)) {
-        return false;
-    }
-
     size_t size;
     uint8_t buffer[1 + device->max_report_size];
-    if (!keyleds_receive(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, buffer, &size)) {
-        return false;
-    }
+    bool ok;
+
+    pthread_mutex_lock(&device->lock);
+    ok = keyleds_send(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, F_PING, 0, NULL) &&
+         keyleds_receive(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, buffer, &size);
+    pthread_mutex_unlock(&device->lock);
+    if (!ok) { return false; }
 
     if (buffer[2] == 0x8f) {
         if (version != NULL) { *version = 1; }
@@ -62,22 +62,23 @@ KEYLEDS_EXPORT bool keyleds_get_protocol(struct keyleds_device * device, uint8_t
  */
 KEYLEDS_EXPORT bool keyleds_ping(Keyleds * device, uint8_t target_id)
 {
-    uint8_t payload = device->ping_seq;
+    uint8_t buffer[1 + device->max_report_size];
+    uint8_t payload;
+    bool ok;
+
+    pthread_mutex_lock(&device->lock);
+    payload = device->ping_seq;
     device->ping_seq = payload == UINT8_MAX ? (uint8_t)1 : payload + 1;
 
-    if (!keyleds_send(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, F_PING,
-                      3, (uint8_t[]){0, 0, payload})) {
-        return false;
+    ok = keyleds_send(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, F_PING,
+                      3, (uint8_t[]){0, 0, payload});
+    while (ok) {
+        ok = keyleds_receive(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, buffer, NULL);
+        if (ok && keyleds_response_data(device, buffer)[2] == payload) { break; }
     }
+    pthread_mutex_unlock(&device->lock);
 
-    uint8_t buffer[1 + device->max_report_size];
-    do {
-        if (!keyleds_receive(device, target_id, KEYLEDS_FEATURE_IDX_ROOT, buffer, NULL)) {
-            return false;
-        }
-    } while (keyleds_response_data(device, buffer)[2] != payload);
-
-    return true;
+    return ok;
 }
 
 KEYLEDS_EXPORT unsigned keyleds_get_feature_count(struct keyleds_device * device, uint8_t target_id)
@@ -90,22 +91,65 @@ KEYLEDS_EXPORT unsigned keyleds_get_feature_count(struct keyleds_device * device
     return (unsigned)data[0];
 }
 
+/* Feature cache is shared by all threads using the device. Lookups and updates
+ * take the device lock, but it is released while querying the device, so two
+ * threads may resolve the same feature concurrently: only one entry is kept.
+ */
+static bool cache_lookup(struct keyleds_device * device, uint8_t target_id,
+                         uint16_t * feature_id, uint8_t * feature_idx)
+{
+    size_t idx;
+    bool found = false;
+
+    pthread_mutex_lock(&device->lock);
+    for (idx = 0; device->features[idx].id != 0; idx += 1) {
+        if (device->features[idx].target_id == target_id &&
+            (*feature_id == 0 || device->features[idx].id == *feature_id) &&
+            (*feature_idx == 0 || device->features[idx].index == *feature_idx)) {
+            *feature_id = device->features[idx].id;
+            *feature_idx = device->features[idx].index;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&device->lock);
+    return found;
+}
+
+static void cache_insert(struct keyleds_device * device, uint8_t target_id,
+                         uint16_t feature_id, uint8_t feature_idx, uint8_t flags)
+{
+    size_t idx;
+
+    pthread_mutex_lock(&device->lock);
+    for (idx = 0; device->features[idx].id != 0; idx += 1) {
+        if (device->features[idx].target_id == target_id &&
+            device->features[idx].id == feature_id) { break; }
+    }
+    if (device->features[idx].id == 0) {
+        device->features = realloc(device->features, (idx + 2) * sizeof(device->features[0]));
+        device->features[idx].target_id = target_id;
+        device->features[idx].id = feature_id;
+        device->features[idx].index = feature_idx;
+        device->features[idx].reserved = (flags & (1<<5)) != 0;
+        device->features[idx].hidden = (flags & (1<<6)) != 0;
+        device->features[idx].obsolete = (flags & (1<<7)) != 0;
+        device->features[idx + 1].id = 0;
+    }
+    pthread_mutex_unlock(&device->lock);
+    KEYLEDS_LOG(DEBUG, "feature %04x is at %d [%02x]", feature_id, feature_idx, flags);
+}
+
 KEYLEDS_EXPORT uint16_t keyleds_get_feature_id(struct keyleds_device * device,
                                                uint8_t target_id, uint8_t feature_idx)
 {
-    size_t idx;
-    uint16_t feature_id;
+    uint16_t feature_id = 0;
     uint8_t data[3];
 
     if (feature_idx == KEYLEDS_FEATURE_IDX_ROOT) { return KEYLEDS_FEATURE_ROOT; }
     if (feature_idx == KEYLEDS_FEATURE_IDX_FEATURE) { return KEYLEDS_FEATURE_FEATURE; }
 
-    for (idx = 0; device->features[idx].id != 0; idx += 1) {
-        if (device->features[idx].target_id == target_id &&
-            device->features[idx].index == feature_idx) {
-            return device->features[idx].id;
-        }
-    }
+    if (cache_lookup(device, target_id, &feature_id, &feature_idx)) { return feature_id; }
 
     if (keyleds_call(device, data, sizeof(data),
                      target_id, KEYLEDS_FEATURE_FEATURE, F_GET_FEATURE_ID,
@@ -115,35 +159,20 @@ KEYLEDS_EXPORT uint16_t keyleds_get_feature_id(struct keyleds_device * device,
     }
 
     feature_id = (data[0] << 8) | data[1];
-    device->features = realloc(device->features, (idx + 2) * sizeof(device->features[0]));
-    device->features[idx].target_id = target_id;
-    device->features[idx].id = feature_id;
-    device->features[idx].index = feature_idx;
-    device->features[idx].reserved = (data[2] & (1<<5)) != 0;
-    device->features[idx].hidden = (data[2] & (1<<6)) != 0;
-    device->features[idx].obsolete = (data[2] & (1<<7)) != 0;
-    device->features[idx + 1].id = 0;
-    KEYLEDS_LOG(DEBUG, "feature %04x is at %d [%02x]",
-                       feature_id, feature_idx, data[2]);
+    cache_insert(device, target_id, feature_id, feature_idx, data[2]);
     return feature_id;
 }
 
 KEYLEDS_EXPORT uint8_t keyleds_get_feature_index(struct keyleds_device * device,
                                                  uint8_t target_id, uint16_t feature_id)
 {
-    size_t idx;
-    uint8_t feature_idx;
+    uint8_t feature_idx = 0;
     uint8_t data[2];
 
     if (feature_id == KEYLEDS_FEATURE_ROOT) { return KEYLEDS_FEATURE_IDX_ROOT; }
     if (feature_id == KEYLEDS_FEATURE_FEATURE) { return KEYLEDS_FEATURE_IDX_FEATURE; }
 
-    for (idx = 0; device->features[idx].id != 0; idx += 1) {
-        if (device->features[idx].target_id == target_id &&
-            device->features[idx].id == feature_id) {
-            return device->features[idx].index;
-        }
-    }
+    if (cache_lookup(device, target_id, &feature_id, &feature_idx)) { return feature_idx; }
 
     if (keyleds_call(device, data, sizeof(data),
                      target_id, KEYLEDS_FEATURE_ROOT, F_GET_FEATURE,
@@ -158,15 +187,6 @@ KEYLEDS_EXPORT uint8_t keyleds_get_feature_index(struct keyleds_device * device,
         return 0;
     }
 
-    device->features = realloc(device->features, (idx + 2) * sizeof(device->features[0]));
-    device->features[idx].target_id = target_id;
-    device->features[idx].id = feature_id;
-    device->features[idx].index = feature_idx;
-    device->features[idx].reserved = (data[1] & (1<<5)) != 0;
-    device->features[idx].hidden = (data[1] & (1<<6)) != 0;
-    device->features[idx].obsolete = (data[1] & (1<<7)) != 0;
-    device->features[idx + 1].id = 0;
-    KEYLEDS_LOG(DEBUG, "feature %04x is at %d [%02x]",
-                       feature_id, feature_idx, data[1]);
+    cache_insert(device, target_id, feature_id, feature_idx, data[1]);
     return feature_idx;
 }
@@ -0,0 +1,212 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "keyleds.h"
+#include "keyleds/device.h"
+#include "keyleds/error.h"
+#include "keyleds/logging.h"
+
+/* Unsolicited reports are stored into a fixed-size ring buffer until the
+ * application asks for them to be dispatched. Each slot holds a full report,
+ * that is 1 + max_report_size bytes. When the ring is full, oldest reports are
+ * overwritten.
+ *
+ * Handlers run without the lock held, so one thread dispatches at a time and
+ * unregistering a handler waits until any dispatch running on another thread
+ * is over. Once unregistering returns, the handler will not be invoked again
+ * and its userdata may be released. Handlers may unregister handlers too, but
+ * those still receive the report being dispatched.
+ */
+
+/* With device lock held, waits until no other thread is running handlers */
+static void wait_dispatch(Keyleds * device)
+{
+    while (device->dispatch_depth > 0 &&
+           !pthread_equal(device->dispatch_thread, pthread_self())) {
+        pthread_cond_wait(&device->dispatch_done, &device->lock);
+    }
+}
+
+KEYLEDS_EXPORT bool keyleds_register_notification_handler(Keyleds * device,
+                                                          keyleds_notification_handler handler,
+                                                          void * userdata)
+{
+    assert(device != NULL);
+    assert(handler != NULL);
+    struct keyleds_device_handler * handlers;
+
+    pthread_mutex_lock(&device->lock);
+    if (device->notifications == NULL) {
+        device->notifications = malloc(KEYLEDS_NOTIFICATION_QUEUE_SIZE *
+                                       (1 + device->max_report_size));
+        if (device->notifications == NULL) { goto error_unlock; }
+    }
+
+    handlers = realloc(device->handlers, (device->handlers_nb + 1) * sizeof(device->handlers[0]));
+    if (handlers == NULL) { goto error_unlock; }
+    handlers[device->handlers_nb].handler = handler;
+    handlers[device->handlers_nb].userdata = userdata;
+    device->handlers = handlers;
+    device->handlers_nb += 1;
+    pthread_mutex_unlock(&device->lock);
+    return true;
+
+error_unlock:
+    keyleds_set_error_errno();
+    pthread_mutex_unlock(&device->lock);
+    return false;
+}
+
+KEYLEDS_EXPORT bool keyleds_unregister_notification_handler(Keyleds * device,
+                                                            keyleds_notification_handler handler,
+                                                            void * userdata)
+{
+    assert(device != NULL);
+    bool found = false;
+
+    pthread_mutex_lock(&device->lock);
+    for (unsigned idx = 0; idx < device->handlers_nb; idx += 1) {
+        if (device->handlers[idx].handler == handler &&
+            device->handlers[idx].userdata == userdata) {
+            memmove(&device->handlers[idx], &device->handlers[idx + 1],
+                    (device->handlers_nb - idx - 1) * sizeof(device->handlers[0]));
+            device->handlers_nb -= 1;
+            if (device->handlers_nb == 0) { device->notifications_nb = 0; }
+            found = true;
+            break;
+        }
+    }
+    if (found) { wait_dispatch(device); }
+    pthread_mutex_unlock(&device->lock);
+    return found;
+}
+
+/* Called by keyleds_receive and keyleds_flush_fd, with device lock held */
+void keyleds_queue_notification(Keyleds * device, const uint8_t * message)
+{
+    assert(device != NULL);
+    assert(message != NULL);
+
+    if (device->handlers_nb == 0) { return; }   /* nobody listens, drop it */
+
+    const unsigned slot_size = 1 + device->max_report_size;
+    unsigned slot;
+    if (device->notifications_nb == KEYLEDS_NOTIFICATION_QUEUE_SIZE) {
+        KEYLEDS_LOG(INFO, "Notification queue full, dropping oldest report");
+        slot = device->notifications_head;
+        device->notifications_head = (slot + 1) % KEYLEDS_NOTIFICATION_QUEUE_SIZE;
+    } else {
+        slot = (device->notifications_head + device->notifications_nb)
+               % KEYLEDS_NOTIFICATION_QUEUE_SIZE;
+        device->notifications_nb += 1;
+    }
+    memcpy(device->notifications + slot * slot_size, message, slot_size);
+    keyleds_signal_notification(device);
+}
+
+/* With device lock held, wakes up whoever watches keyleds_event_fd */
+void keyleds_signal_notification(Keyleds * device)
+{
+    const uint64_t one = 1;
+    if (device->notify_fd < 0) { return; }
+    if (write(device->notify_fd, &one, sizeof(one)) < 0) {
+        KEYLEDS_LOG(DEBUG, "Cannot signal notification");  /* counter is already set */
+    }
+}
+
+static uint16_t lookup_feature_id(const Keyleds * device, uint8_t target_id, uint8_t feature_idx)
+{
+    /* Only use the cache, we must not issue calls from here */
+    for (unsigned idx = 0; device->features[idx].id != 0; idx += 1) {
+        if (device->features[idx].target_id == target_id &&
+            device->features[idx].index == feature_idx) {
+            return device->features[idx].id;
+        }
+    }
+    return 0;
+}
+
+KEYLEDS_EXPORT unsigned keyleds_dispatch_notifications(Keyleds * device)
+{
+    assert(device != NULL);
+
+    const unsigned slot_size = 1 + device->max_report_size;
+    uint8_t message[slot_size];
+    struct keyleds_notification notification;
+    unsigned count = 0;
+
+    /* Handlers may issue calls, which may queue more notifications, so the
+     * lock is released while they run. Each report is copied out of the ring
+     * along with the current handler list before invoking them. */
+    pthread_mutex_lock(&device->lock);
+    wait_dispatch(device);
+    if (device->notify_fd >= 0) {               /* we are about to empty the queue */
+        uint64_t value;
+        ssize_t nread = read(device->notify_fd, &value, sizeof(value));
+        (void)nread;                            /* EAGAIN if it was not signalled */
+    }
+    device->dispatch_thread = pthread_self();
+    device->dispatch_depth += 1;
+    while (device->notifications_nb > 0) {
+        struct keyleds_device_handler handlers[device->handlers_nb + 1];
+        unsigned handlers_nb = device->handlers_nb;
+
+        memcpy(message, device->notifications + device->notifications_head * slot_size,
+               slot_size);
+        device->notifications_head = (device->notifications_head + 1)
+                                     % KEYLEDS_NOTIFICATION_QUEUE_SIZE;
+        device->notifications_nb -= 1;
+        memcpy(handlers, device->handlers, handlers_nb * sizeof(handlers[0]));
+
+        notification.target_id = message[1];
+        if (message[2] == 0xff || message[2] == 0x8f) {
+            /* Error report: original feature, function and error code follow */
+            notification.feature_idx = message[3];
+            notification.function = message[4] >> 4;
+            notification.app_id = message[4] & 0xf;
+            notification.error = message[5];
+            notification.length = keyleds_find_report_size(device, message[0]) - 5;
+            notification.data = message + 6;
+        } else {
+            notification.feature_idx = message[2];
+            notification.function = message[3] >> 4;
+            notification.app_id = message[3] & 0xf;
+            notification.error = 0;
+            notification.length = keyleds_find_report_size(device, message[0]) - 3;
+            notification.data = keyleds_response_data(device, message);
+        }
+        notification.feature_id = lookup_feature_id(device, message[1],
+                                                     notification.feature_idx);
+        pthread_mutex_unlock(&device->lock);
+
+        for (unsigned idx = 0; idx < handlers_nb; idx += 1) {
+            (*handlers[idx].handler)(device, &notification, handlers[idx].userdata);
+        }
+        count += 1;
+        pthread_mutex_lock(&device->lock);
+    }
+    device->dispatch_depth -= 1;
+    if (device->dispatch_depth == 0) { pthread_cond_broadcast(&device->dispatch_done); }
+    pthread_mutex_unlock(&device->lock);
+    return count;
+}
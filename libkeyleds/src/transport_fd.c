@@ -0,0 +1,246 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/hidraw.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "keyleds.h"
+#include "keyleds/error.h"
+#include "keyleds/logging.h"
+
+/* File descriptor based transports: hidraw device nodes and sockets. Both
+ * preserve report boundaries, so they share everything but the way the report
+ * descriptor is obtained.
+ */
+
+struct fd_transport {
+    struct keyleds_transport base;
+    int         fd;
+    unsigned    descriptor_size;    /* only used for sockets */
+    uint8_t     descriptor[];
+};
+
+static void fd_close(struct keyleds_transport * transport)
+{
+    struct fd_transport * self = (struct fd_transport *)transport;
+    close(self->fd);
+    free(self);
+}
+
+static ssize_t fd_send(struct keyleds_transport * transport, const uint8_t * data, size_t size)
+{
+    struct fd_transport * self = (struct fd_transport *)transport;
+    return write(self->fd, data, size);
+}
+
+static ssize_t fd_receive(struct keyleds_transport * transport, uint8_t * data, size_t size,
+                          int timeout_us)
+{
+    struct fd_transport * self = (struct fd_transport *)transport;
+
+    if (timeout_us >= 0) {
+        fd_set set;
+        struct timeval timeout;
+        int err;
+
+        FD_ZERO(&set);
+        FD_SET(self->fd, &set);
+        timeout.tv_sec = timeout_us / 1000000;
+        timeout.tv_usec = timeout_us % 1000000;
+        if ((err = select(self->fd + 1, &set, NULL, NULL, &timeout)) <= 0) {
+            return err;
+        }
+    }
+    return read(self->fd, data, size);
+}
+
+static int fd_poll_fd(struct keyleds_transport * transport)
+{
+    return ((struct fd_transport *)transport)->fd;
+}
+
+/****************************************************************************/
+/* Hidraw */
+
+static bool hidraw_get_descriptor(struct keyleds_transport * transport,
+                                  uint8_t * buffer, unsigned * size)
+{
+    struct fd_transport * self = (struct fd_transport *)transport;
+    struct hidraw_report_descriptor descriptor;
+
+    if (ioctl(self->fd, HIDIOCGRDESCSIZE, &descriptor.size) < 0) { return false; }
+    if (ioctl(self->fd, HIDIOCGRDESC, &descriptor) < 0) { return false; }
+    if (descriptor.size > *size) {
+        errno = ENOBUFS;
+        return false;
+    }
+    memcpy(buffer, descriptor.value, descriptor.size);
+    *size = descriptor.size;
+    return true;
+}
+
+static const struct keyleds_transport_ops hidraw_ops = {
+    .close = fd_close,
+    .get_descriptor = hidraw_get_descriptor,
+    .send = fd_send,
+    .receive = fd_receive,
+    .poll_fd = fd_poll_fd
+};
+
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_hidraw(const char * path)
+{
+    assert(path != NULL);
+
+    struct fd_transport * self = malloc(sizeof(struct fd_transport));
+    if (self == NULL) {
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    self->base.ops = &hidraw_ops;
+    self->descriptor_size = 0;
+
+    if ((self->fd = open(path, O_RDWR)) < 0) {
+        keyleds_set_error_errno();
+        free(self);
+        return NULL;
+    }
+    fcntl(self->fd, F_SETFD, FD_CLOEXEC);
+    return &self->base;
+}
+
+/****************************************************************************/
+/* Sockets */
+
+static bool socket_get_descriptor(struct keyleds_transport * transport,
+                                  uint8_t * buffer, unsigned * size)
+{
+    struct fd_transport * self = (struct fd_transport *)transport;
+    if (self->descriptor_size > *size) {
+        errno = ENOBUFS;
+        return false;
+    }
+    memcpy(buffer, self->descriptor, self->descriptor_size);
+    *size = self->descriptor_size;
+    return true;
+}
+
+static const struct keyleds_transport_ops socket_ops = {
+    .close = fd_close,
+    .get_descriptor = socket_get_descriptor,
+    .send = fd_send,
+    .receive = fd_receive,
+    .poll_fd = fd_poll_fd
+};
+
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_socket(int fd,
+                                                                   const uint8_t * descriptor,
+                                                                   unsigned size)
+{
+    assert(fd >= 0);
+    assert(descriptor != NULL || size == 0);
+
+    struct fd_transport * self = malloc(sizeof(struct fd_transport) + size);
+    if (self == NULL) {
+        keyleds_set_error_errno();
+        close(fd);                              /* we own it, even on failure */
+        return NULL;
+    }
+    self->base.ops = &socket_ops;
+    self->fd = fd;
+    self->descriptor_size = size;
+    memcpy(self->descriptor, descriptor, size);
+    return &self->base;
+}
+
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_socketpair(int * peer,
+                                                                       const uint8_t * descriptor,
+                                                                       unsigned size)
+{
+    assert(peer != NULL);
+    int fds[2];
+    struct keyleds_transport * transport;
+
+    /* Sequenced packets preserve report boundaries, just as hidraw does */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    if ((transport = keyleds_transport_socket(fds[0], descriptor, size)) == NULL) {
+        close(fds[1]);                          /* fds[0] was closed by transport */
+        return NULL;
+    }
+    *peer = fds[1];
+    return transport;
+}
+
+/* Connect to a unix socket emulating a device, such as keyledssim. The peer
+ * sends the report descriptor as the first packet after accepting.
+ */
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_unix(const char * path)
+{
+    assert(path != NULL);
+    struct sockaddr_un address;
+    uint8_t descriptor[KEYLEDS_DESCRIPTOR_MAX_SIZE];
+    struct keyleds_transport * transport;
+    ssize_t nread;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        keyleds_set_error_errno();
+        goto error_close_fd;
+    }
+    if ((nread = read(fd, descriptor, sizeof(descriptor))) <= 0) {
+        if (nread == 0) { errno = ECONNRESET; }
+        keyleds_set_error_errno();
+        goto error_close_fd;
+    }
+    if ((transport = keyleds_transport_socket(fd, descriptor, (unsigned)nread)) == NULL) {
+        return NULL;                            /* fd was closed by transport */
+    }
+    return transport;
+
+error_close_fd:
+    close(fd);
+    return NULL;
+}
@@ -0,0 +1,157 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "keyleds.h"
+#include "keyleds/error.h"
+#include "keyleds/logging.h"
+
+/* In-process transport: every report sent is handed to a callback, which
+ * answers by pushing reports into the receive queue. As nothing else can
+ * produce reports, receive never blocks: an empty queue is a timeout.
+ */
+
+#define LOOPBACK_QUEUE_SIZE     (64)
+#define LOOPBACK_REPORT_SIZE    (64)
+
+struct loopback_report {
+    size_t      size;
+    uint8_t     data[LOOPBACK_REPORT_SIZE];
+};
+
+struct loopback_transport {
+    struct keyleds_transport base;
+    keyleds_loopback_handler handler;
+    void *      userdata;
+
+    struct loopback_report queue[LOOPBACK_QUEUE_SIZE];
+    unsigned    queue_head;
+    unsigned    queue_nb;
+
+    unsigned    descriptor_size;
+    uint8_t     descriptor[];
+};
+
+static void loopback_close(struct keyleds_transport * transport)
+{
+    free(transport);
+}
+
+static bool loopback_get_descriptor(struct keyleds_transport * transport,
+                                    uint8_t * buffer, unsigned * size)
+{
+    struct loopback_transport * self = (struct loopback_transport *)transport;
+    if (self->descriptor_size > *size) {
+        errno = ENOBUFS;
+        return false;
+    }
+    memcpy(buffer, self->descriptor, self->descriptor_size);
+    *size = self->descriptor_size;
+    return true;
+}
+
+static ssize_t loopback_send(struct keyleds_transport * transport,
+                             const uint8_t * data, size_t size)
+{
+    struct loopback_transport * self = (struct loopback_transport *)transport;
+    if (self->handler != NULL) {
+        (*self->handler)(transport, data, size, self->userdata);
+    }
+    return size;
+}
+
+static ssize_t loopback_receive(struct keyleds_transport * transport,
+                                uint8_t * data, size_t size, int timeout_us)
+{
+    struct loopback_transport * self = (struct loopback_transport *)transport;
+    (void)timeout_us;
+
+    if (self->queue_nb == 0) { return 0; }
+
+    const struct loopback_report * report = &self->queue[self->queue_head];
+    self->queue_head = (self->queue_head + 1) % LOOPBACK_QUEUE_SIZE;
+    self->queue_nb -= 1;
+
+    if (size > report->size) { size = report->size; }
+    memcpy(data, report->data, size);
+    return size;
+}
+
+static int loopback_poll_fd(struct keyleds_transport * transport)
+{
+    (void)transport;
+    return -1;
+}
+
+static const struct keyleds_transport_ops loopback_ops = {
+    .close = loopback_close,
+    .get_descriptor = loopback_get_descriptor,
+    .send = loopback_send,
+    .receive = loopback_receive,
+    .poll_fd = loopback_poll_fd
+};
+
+/****************************************************************************/
+
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_loopback(
+    const uint8_t * descriptor, unsigned size, keyleds_loopback_handler handler, void * userdata)
+{
+    assert(descriptor != NULL || size == 0);
+
+    struct loopback_transport * self = malloc(sizeof(struct loopback_transport) + size);
+    if (self == NULL) {
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    self->base.ops = &loopback_ops;
+    self->handler = handler;
+    self->userdata = userdata;
+    self->queue_head = 0;
+    self->queue_nb = 0;
+    self->descriptor_size = size;
+    memcpy(self->descriptor, descriptor, size);
+    return &self->base;
+}
+
+KEYLEDS_EXPORT bool keyleds_transport_loopback_push(struct keyleds_transport * transport,
+                                                    const uint8_t * report, size_t size)
+{
+    assert(transport != NULL);
+    assert(transport->ops == &loopback_ops);
+    assert(report != NULL);
+    struct loopback_transport * self = (struct loopback_transport *)transport;
+
+    if (size > LOOPBACK_REPORT_SIZE || self->queue_nb == LOOPBACK_QUEUE_SIZE) {
+        KEYLEDS_LOG(WARNING, "Loopback transport cannot queue report of %zu bytes", size);
+        errno = ENOBUFS;
+        keyleds_set_error_errno();
+        return false;
+    }
+
+    struct loopback_report * slot = &self->queue[
+        (self->queue_head + self->queue_nb) % LOOPBACK_QUEUE_SIZE
+    ];
+    slot->size = size;
+    memcpy(slot->data, report, size);
+    self->queue_nb += 1;
+    return true;
+}
@@ -0,0 +1,379 @@
+/* Keyleds -- Gaming keyboard tool
+ * Copyright (C) 2017 Julien Hartmann, juli1.hartmann@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "keyleds.h"
+#include "keyleds/error.h"
+#include "keyleds/logging.h"
+
+/* Recording file format, all integers little-endian:
+ *   header: "KLRC", u8 version, u8 reserved, u16 descriptor size, descriptor
+ *   records: u32 microseconds since previous record, u8 type, u8 size, data
+ * Receive timeouts are recorded as well, with no data, so replays reproduce
+ * them at the same points.
+ */
+#define RECORD_MAGIC        "KLRC"
+#define RECORD_VERSION      (1)
+#define RECORD_HEADER_SIZE  (8)
+#define RECORD_ENTRY_SIZE   (6)
+
+enum record_type {
+    RECORD_SEND = 0,
+    RECORD_RECEIVE = 1,
+    RECORD_TIMEOUT = 2
+};
+
+static uint64_t monotonic_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+static void sleep_us(uint64_t duration)
+{
+    struct timespec remaining = { (time_t)(duration / 1000000), (long)(duration % 1000000) * 1000 };
+    while (nanosleep(&remaining, &remaining) < 0 && errno == EINTR) {
+        /* resume sleeping */
+    }
+}
+
+static void write_le16(uint8_t * buffer, unsigned value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void write_le32(uint8_t * buffer, uint32_t value)
+{
+    write_le16(buffer, value & 0xffff);
+    write_le16(buffer + 2, value >> 16);
+}
+
+static unsigned read_le16(const uint8_t * buffer)
+{
+    return (unsigned)buffer[0] | (unsigned)buffer[1] << 8;
+}
+
+static uint32_t read_le32(const uint8_t * buffer)
+{
+    return (uint32_t)read_le16(buffer) | (uint32_t)read_le16(buffer + 2) << 16;
+}
+
+/****************************************************************************/
+/* Recorder: forwards everything to an inner transport, logging traffic */
+
+struct recorder_transport {
+    struct keyleds_transport base;
+    struct keyleds_transport * inner;
+    FILE *      file;
+    uint64_t    last;           /* timestamp of last record */
+};
+
+static void recorder_write(struct recorder_transport * self, enum record_type type,
+                           const uint8_t * data, size_t size)
+{
+    uint64_t now = monotonic_us();
+    uint64_t delta = now - self->last;
+    uint8_t entry[RECORD_ENTRY_SIZE];
+
+    if (size > UINT8_MAX) { size = UINT8_MAX; }
+    write_le32(entry, delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta);
+    entry[4] = (uint8_t)type;
+    entry[5] = (uint8_t)size;
+    (void)fwrite(entry, sizeof(entry), 1, self->file);
+    if (size > 0) { (void)fwrite(data, size, 1, self->file); }
+    (void)fflush(self->file);       /* recordings must survive the process crashing */
+    self->last = now;
+}
+
+static void recorder_close(struct keyleds_transport * transport)
+{
+    struct recorder_transport * self = (struct recorder_transport *)transport;
+    (*self->inner->ops->close)(self->inner);
+    fclose(self->file);
+    free(self);
+}
+
+static bool recorder_get_descriptor(struct keyleds_transport * transport,
+                                    uint8_t * buffer, unsigned * size)
+{
+    struct recorder_transport * self = (struct recorder_transport *)transport;
+    uint8_t header[RECORD_HEADER_SIZE];
+
+    if (!(*self->inner->ops->get_descriptor)(self->inner, buffer, size)) { return false; }
+
+    memcpy(header, RECORD_MAGIC, 4);
+    header[4] = RECORD_VERSION;
+    header[5] = 0;
+    write_le16(header + 6, *size);
+    (void)fwrite(header, sizeof(header), 1, self->file);
+    (void)fwrite(buffer, *size, 1, self->file);
+    (void)fflush(self->file);
+    self->last = monotonic_us();
+    return true;
+}
+
+static ssize_t recorder_send(struct keyleds_transport * transport,
+                             const uint8_t * data, size_t size)
+{
+    struct recorder_transport * self = (struct recorder_transport *)transport;
+    ssize_t result = (*self->inner->ops->send)(self->inner, data, size);
+    if (result > 0) { recorder_write(self, RECORD_SEND, data, (size_t)result); }
+    return result;
+}
+
+static ssize_t recorder_receive(struct keyleds_transport * transport,
+                                uint8_t * data, size_t size, int timeout_us)
+{
+    struct recorder_transport * self = (struct recorder_transport *)transport;
+    ssize_t result = (*self->inner->ops->receive)(self->inner, data, size, timeout_us);
+    if (result > 0) {
+        recorder_write(self, RECORD_RECEIVE, data, (size_t)result);
+    } else if (result == 0 && timeout_us != 0) {    /* polling is not worth recording */
+        recorder_write(self, RECORD_TIMEOUT, NULL, 0);
+    }
+    return result;
+}
+
+static int recorder_poll_fd(struct keyleds_transport * transport)
+{
+    struct recorder_transport * self = (struct recorder_transport *)transport;
+    return (*self->inner->ops->poll_fd)(self->inner);
+}
+
+static const struct keyleds_transport_ops recorder_ops = {
+    .close = recorder_close,
+    .get_descriptor = recorder_get_descriptor,
+    .send = recorder_send,
+    .receive = recorder_receive,
+    .poll_fd = recorder_poll_fd
+};
+
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_recorder(
+    struct keyleds_transport * inner, const char * path)
+{
+    assert(inner != NULL);
+    assert(path != NULL);
+
+    struct recorder_transport * self = malloc(sizeof(struct recorder_transport));
+    if (self == NULL) {
+        keyleds_set_error_errno();
+        goto error_close_inner;
+    }
+    if ((self->file = fopen(path, "wb")) == NULL) {
+        keyleds_set_error_errno();
+        goto error_free_self;
+    }
+    KEYLEDS_LOG(INFO, "Recording device traffic to %s", path);
+    self->base.ops = &recorder_ops;
+    self->inner = inner;
+    self->last = monotonic_us();
+    return &self->base;
+
+error_free_self:
+    free(self);
+error_close_inner:
+    (*inner->ops->close)(inner);
+    return NULL;
+}
+
+/****************************************************************************/
+/* Replay: serves recorded responses with their original timing */
+
+struct replay_transport {
+    struct keyleds_transport base;
+    uint8_t *   data;           /* whole recording */
+    size_t      size;
+    size_t      position;       /* offset of next record */
+    uint64_t    clock;          /* time at which the previous record was replayed */
+    unsigned    mismatches;     /* sent reports that differ from recording */
+};
+
+static bool replay_next(const struct replay_transport * self, /*@out@*/ enum record_type * type,
+                        /*@out@*/ uint32_t * delta, /*@out@*/ const uint8_t ** data,
+                        /*@out@*/ size_t * size)
+{
+    if (self->position + RECORD_ENTRY_SIZE > self->size) { return false; }
+    const uint8_t * entry = self->data + self->position;
+    *delta = read_le32(entry);
+    *type = (enum record_type)entry[4];
+    *size = entry[5];
+    *data = entry + RECORD_ENTRY_SIZE;
+    return self->position + RECORD_ENTRY_SIZE + *size <= self->size;
+}
+
+static void replay_close(struct keyleds_transport * transport)
+{
+    struct replay_transport * self = (struct replay_transport *)transport;
+    if (self->mismatches > 0) {
+        KEYLEDS_LOG(WARNING, "Replay ended with %u mismatching reports", self->mismatches);
+    }
+    free(self->data);
+    free(self);
+}
+
+static bool replay_get_descriptor(struct keyleds_transport * transport,
+                                  uint8_t * buffer, unsigned * size)
+{
+    struct replay_transport * self = (struct replay_transport *)transport;
+    unsigned descriptor_size = read_le16(self->data + 6);
+    if (descriptor_size > *size) {
+        errno = ENOBUFS;
+        return false;
+    }
+    memcpy(buffer, self->data + RECORD_HEADER_SIZE, descriptor_size);
+    *size = descriptor_size;
+    self->clock = monotonic_us();
+    return true;
+}
+
+static ssize_t replay_send(struct keyleds_transport * transport,
+                           const uint8_t * data, size_t size)
+{
+    struct replay_transport * self = (struct replay_transport *)transport;
+    enum record_type type;
+    uint32_t delta;
+    const uint8_t * expected;
+    size_t expected_size;
+    bool found;
+
+    /* Skip anything the device sent that the application never read */
+    while ((found = replay_next(self, &type, &delta, &expected, &expected_size)) &&
+           type != RECORD_SEND) {
+        self->position += RECORD_ENTRY_SIZE + expected_size;
+    }
+    if (!found) {
+        /* End of recording, or a partial record left by an interrupted recorder */
+        self->position = self->size;
+        KEYLEDS_LOG(WARNING, "Replay exhausted, sending to void");
+        self->mismatches += 1;
+        return size;
+    }
+    if (expected_size != size || memcmp(expected, data, size) != 0) {
+        KEYLEDS_LOG(WARNING, "Sent report differs from recording at offset %zu", self->position);
+        self->mismatches += 1;
+    }
+    self->position += RECORD_ENTRY_SIZE + expected_size;
+    self->clock = monotonic_us();
+    return size;
+}
+
+static ssize_t replay_receive(struct keyleds_transport * transport,
+                              uint8_t * data, size_t size, int timeout_us)
+{
+    struct replay_transport * self = (struct replay_transport *)transport;
+    enum record_type type;
+    uint32_t delta;
+    const uint8_t * recorded;
+    size_t recorded_size;
+    uint64_t now = monotonic_us();
+
+    if (!replay_next(self, &type, &delta, &recorded, &recorded_size) || type == RECORD_SEND) {
+        /* Application expects something the device did not send, wait the full timeout */
+        if (timeout_us > 0) { sleep_us((uint64_t)timeout_us); }
+        return 0;
+    }
+
+    uint64_t due = self->clock + delta;
+    if (timeout_us >= 0 && due > now + (uint64_t)timeout_us) {
+        sleep_us((uint64_t)timeout_us);
+        return 0;                       /* timing changed: record stays pending */
+    }
+    if (due > now) { sleep_us(due - now); }
+
+    self->position += RECORD_ENTRY_SIZE + recorded_size;
+    self->clock = due;
+    if (type == RECORD_TIMEOUT) { return 0; }
+
+    if (size > recorded_size) { size = recorded_size; }
+    memcpy(data, recorded, size);
+    return size;
+}
+
+static int replay_poll_fd(struct keyleds_transport * transport)
+{
+    (void)transport;
+    return -1;
+}
+
+static const struct keyleds_transport_ops replay_ops = {
+    .close = replay_close,
+    .get_descriptor = replay_get_descriptor,
+    .send = replay_send,
+    .receive = replay_receive,
+    .poll_fd = replay_poll_fd
+};
+
+KEYLEDS_EXPORT struct keyleds_transport * keyleds_transport_replay(const char * path)
+{
+    assert(path != NULL);
+    struct replay_transport * self;
+    FILE * file;
+    long size;
+
+    if ((file = fopen(path, "rb")) == NULL) {
+        keyleds_set_error_errno();
+        return NULL;
+    }
+    if ((self = malloc(sizeof(struct replay_transport))) == NULL) {
+        keyleds_set_error_errno();
+        goto error_close_file;
+    }
+    if (fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) < 0) {
+        keyleds_set_error_errno();
+        goto error_free_self;
+    }
+    if ((self->data = malloc((size_t)size)) == NULL) {
+        keyleds_set_error_errno();
+        goto error_free_self;
+    }
+    if (fread(self->data, 1, (size_t)size, file) != (size_t)size) {
+        keyleds_set_error(KEYLEDS_ERROR_IO_LENGTH);
+        goto error_free_data;
+    }
+    if (size < RECORD_HEADER_SIZE || memcmp(self->data, RECORD_MAGIC, 4) != 0 ||
+        self->data[4] != RECORD_VERSION ||
+        RECORD_HEADER_SIZE + read_le16(self->data + 6) > (unsigned long)size) {
+        KEYLEDS_LOG(ERROR, "%s is not a keyleds recording", path);
+        keyleds_set_error(KEYLEDS_ERROR_HIDREPORT);
+        goto error_free_data;
+    }
+    fclose(file);
+
+    self->base.ops = &replay_ops;
+    self->size = (size_t)size;
+    self->position = RECORD_HEADER_SIZE + read_le16(self->data + 6);
+    self->clock = monotonic_us();
+    self->mismatches = 0;
+    return &self->base;
+
+error_free_data:
+    free(self->data);
+error_free_self:
+    free(self);
+error_close_file:
+    fclose(file);
+    return NULL;
+}